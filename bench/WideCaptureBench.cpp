@@ -0,0 +1,597 @@
+// WideCaptureBench: runs the capture pipeline outside a game on synthetic input, so performance
+// changes can be measured reproducibly.
+//
+// - ScanBuffer: a stream of constant buffer updates (noise buffers plus one camera buffer with a
+//   moving view) through CameraController, before and after lock-on.
+// - StateBlock: capture/restore of the masks the draw and present paths use.
+// - GPU pipeline, per frame:
+//   - face replay: a synthetic scene (--draws cube meshes around a moving camera) writes its camera
+//     buffer through CameraController, and every draw is replayed into the six faces of a cube
+//     texture the way CubemapManager's per-face path does (state block, face constant buffer copies,
+//     face render target and depth slice, viewport). Layered rendering, face culling and temporal
+//     reuse are not exercised.
+//   - projection and NV12 conversion through the addon's own Graphics::OutputProjector, straight
+//     into the encoder's surfaces (fused kernel when they take UAVs, projection + raster conversion
+//     otherwise), then submission to the encoder.
+//
+// Usage: WideCaptureBench [--face N] [--projection 0-3] [--lut] [--frames N] [--buffers N]
+//   [--draws N] [--codec 0-3] [--tiles N] [--no-encode] [--output file.mp4] [--log]
+
+#include "pch.h"
+#include "Camera/CameraController.h"
+#include "Compute/Projection.h"
+#include "Core/Logger.h"
+#include "Graphics/GpuTimer.h"
+#include "Graphics/OutputProjector.h"
+#include "Graphics/StateBlock.h"
+#include "Video/EncoderFactory.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+using Microsoft::WRL::ComPtr;
+
+namespace {
+    struct Options {
+        uint32_t faceSize = 1024;
+        Compute::ProjectionType projection = Compute::ProjectionType::Equirectangular;
+        bool useLut = false;
+        uint32_t frames = 300;
+        uint32_t noiseBuffers = 32; // Non-camera constant buffer updates per frame
+        uint32_t draws = 200;       // Scene draws replayed into the faces per frame
+        uint32_t codec = 0;         // Config::EncoderCodec
+        uint32_t tiles = 1;
+        bool encode = true;
+        bool log = false;
+        std::string output = "widecapture_bench.mp4";
+    };
+
+    bool ParseOptions(int argc, char** argv, Options& options) {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+            if (arg == "--face" && hasValue) options.faceSize = (uint32_t)std::stoul(argv[++i]);
+            else if (arg == "--projection" && hasValue) options.projection = Compute::ToProjectionType((uint32_t)std::stoul(argv[++i]));
+            else if (arg == "--lut") options.useLut = true;
+            else if (arg == "--frames" && hasValue) options.frames = (uint32_t)std::stoul(argv[++i]);
+            else if (arg == "--buffers" && hasValue) options.noiseBuffers = (uint32_t)std::stoul(argv[++i]);
+            else if (arg == "--draws" && hasValue) options.draws = (uint32_t)std::stoul(argv[++i]);
+            else if (arg == "--codec" && hasValue) options.codec = (uint32_t)std::stoul(argv[++i]);
+            else if (arg == "--tiles" && hasValue) options.tiles = std::clamp((uint32_t)std::stoul(argv[++i]), 1u, 8u);
+            else if (arg == "--no-encode") options.encode = false;
+            else if (arg == "--output" && hasValue) options.output = argv[++i];
+            else if (arg == "--log") options.log = true;
+            else {
+                fprintf(stderr, "Unknown option %s\n", arg.c_str());
+                return false;
+            }
+        }
+        options.faceSize = std::max((options.faceSize + 15) & ~15u, 16u);
+        options.frames = std::max(options.frames, 1u);
+        return true;
+    }
+
+    double NowMs() {
+        static LARGE_INTEGER frequency = [] { LARGE_INTEGER f; QueryPerformanceFrequency(&f); return f; }();
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        return (double)now.QuadPart * 1000.0 / (double)frequency.QuadPart;
+    }
+
+    // One line of the report. bytes is the data a stage reads or writes per frame, 0 if meaningless.
+    void Report(const char* stage, uint32_t frames, double totalMs, double bytesPerFrame) {
+        double msPerFrame = totalMs / frames;
+        double fps = msPerFrame > 0.0 ? 1000.0 / msPerFrame : 0.0;
+        double mbps = msPerFrame > 0.0 ? bytesPerFrame / (msPerFrame * 1000.0) : 0.0;
+        printf("  %-28s %10.1f frames/s %9.3f ms/frame", stage, fps, msPerFrame);
+        if (bytesPerFrame > 0.0) printf(" %10.1f MB/s", mbps);
+        printf("\n");
+    }
+
+    // ---- ScanBuffer ----
+
+    void WriteCameraMatrices(std::vector<float>& data, uint32_t frame) {
+        // View at float 16, projection at float 48, like a typical per-frame camera CB
+        float yaw = (float)frame * 0.01f;
+        DirectX::XMMATRIX camera = DirectX::XMMatrixRotationY(yaw) * DirectX::XMMatrixTranslation(0.0f, 1.7f, (float)frame * 0.05f);
+        DirectX::XMMATRIX view = DirectX::XMMatrixInverse(nullptr, camera);
+        DirectX::XMMATRIX proj = DirectX::XMMatrixPerspectiveFovLH(DirectX::XM_PIDIV2 * 0.8f, 16.0f / 9.0f, 0.1f, 1000.0f);
+        DirectX::XMStoreFloat4x4((DirectX::XMFLOAT4X4*)(data.data() + 16), view);
+        DirectX::XMStoreFloat4x4((DirectX::XMFLOAT4X4*)(data.data() + 48), proj);
+    }
+
+    void BenchScanBuffer(const Options& options) {
+        printf("ScanBuffer (%u noise buffers per frame)\n", options.noiseBuffers);
+
+        // Deterministic content: sizes 256 B - 4 KB, values that never form a matrix
+        std::mt19937 rng(1234);
+        std::uniform_real_distribution<float> value(-100.0f, 100.0f);
+        std::uniform_int_distribution<uint32_t> rows(16, 256);
+        std::vector<std::vector<float>> noise(options.noiseBuffers);
+        double noiseBytes = 0.0;
+        for (auto& buffer : noise) {
+            buffer.resize(rows(rng) * 4);
+            for (float& f : buffer) f = value(rng);
+            noiseBytes += buffer.size() * sizeof(float);
+        }
+        std::vector<float> cameraData(128, 0.0f);
+
+        Camera::CameraController controller;
+
+        // Searching: nothing is the camera yet, every update goes through the full matrix search
+        double start = NowMs();
+        for (uint32_t frame = 0; frame < options.frames; ++frame) {
+            for (uint32_t i = 0; i < noise.size(); ++i) {
+                noise[i][frame % noise[i].size()] = (float)frame; // Games rewrite their buffers every frame
+                controller.OnUpdateBuffer({ 0x1000 + i }, noise[i].data(), noise[i].size() * sizeof(float));
+            }
+        }
+        Report("search", options.frames, NowMs() - start, noiseBytes);
+
+        // Locked on: the camera buffer is found once, everything else is skipped from then on
+        uint32_t lockFrames = 0;
+        start = NowMs();
+        for (uint32_t frame = 0; frame < options.frames; ++frame) {
+            for (uint32_t i = 0; i < noise.size(); ++i) {
+                controller.OnUpdateBuffer({ 0x1000 + i }, noise[i].data(), noise[i].size() * sizeof(float));
+            }
+            WriteCameraMatrices(cameraData, frame);
+            controller.OnUpdateBuffer({ 0x100 }, cameraData.data(), cameraData.size() * sizeof(float));
+            if (controller.GetCameraBuffer().handle == 0) lockFrames++;
+        }
+        Report("locked on", options.frames, NowMs() - start, noiseBytes + cameraData.size() * sizeof(float));
+        if (controller.GetCameraBuffer().handle != 0x100) printf("  camera buffer was not detected\n");
+        else if (lockFrames > 0) printf("  lock-on took %u frames\n", lockFrames);
+    }
+
+    // ---- StateBlock ----
+
+    template <uint32_t Mask>
+    void BenchStateBlock(ID3D11DeviceContext* ctx, const char* name, uint32_t iterations) {
+        double start = NowMs();
+        for (uint32_t i = 0; i < iterations; ++i) {
+            Graphics::StateBlock<Mask> state(ctx);
+        }
+        double ms = NowMs() - start;
+        printf("  %-28s %10.2f us per capture+restore\n", name, ms * 1000.0 / iterations);
+    }
+
+    // ---- GPU pipeline ----
+
+    // Synthetic scene: one cube mesh per draw scattered around the camera, transformed by the camera
+    // buffer WriteCameraMatrices fills (view at float 16, projection at float 48)
+    const char* kSceneShader = R"(
+cbuffer Camera : register(b1) {
+    row_major float4x4 g_Pad0;
+    row_major float4x4 g_View;
+    row_major float4x4 g_Pad1;
+    row_major float4x4 g_Proj;
+};
+struct VSOut { float4 pos : SV_Position; float3 color : COLOR; };
+VSOut VS(float3 pos : POSITION, float3 color : COLOR) {
+    VSOut o;
+    o.pos = mul(mul(float4(pos, 1.0), g_View), g_Proj);
+    o.color = color;
+    return o;
+}
+float4 PS(VSOut i) : SV_Target { return float4(i.color, 1.0); }
+)";
+
+    struct SceneVertex {
+        float position[3];
+        float color[3];
+    };
+
+    class PipelineBench {
+    public:
+        PipelineBench(ID3D11Device* device, ID3D11DeviceContext* ctx, const Options& options)
+            : m_device(device), m_ctx(ctx), m_options(options) {}
+
+        bool Initialize() {
+            Compute::OutputSize output = Compute::GetOutputSize(m_options.projection, m_options.faceSize);
+
+            if (m_options.encode) {
+                Video::EncoderSettings settings;
+                settings.width = (int)output.width;
+                settings.height = (int)output.height;
+                settings.filename = m_options.output;
+                settings.tiles = m_options.tiles;
+                settings.dropOldest = false; // Every frame is encoded, throughput is what's measured
+                m_encoder = Video::EncoderFactory::Create(m_device, settings, m_options.codec);
+                if (!m_encoder) printf("  no encoder available, timing projection and NV12 only\n");
+            }
+            if (!m_encoder && !CreateLocalSurface(output)) return false;
+
+            // The addon's projection and NV12 passes, set up the way CubemapManager does
+            Graphics::OutputProjector::Settings settings;
+            settings.projection = m_options.projection;
+            settings.width = output.width;
+            settings.height = output.height;
+            settings.directionLut = m_options.useLut;
+            settings.surfaceBindFlags = m_encoder ? m_encoder->GetSurfaceBindFlags() : m_localBindFlags;
+            if (!m_projector.Initialize(m_device, settings)) {
+                fprintf(stderr, "Failed to set up the projection\n");
+                return false;
+            }
+
+            return CreateCube() && CreateScene() && CreateTimers();
+        }
+
+        void Run() {
+            printf("GPU pipeline: %u px faces, %u draws, %s %ux%u, %s%s, %s\n", m_options.faceSize, m_options.draws,
+                Compute::GetProjectionName(m_options.projection), m_projector.GetWidth(), m_projector.GetHeight(),
+                m_projector.IsFused() ? "fused NV12 kernel" : "projection + raster NV12", m_projector.UsesDirectionLut() ? " with LUT" : "",
+                m_encoder ? m_encoder->GetName().c_str() : "no encoder");
+
+            double replayMs = 0.0;
+            double submitMs = 0.0;
+            double start = NowMs();
+            for (uint32_t frame = 0; frame < m_options.frames; ++frame) {
+                for (Graphics::GpuTimer& timer : m_timers) timer.BeginFrame(m_ctx);
+                double replayStart = NowMs();
+                ReplayDraws(frame);
+                replayMs += NowMs() - replayStart;
+                submitMs += ProjectAndSubmit();
+                for (Graphics::GpuTimer& timer : m_timers) timer.EndFrame(m_ctx);
+                ResolveTimers();
+            }
+            double renderedMs = NowMs() - start;
+
+            // Whatever the encoder still has queued belongs to the measured frames
+            if (m_encoder) m_encoder->Finish();
+            double totalMs = NowMs() - start;
+            DrainTimers();
+
+            uint32_t frames = m_options.frames;
+            double outputPixels = (double)m_projector.GetWidth() * m_projector.GetHeight();
+            bool fused = m_projector.IsFused();
+            Report("CPU camera + face replay", frames, replayMs, 0.0);
+            Report("GPU face replay", m_resolved[kReplay], m_gpuMs[kReplay], 0.0);
+            Report("GPU projection", m_resolved[kProjection], m_gpuMs[kProjection], outputPixels * (fused ? 1.5 : 4.0));
+            if (!fused) Report("GPU NV12 passes", m_resolved[kConvert], m_gpuMs[kConvert], outputPixels * 1.5);
+            Report("CPU acquire + submit", frames, submitMs, outputPixels * 1.5);
+            Report("render loop (wall)", frames, renderedMs, outputPixels * 1.5);
+            if (m_encoder) Report("encode incl. flush (wall)", frames, totalMs, outputPixels * 1.5);
+        }
+
+    private:
+        enum { kReplay, kProjection, kConvert, kStages };
+        static constexpr UINT kCameraSlot = 1; // register(b1) in kSceneShader
+        static constexpr uint32_t kCubeVertices = 8;
+        static constexpr uint32_t kCubeIndices = 36;
+
+        bool CreateLocalSurface(const Compute::OutputSize& output) {
+            // Stand-in for the encoder pool when nothing encodes: same format, same bind flags logic
+            D3D11_FEATURE_DATA_FORMAT_SUPPORT2 support2 = { DXGI_FORMAT_NV12 };
+            bool typedUav = SUCCEEDED(m_device->CheckFeatureSupport(D3D11_FEATURE_FORMAT_SUPPORT2, &support2, sizeof(support2))) &&
+                (support2.OutFormatSupport2 & D3D11_FORMAT_SUPPORT2_UAV_TYPED_STORE);
+            m_localBindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE | (typedUav ? D3D11_BIND_UNORDERED_ACCESS : 0);
+
+            D3D11_TEXTURE2D_DESC desc = {};
+            desc.Width = output.width;
+            desc.Height = output.height;
+            desc.MipLevels = 1;
+            desc.ArraySize = 1;
+            desc.Format = DXGI_FORMAT_NV12;
+            desc.SampleDesc.Count = 1;
+            desc.BindFlags = m_localBindFlags;
+            if (FAILED(m_device->CreateTexture2D(&desc, nullptr, m_localSurface.GetAddressOf()))) {
+                fprintf(stderr, "Failed to create NV12 texture\n");
+                return false;
+            }
+            return true;
+        }
+
+        bool CreateCube() {
+            D3D11_TEXTURE2D_DESC desc = {};
+            desc.Width = m_options.faceSize;
+            desc.Height = m_options.faceSize;
+            desc.MipLevels = 1;
+            desc.ArraySize = 6;
+            desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+            desc.SampleDesc.Count = 1;
+            desc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
+            desc.MiscFlags = D3D11_RESOURCE_MISC_TEXTURECUBE;
+            if (FAILED(m_device->CreateTexture2D(&desc, nullptr, m_cube.GetAddressOf()))) return false;
+
+            D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+            srvDesc.Format = desc.Format;
+            srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURECUBE;
+            srvDesc.TextureCube.MipLevels = 1;
+            if (FAILED(m_device->CreateShaderResourceView(m_cube.Get(), &srvDesc, m_cubeSrv.GetAddressOf()))) return false;
+
+            srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
+            srvDesc.Texture2DArray.MipLevels = 1;
+            srvDesc.Texture2DArray.ArraySize = 6;
+            if (FAILED(m_device->CreateShaderResourceView(m_cube.Get(), &srvDesc, m_cubeArraySrv.GetAddressOf()))) return false;
+
+            for (UINT i = 0; i < 6; ++i) {
+                D3D11_RENDER_TARGET_VIEW_DESC rtvDesc = {};
+                rtvDesc.Format = desc.Format;
+                rtvDesc.ViewDimension = D3D11_RTV_DIMENSION_TEXTURE2DARRAY;
+                rtvDesc.Texture2DArray.FirstArraySlice = i;
+                rtvDesc.Texture2DArray.ArraySize = 1;
+                if (FAILED(m_device->CreateRenderTargetView(m_cube.Get(), &rtvDesc, m_faceRtvs[i].GetAddressOf()))) return false;
+            }
+
+            // Face depth like CubemapManager's: one array, a DSV per slice plus one clearing all six
+            desc.Format = DXGI_FORMAT_D32_FLOAT;
+            desc.BindFlags = D3D11_BIND_DEPTH_STENCIL;
+            desc.MiscFlags = 0;
+            ComPtr<ID3D11Texture2D> depth;
+            if (FAILED(m_device->CreateTexture2D(&desc, nullptr, depth.GetAddressOf()))) return false;
+            D3D11_DEPTH_STENCIL_VIEW_DESC dsvDesc = {};
+            dsvDesc.Format = desc.Format;
+            dsvDesc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2DARRAY;
+            dsvDesc.Texture2DArray.ArraySize = 6;
+            if (FAILED(m_device->CreateDepthStencilView(depth.Get(), &dsvDesc, m_faceArrayDsv.GetAddressOf()))) return false;
+            for (UINT i = 0; i < 6; ++i) {
+                dsvDesc.Texture2DArray.FirstArraySlice = i;
+                dsvDesc.Texture2DArray.ArraySize = 1;
+                if (FAILED(m_device->CreateDepthStencilView(depth.Get(), &dsvDesc, m_faceDsvs[i].GetAddressOf()))) return false;
+            }
+            return true;
+        }
+
+        bool CreateScene() {
+            ComPtr<ID3DBlob> vsCode, psCode, errors;
+            if (FAILED(D3DCompile(kSceneShader, strlen(kSceneShader), "BenchScene", nullptr, nullptr, "VS", "vs_5_0", 0, 0, vsCode.GetAddressOf(), errors.GetAddressOf())) ||
+                FAILED(D3DCompile(kSceneShader, strlen(kSceneShader), "BenchScene", nullptr, nullptr, "PS", "ps_5_0", 0, 0, psCode.GetAddressOf(), errors.ReleaseAndGetAddressOf())) ||
+                FAILED(m_device->CreateVertexShader(vsCode->GetBufferPointer(), vsCode->GetBufferSize(), nullptr, m_sceneVS.GetAddressOf())) ||
+                FAILED(m_device->CreatePixelShader(psCode->GetBufferPointer(), psCode->GetBufferSize(), nullptr, m_scenePS.GetAddressOf())))
+            {
+                fprintf(stderr, "Failed to create the scene shaders%s%s\n", errors ? ": " : "", errors ? (const char*)errors->GetBufferPointer() : "");
+                return false;
+            }
+
+            D3D11_INPUT_ELEMENT_DESC layout[] = {
+                { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+                { "COLOR", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+            };
+            if (FAILED(m_device->CreateInputLayout(layout, 2, vsCode->GetBufferPointer(), vsCode->GetBufferSize(), m_sceneLayout.GetAddressOf()))) return false;
+
+            // Deterministic placement on a shell around the camera path, so every face gets draws
+            std::mt19937 rng(5678);
+            std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+            std::uniform_real_distribution<float> distance(5.0f, 40.0f);
+            std::vector<SceneVertex> vertices;
+            vertices.reserve(std::max(m_options.draws, 1u) * kCubeVertices);
+            for (uint32_t draw = 0; draw < std::max(m_options.draws, 1u); ++draw) {
+                DirectX::XMVECTOR dir = DirectX::XMVector3Normalize(DirectX::XMVectorSet(unit(rng), unit(rng), unit(rng), 0.0f));
+                DirectX::XMFLOAT3 center;
+                DirectX::XMStoreFloat3(&center, DirectX::XMVectorScale(dir, distance(rng)));
+                float half = 0.5f + 0.5f * (unit(rng) + 1.0f);
+                for (uint32_t v = 0; v < kCubeVertices; ++v) {
+                    SceneVertex vertex = {};
+                    vertex.position[0] = center.x + ((v & 1) ? half : -half);
+                    vertex.position[1] = center.y + ((v & 2) ? half : -half);
+                    vertex.position[2] = center.z + ((v & 4) ? half : -half);
+                    vertex.color[0] = (v & 1) ? 1.0f : 0.2f;
+                    vertex.color[1] = (v & 2) ? 1.0f : 0.2f;
+                    vertex.color[2] = (float)draw / std::max(m_options.draws, 1u);
+                    vertices.push_back(vertex);
+                }
+            }
+            static const uint16_t indices[kCubeIndices] = {
+                0, 2, 1, 1, 2, 3,  4, 5, 6, 5, 7, 6,  0, 1, 4, 1, 5, 4,
+                2, 6, 3, 3, 6, 7,  0, 4, 2, 2, 4, 6,  1, 3, 5, 3, 7, 5,
+            };
+
+            D3D11_BUFFER_DESC desc = {};
+            desc.ByteWidth = (UINT)(vertices.size() * sizeof(SceneVertex));
+            desc.Usage = D3D11_USAGE_IMMUTABLE;
+            desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+            D3D11_SUBRESOURCE_DATA data = { vertices.data() };
+            if (FAILED(m_device->CreateBuffer(&desc, &data, m_vertexBuffer.GetAddressOf()))) return false;
+            desc.ByteWidth = sizeof(indices);
+            desc.BindFlags = D3D11_BIND_INDEX_BUFFER;
+            data.pSysMem = indices;
+            if (FAILED(m_device->CreateBuffer(&desc, &data, m_indexBuffer.GetAddressOf()))) return false;
+
+            // The game's camera buffer, and the persistent per-face copies the draw path rebinds
+            desc.ByteWidth = (UINT)(m_cameraData.size() * sizeof(float));
+            desc.Usage = D3D11_USAGE_DEFAULT;
+            desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+            if (FAILED(m_device->CreateBuffer(&desc, nullptr, m_cameraBuffer.GetAddressOf()))) return false;
+            desc.Usage = D3D11_USAGE_DYNAMIC;
+            desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+            for (ComPtr<ID3D11Buffer>& buffer : m_faceBuffers) {
+                if (FAILED(m_device->CreateBuffer(&desc, nullptr, buffer.GetAddressOf()))) return false;
+            }
+
+            // Cube winding isn't consistent across faces of the mesh, nothing is culled
+            D3D11_RASTERIZER_DESC rsDesc = {};
+            rsDesc.FillMode = D3D11_FILL_SOLID;
+            rsDesc.CullMode = D3D11_CULL_NONE;
+            rsDesc.DepthClipEnable = TRUE;
+            rsDesc.ScissorEnable = TRUE;
+            return SUCCEEDED(m_device->CreateRasterizerState(&rsDesc, m_rasterizer.GetAddressOf()));
+        }
+
+        bool CreateTimers() {
+            for (Graphics::GpuTimer& timer : m_timers) {
+                if (!timer.Initialize(m_device, 4)) {
+                    fprintf(stderr, "Timestamp queries unavailable\n");
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // The face copies follow the controller's snapshot, refilled only when the camera data changed
+        bool UpdateFaceBuffers() {
+            Camera::CameraSnapshotPtr snap = m_camera.GetSnapshot();
+            if (!snap->valid) return false;
+            if (snap->generation == m_faceGeneration) return true;
+            for (int i = 0; i < 6; ++i) {
+                D3D11_MAPPED_SUBRESOURCE mapped;
+                if (FAILED(m_ctx->Map(m_faceBuffers[i].Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped))) return false;
+                memcpy(mapped.pData, snap->faceData[i].data(), std::min(m_cameraData.size() * sizeof(float), snap->faceData[i].size()));
+                m_ctx->Unmap(m_faceBuffers[i].Get(), 0);
+            }
+            m_faceGeneration = snap->generation;
+            return true;
+        }
+
+        void ReplayDraws(uint32_t frame) {
+            // The game writes its camera, CameraController builds the face matrices from it
+            WriteCameraMatrices(m_cameraData, frame);
+            m_ctx->UpdateSubresource(m_cameraBuffer.Get(), 0, nullptr, m_cameraData.data(), 0, 0);
+            m_camera.OnUpdateBuffer({ (uint64_t)m_cameraBuffer.Get() }, m_cameraData.data(), m_cameraData.size() * sizeof(float));
+
+            Graphics::GpuTimer::Interval timing(&m_timers[kReplay], m_ctx);
+            m_ctx->ClearDepthStencilView(m_faceArrayDsv.Get(), D3D11_CLEAR_DEPTH, 1.0f, 0);
+            if (m_options.draws == 0 || !UpdateFaceBuffers()) return;
+
+            // The game's pipeline state for its scene draws
+            UINT stride = sizeof(SceneVertex), offset = 0;
+            m_ctx->IASetInputLayout(m_sceneLayout.Get());
+            m_ctx->IASetVertexBuffers(0, 1, m_vertexBuffer.GetAddressOf(), &stride, &offset);
+            m_ctx->IASetIndexBuffer(m_indexBuffer.Get(), DXGI_FORMAT_R16_UINT, 0);
+            m_ctx->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+            m_ctx->VSSetShader(m_sceneVS.Get(), nullptr, 0);
+            m_ctx->VSSetConstantBuffers(kCameraSlot, 1, m_cameraBuffer.GetAddressOf());
+            m_ctx->PSSetShader(m_scenePS.Get(), nullptr, 0);
+            m_ctx->RSSetState(m_rasterizer.Get());
+
+            // What CubemapManager::ProcessDraw does per intercepted draw on the per-face path
+            D3D11_RECT rect = { 0, 0, (LONG)m_options.faceSize, (LONG)m_options.faceSize };
+            D3D11_VIEWPORT vp = { 0.0f, 0.0f, (float)m_options.faceSize, (float)m_options.faceSize, 0.0f, 1.0f };
+            for (uint32_t draw = 0; draw < m_options.draws; ++draw) {
+                Graphics::StateBlock<Graphics::State::VS_CB | Graphics::State::OM_RT | Graphics::State::RS_VP> state(m_ctx);
+                for (int i = 0; i < 6; ++i) {
+                    m_ctx->VSSetConstantBuffers(kCameraSlot, 1, m_faceBuffers[i].GetAddressOf());
+                    m_ctx->OMSetRenderTargets(1, m_faceRtvs[i].GetAddressOf(), m_faceDsvs[i].Get());
+                    m_ctx->RSSetViewports(1, &vp);
+                    m_ctx->RSSetScissorRects(1, &rect);
+                    m_ctx->DrawIndexed(kCubeIndices, 0, (INT)(draw * kCubeVertices));
+                }
+            }
+            m_ctx->ClearState();
+        }
+
+        // Returns the CPU time spent acquiring and submitting the surface
+        double ProjectAndSubmit() {
+            double cpuMs = 0.0;
+            double start = NowMs();
+            Video::EncoderSurface surface;
+            if (m_encoder) {
+                if (!m_encoder->AcquireSurface(surface)) return NowMs() - start;
+            } else {
+                surface.texture = m_localSurface.Get();
+            }
+            cpuMs += NowMs() - start;
+
+            bool written = m_projector.Project(m_ctx, m_cubeSrv.Get(), m_cubeArraySrv.Get(), nullptr, surface,
+                                               &m_timers[kProjection], &m_timers[kConvert]);
+            if (m_encoder) {
+                start = NowMs();
+                if (written) m_encoder->SubmitSurface(surface);
+                else m_encoder->DiscardSurface(surface);
+                cpuMs += NowMs() - start;
+            }
+            return cpuMs;
+        }
+
+        void ResolveTimers() {
+            for (int i = 0; i < kStages; ++i) {
+                double ms;
+                while (m_timers[i].Resolve(m_ctx, ms)) {
+                    m_gpuMs[i] += ms;
+                    m_resolved[i]++;
+                }
+            }
+        }
+
+        void DrainTimers() {
+            // The last few frames' queries, without letting a lost sample hang the bench
+            m_ctx->Flush();
+            double deadline = NowMs() + 500.0;
+            while (NowMs() < deadline) {
+                ResolveTimers();
+                uint32_t resolved = m_resolved[kReplay];
+                if (resolved >= m_options.frames) break;
+                Sleep(1);
+            }
+            for (uint32_t& count : m_resolved) count = std::max(count, 1u);
+        }
+
+        ID3D11Device* m_device;
+        ID3D11DeviceContext* m_ctx;
+        const Options& m_options;
+
+        std::unique_ptr<Video::Encoder> m_encoder;
+        ComPtr<ID3D11Texture2D> m_localSurface;
+        UINT m_localBindFlags = 0;
+        Graphics::OutputProjector m_projector;
+
+        ComPtr<ID3D11Texture2D> m_cube;
+        ComPtr<ID3D11ShaderResourceView> m_cubeSrv;
+        ComPtr<ID3D11ShaderResourceView> m_cubeArraySrv;
+        ComPtr<ID3D11RenderTargetView> m_faceRtvs[6];
+        ComPtr<ID3D11DepthStencilView> m_faceDsvs[6];
+        ComPtr<ID3D11DepthStencilView> m_faceArrayDsv;
+
+        // Synthetic scene and its camera
+        Camera::CameraController m_camera;
+        std::vector<float> m_cameraData = std::vector<float>(128, 0.0f);
+        ComPtr<ID3D11Buffer> m_cameraBuffer;
+        ComPtr<ID3D11Buffer> m_faceBuffers[6];
+        uint64_t m_faceGeneration = 0;
+        ComPtr<ID3D11Buffer> m_vertexBuffer;
+        ComPtr<ID3D11Buffer> m_indexBuffer;
+        ComPtr<ID3D11InputLayout> m_sceneLayout;
+        ComPtr<ID3D11VertexShader> m_sceneVS;
+        ComPtr<ID3D11PixelShader> m_scenePS;
+        ComPtr<ID3D11RasterizerState> m_rasterizer;
+
+        Graphics::GpuTimer m_timers[kStages];
+        double m_gpuMs[kStages] = {};
+        uint32_t m_resolved[kStages] = {};
+    };
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!ParseOptions(argc, argv, options)) return 1;
+    // Console output stays redirectable unless the addon's log is asked for
+    if (options.log) Logger::Init();
+
+    // The camera scan remembers layouts per executable next to it; start from nothing so runs compare
+    std::error_code ec;
+    wchar_t exePath[MAX_PATH] = {};
+    if (GetModuleFileNameW(nullptr, exePath, MAX_PATH) != 0) {
+        std::filesystem::remove(std::filesystem::path(exePath).parent_path() / L"WideCapture.cache.json", ec);
+    }
+
+    BenchScanBuffer(options);
+
+    ComPtr<ID3D11Device> device;
+    ComPtr<ID3D11DeviceContext> ctx;
+    UINT flags = D3D11_CREATE_DEVICE_BGRA_SUPPORT | D3D11_CREATE_DEVICE_VIDEO_SUPPORT;
+    D3D_FEATURE_LEVEL level = D3D_FEATURE_LEVEL_11_0;
+    if (FAILED(D3D11CreateDevice(nullptr, D3D_DRIVER_TYPE_HARDWARE, nullptr, flags, &level, 1, D3D11_SDK_VERSION,
+                                 device.GetAddressOf(), nullptr, ctx.GetAddressOf())))
+    {
+        fprintf(stderr, "Failed to create a D3D11 device\n");
+        if (options.log) Logger::Shutdown();
+        return 1;
+    }
+
+    printf("StateBlock\n");
+    BenchStateBlock<Graphics::State::VS_CB | Graphics::State::OM_RT | Graphics::State::RS_VP>(ctx.Get(), "face replay mask", 100000);
+    BenchStateBlock<Graphics::State::CS | Graphics::State::IA | Graphics::State::VS | Graphics::State::PS | Graphics::State::PS_SRV |
+                    Graphics::State::PS_SAMPLER | Graphics::State::RS_VP | Graphics::State::OM_RT>(ctx.Get(), "projection mask", 20000);
+    BenchStateBlock<Graphics::State::All>(ctx.Get(), "all", 20000);
+
+    int result = 0;
+    {
+        PipelineBench pipeline(device.Get(), ctx.Get(), options);
+        if (pipeline.Initialize()) pipeline.Run();
+        else result = 1;
+    }
+
+    if (options.log) Logger::Shutdown();
+    return result;
+}
@@ -0,0 +1,153 @@
+#include "pch.h"
+#include "BufferCache.h"
+#include <cstring>
+
+namespace Camera {
+
+    static_assert(BufferCache::kMaxEntries <= 64 && BufferCache::kSmallSlots <= 64 && BufferCache::kLargeSlots <= 64,
+                  "Free lists are 64-bit masks");
+
+    static uint64_t LowBits(uint32_t count) {
+        return count >= 64 ? ~0ull : (1ull << count) - 1;
+    }
+
+    static uint32_t LowestSetBit(uint64_t mask) {
+        unsigned long index;
+        _BitScanForward64(&index, mask);
+        return (uint32_t)index;
+    }
+
+    BufferCache::BufferCache() {
+        m_arena.resize((size_t)kSmallSlots * kSmallSlotSize + (size_t)kLargeSlots * kLargeSlotSize);
+        Clear();
+    }
+
+    void BufferCache::Clear() {
+        for (uint16_t& bucket : m_table) bucket = kEmpty;
+        for (Entry& entry : m_entries) entry = Entry();
+        m_freeEntries = LowBits(kMaxEntries);
+        m_freeSmall = LowBits(kSmallSlots);
+        m_freeLarge = LowBits(kLargeSlots);
+    }
+
+    uint32_t BufferCache::Hash(uint64_t handle) {
+        // Handles are object pointers, the low bits carry little entropy
+        handle ^= handle >> 33;
+        handle *= 0xff51afd7ed558ccdull;
+        handle ^= handle >> 33;
+        return (uint32_t)handle & (kTableSize - 1);
+    }
+
+    uint32_t BufferCache::FindIndex(uint64_t handle) const {
+        for (uint32_t i = Hash(handle), probes = 0; probes < kTableSize; i = (i + 1) & (kTableSize - 1), ++probes) {
+            if (m_table[i] == kEmpty) break;
+            if (m_entries[m_table[i]].handle == handle) return i;
+        }
+        return kTableSize;
+    }
+
+    ConstantBufferState* BufferCache::Find(uint64_t handle) {
+        uint32_t index = FindIndex(handle);
+        return index < kTableSize ? &m_entries[m_table[index]].state : nullptr;
+    }
+
+    ConstantBufferState* BufferCache::Store(uint64_t handle, const void* data, uint32_t size, uint64_t pinnedHandle) {
+        if (handle == 0 || size == 0 || size > kLargeSlotSize) return nullptr;
+        bool large = size > kSmallSlotSize;
+
+        uint32_t index = FindIndex(handle);
+        if (index == kTableSize) {
+            if (m_freeEntries == 0 && !EvictOldest(pinnedHandle, -1)) return nullptr;
+
+            uint16_t entryIndex = (uint16_t)LowestSetBit(m_freeEntries);
+            m_freeEntries &= ~(1ull << entryIndex);
+            m_entries[entryIndex] = Entry();
+            m_entries[entryIndex].handle = handle;
+
+            index = Hash(handle);
+            while (m_table[index] != kEmpty) index = (index + 1) & (kTableSize - 1);
+            m_table[index] = entryIndex;
+        }
+
+        Entry& entry = m_entries[m_table[index]];
+        if (entry.slot == kNoSlot || entry.large != large) {
+            ReleaseSlot(entry);
+            if (!AcquireSlot(entry, large, pinnedHandle)) {
+                EraseAt(FindIndex(handle)); // Eviction may have moved the bucket
+                return nullptr;
+            }
+        }
+
+        size_t offset = entry.large ? (size_t)kSmallSlots * kSmallSlotSize + (size_t)entry.slot * kLargeSlotSize
+                                    : (size_t)entry.slot * kSmallSlotSize;
+        uint8_t* dest = m_arena.data() + offset;
+        memcpy(dest, data, size);
+
+        entry.state.data = dest;
+        entry.state.size = size;
+        entry.lastUse = ++m_tick;
+        return &entry.state;
+    }
+
+    void BufferCache::Erase(uint64_t handle) {
+        uint32_t index = FindIndex(handle);
+        if (index < kTableSize) EraseAt(index);
+    }
+
+    void BufferCache::EraseAt(uint32_t tableIndex) {
+        uint16_t entryIndex = m_table[tableIndex];
+        ReleaseSlot(m_entries[entryIndex]);
+        m_entries[entryIndex] = Entry();
+        m_freeEntries |= 1ull << entryIndex;
+
+        // Backward-shift deletion: pull later entries of the probe run into the hole
+        uint32_t hole = tableIndex;
+        for (uint32_t j = (hole + 1) & (kTableSize - 1); m_table[j] != kEmpty; j = (j + 1) & (kTableSize - 1)) {
+            uint32_t home = Hash(m_entries[m_table[j]].handle);
+            bool homeInRange = hole <= j ? (hole < home && home <= j) : (hole < home || home <= j);
+            if (homeInRange) continue;
+            m_table[hole] = m_table[j];
+            hole = j;
+        }
+        m_table[hole] = kEmpty;
+    }
+
+    void BufferCache::ReleaseSlot(Entry& entry) {
+        if (entry.slot == kNoSlot) return;
+        if (entry.large) m_freeLarge |= 1ull << entry.slot;
+        else             m_freeSmall |= 1ull << entry.slot;
+        entry.slot = kNoSlot;
+        entry.state.data = nullptr;
+        entry.state.size = 0;
+    }
+
+    bool BufferCache::AcquireSlot(Entry& entry, bool large, uint64_t pinnedHandle) {
+        uint64_t& freeSlots = large ? m_freeLarge : m_freeSmall;
+        // The entry being filled has no slot, so eviction can't pick it
+        if (freeSlots == 0 && !EvictOldest(pinnedHandle, large ? 1 : 0)) return false;
+
+        entry.slot = (uint16_t)LowestSetBit(freeSlots);
+        entry.large = large;
+        freeSlots &= ~(1ull << entry.slot);
+        return true;
+    }
+
+    bool BufferCache::EvictOldest(uint64_t pinnedHandle, int requiredClass) {
+        uint32_t oldest = kTableSize;
+        uint64_t oldestUse = ~0ull;
+        for (uint32_t i = 0; i < kTableSize; ++i) {
+            if (m_table[i] == kEmpty) continue;
+            const Entry& entry = m_entries[m_table[i]];
+            if (entry.handle == pinnedHandle) continue;
+            if (requiredClass >= 0 && (entry.slot == kNoSlot || entry.large != (requiredClass == 1))) continue;
+            if (entry.lastUse < oldestUse) {
+                oldestUse = entry.lastUse;
+                oldest = i;
+            }
+        }
+        if (oldest == kTableSize) return false;
+
+        EraseAt(oldest);
+        return true;
+    }
+}
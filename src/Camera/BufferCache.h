@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+namespace Camera {
+
+    // What the scanner remembers about one candidate buffer. data points into the BufferCache arena
+    // and stays valid until the entry is stored again, evicted or erased.
+    struct ConstantBufferState {
+        const uint8_t* data = nullptr;
+        uint32_t size = 0;
+        bool isCamera = false;
+        int viewMatrixOffset = -1;
+        int projMatrixOffset = -1;
+    };
+
+    // Fixed-capacity cache of candidate camera buffers that never allocates after construction.
+    // Handles are keys of an open-addressed table (linear probing, backward-shift deletion); buffer
+    // contents are copied into pooled arena slots of two size classes. When the table or a pool is
+    // full, the least recently stored entry is evicted. Not thread-safe, CameraController serializes access.
+    class BufferCache {
+    public:
+        static constexpr uint32_t kMaxEntries = 64;
+        static constexpr uint32_t kSmallSlots = 56;
+        static constexpr uint32_t kSmallSlotSize = 4096;
+        static constexpr uint32_t kLargeSlots = 8;
+        static constexpr uint32_t kLargeSlotSize = 65536; // D3D11 constant buffer limit
+
+        BufferCache();
+
+        ConstantBufferState* Find(uint64_t handle);
+
+        // Copies the buffer contents into the handle's entry, creating it if needed. The entry of
+        // pinnedHandle (the camera buffer) is never evicted. Returns nullptr if size exceeds kLargeSlotSize.
+        ConstantBufferState* Store(uint64_t handle, const void* data, uint32_t size, uint64_t pinnedHandle);
+
+        void Erase(uint64_t handle);
+        void Clear();
+
+    private:
+        static constexpr uint32_t kTableSize = kMaxEntries * 2; // Power of two, at most half full
+        static constexpr uint16_t kEmpty = 0xFFFF;
+        static constexpr uint16_t kNoSlot = 0xFFFF;
+
+        struct Entry {
+            uint64_t handle = 0;
+            uint64_t lastUse = 0;
+            ConstantBufferState state;
+            uint16_t slot = kNoSlot;
+            bool large = false;
+        };
+
+        static uint32_t Hash(uint64_t handle);
+        uint32_t FindIndex(uint64_t handle) const; // Table index, kTableSize if not found
+        void EraseAt(uint32_t tableIndex);
+        void ReleaseSlot(Entry& entry);
+        bool AcquireSlot(Entry& entry, bool large, uint64_t pinnedHandle);
+        // Evicts the least recently used entry, optionally only among holders of a large/small slot
+        bool EvictOldest(uint64_t pinnedHandle, int requiredClass);
+
+        uint16_t m_table[kTableSize];      // Entry index per bucket, kEmpty if free
+        Entry m_entries[kMaxEntries];
+        uint64_t m_freeEntries = 0;        // Bit i set: m_entries[i] unused
+        uint64_t m_freeSmall = 0;          // Bit i set: small slot i unused
+        uint64_t m_freeLarge = 0;
+        uint64_t m_tick = 0;
+        std::vector<uint8_t> m_arena;      // Small slots first, then large slots
+    };
+}
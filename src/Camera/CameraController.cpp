@@ -1,10 +1,50 @@
 #include "pch.h"
 #include "CameraController.h"
 #include "../Core/Logger.h"
+#include "../Core/Profiler.h"
+#include <cstring>
+#include <emmintrin.h>
 
 namespace Camera {
 
-    CameraController::CameraController() {}
+    namespace {
+        // Last camera buffer write on this thread, see GetCurrentRole and GetThreadSnapshot
+        struct ThreadCameraWrite {
+            uint64_t handle = 0;
+            CameraRole role = CameraRole::Main;
+            CameraSnapshotPtr snapshot; // Of the last main view write, kept across other views' writes
+        };
+        thread_local ThreadCameraWrite t_cameraWrite;
+
+        // Camera buffer layout in one word: size (bits 0-31), view offset + 1 (32-46), projection
+        // offset + 1 (47-61), transposed view (62). Offsets are in floats, so at most 16384.
+        uint64_t PackLayout(uint32_t size, int viewOffset, int projOffset, bool transposed) {
+            return (uint64_t)size | ((uint64_t)(viewOffset + 1) << 32) | ((uint64_t)(projOffset + 1) << 47) | ((uint64_t)transposed << 62);
+        }
+
+        // Determinant of the upper 3x3, the same for the transposed layout
+        float GetViewDeterminant(const float* v) {
+            return v[0] * (v[5] * v[10] - v[6] * v[9]) - v[1] * (v[4] * v[10] - v[6] * v[8]) + v[2] * (v[4] * v[9] - v[5] * v[8]);
+        }
+    }
+
+    CameraController::CameraController() : m_snapshot(std::make_shared<CameraSnapshot>()) {
+        m_hasSignature = SignatureCache::Load(m_signature);
+        if (m_hasSignature) {
+            m_savedSignature = m_signature;
+            // Orientation cues come from the cache too
+            m_worldUp = DirectX::XMVectorSet(m_signature.worldUp[0], m_signature.worldUp[1], m_signature.worldUp[2], 0);
+            m_upDetected = true;
+            m_isRH = m_signature.rightHanded;
+            m_isTransposed = m_signature.transposed;
+            LOG_INFO("Cached camera signature: ", m_signature.bufferSize, " byte buffer, view offset ", m_signature.viewOffset, ", proj offset ", m_signature.projOffset);
+        }
+    }
+
+    CameraController::~CameraController() {
+        // A signature that locked on just before shutdown still reaches the file
+        SignatureCache::Flush();
+    }
 
     void CameraController::OnUpdateBuffer(reshade::api::resource resource, const void* data, uint64_t size) {
         ScanBufferImpl(resource, data, size, false);
@@ -14,158 +54,432 @@ namespace Camera {
         ScanBufferImpl(resource, data, size, true);
     }
 
+    void CameraController::OnDestroyResource(reshade::api::resource resource) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bufferCache.Erase(resource.handle);
+
+        // A destroyed camera buffer can't come back (the handle may even be reused), look for the next one
+        if (resource.handle == m_cameraBuffer.load(std::memory_order_relaxed)) {
+            LOG_INFO("Camera buffer destroyed, scanning for a new one");
+            m_cameraBuffer.store(0, std::memory_order_release);
+            m_cameraLayout.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    CameraRole CameraController::GetCurrentRole() const {
+        const ThreadCameraWrite& write = t_cameraWrite;
+        bool current = write.handle != 0 && write.handle == m_cameraBuffer.load(std::memory_order_relaxed);
+        return current ? write.role : CameraRole::Main;
+    }
+
+    const CameraSnapshotPtr* CameraController::GetThreadSnapshot() const {
+        const ThreadCameraWrite& write = t_cameraWrite;
+        if (!write.snapshot || write.handle == 0 || write.handle != m_cameraBuffer.load(std::memory_order_relaxed)) return nullptr;
+        return &write.snapshot;
+    }
+
+    const char* CameraController::GetRoleName(CameraRole role) {
+        switch (role) {
+            case CameraRole::Shadow: return "shadow";
+            case CameraRole::Reflection: return "reflection";
+            default: return "main";
+        }
+    }
+
+    CameraRole CameraController::Classify(const float* data, const MatrixLayout& layout, bool expectProj) const {
+        // Planar reflections mirror the view, which flips the sign of its determinant. Engines differ
+        // in the sign of a plain view, so it is compared with the main view's once one was found.
+        if (layout.viewOffset >= 0) {
+            int mainSign = m_mainViewSign.load(std::memory_order_relaxed);
+            int sign = GetViewDeterminant(data + layout.viewOffset) < 0.0f ? -1 : 1;
+            if (mainSign != 0 && sign != mainSign) return CameraRole::Reflection;
+        }
+
+        if (layout.projOffset >= 0) {
+            // Light (and probe) frustums are square, the game view is only square in a square window.
+            // The x/y scale ratio of the projection is its aspect ratio.
+            const float* proj = data + layout.projOffset;
+            float outputAspect = m_outputAspect.load(std::memory_order_relaxed);
+            bool squareOutput = outputAspect > 0.0f && std::abs(outputAspect - 1.0f) < 0.05f;
+            if (!squareOutput && std::abs(proj[0]) > 1e-6f && std::abs(proj[5] / proj[0] - 1.0f) < 0.01f) return CameraRole::Shadow;
+        } else if (expectProj) {
+            // No perspective projection where the camera keeps one: an orthographic (directional light) pass
+            return CameraRole::Shadow;
+        }
+        return CameraRole::Main;
+    }
+
+    uint64_t CameraController::HashContents(const void* data, uint64_t size) {
+        // Only compared for equality, so a fast multiplicative hash over 8-byte words will do
+        const uint8_t* bytes = (const uint8_t*)data;
+        uint64_t hash = 0xCBF29CE484222325ull ^ size;
+        uint64_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            uint64_t word;
+            memcpy(&word, bytes + i, sizeof(word));
+            hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+            hash ^= hash >> 32;
+        }
+        for (; i < size; ++i) hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+        return hash ? hash : 1; // 0 means nothing published
+    }
+
+    bool CameraController::TryScanCameraWrite(uint64_t handle, const float* data, uint64_t size) {
+        // Nothing published yet, or the buffer changed size: the locked scan takes it from here
+        uint64_t packed = m_cameraLayout.load(std::memory_order_acquire);
+        if ((uint32_t)packed != size) return false;
+
+        int viewOffset = (int)((packed >> 32) & 0x7FFF) - 1;
+        int projOffset = (int)((packed >> 47) & 0x7FFF) - 1;
+        bool transposed = ((packed >> 62) & 1) != 0;
+
+        MatrixLayout layout;
+        if (viewOffset >= 0 && IsViewMatrix(data + viewOffset, &layout.viewTransposed) && layout.viewTransposed == transposed)
+            layout.viewOffset = viewOffset;
+        if (projOffset >= 0 && IsProjectionMatrix(data + projOffset))
+            layout.projOffset = projOffset;
+        // Neither matrix where it used to be, the buffer may have a new layout
+        if (layout.viewOffset < 0 && layout.projOffset < 0) return false;
+
+        ThreadCameraWrite& write = t_cameraWrite;
+        CameraRole role = Classify(data, layout, projOffset >= 0);
+        write.handle = handle;
+        write.role = role;
+        if (role != CameraRole::Main) {
+            LOG_ONCE(INFO, "Camera buffer also holds ", GetRoleName(role), " views, their draws are not replicated");
+            return true;
+        }
+
+        // Only main view writes keep the lock, a buffer that stops carrying the main view times out
+        m_scansSinceCameraUpdate.store(0, std::memory_order_relaxed);
+
+        // The same contents as this thread's last write, or as what another context recorded in
+        // parallel already built (per-view data usually is), reuse that snapshot
+        uint64_t hash = HashContents(data, size);
+        if (write.snapshot && write.snapshot->contentHash == hash) return true;
+        if (hash != m_publishedHash.load(std::memory_order_acquire)) return false;
+
+        CameraSnapshotPtr published = GetSnapshot();
+        if (published->contentHash != hash) return false; // Replaced in between
+        write.snapshot = std::move(published);
+        return true;
+    }
+
     void CameraController::ScanBufferImpl(reshade::api::resource resource, const void* data, uint64_t size, bool isMapped) {
         if (size < 64) return; // Too small for a matrix
+        Profiler::CpuScope profile(Profiler::CpuStage::ScanBuffer);
+        Profiler::Increment(Profiler::Counter::ScannedBuffers);
 
         // Performance Guard: If mapped (uncached memory), ONLY read small buffers
         if (isMapped && size > 4096) return;
+        // Nothing larger can be bound as a constant buffer, which also bounds the cost and the cache
+        if (size > kMaxScanSize) return;
 
-        static int logCounter = 0;
-        bool logThisFrame = (logCounter++ % 500 == 0); // Log occasionally to avoid spam
-
-        std::lock_guard<std::mutex> lock(m_mutex);
-        
         uint64_t handle = resource.handle;
-        auto& state = m_bufferCache[handle];
-        
-        // Update cache
-        if (state.data.size() != size) state.data.resize(size);
-        memcpy(state.data.data(), data, size);
-
         const float* floatData = (const float*)data;
-        size_t floatCount = size / sizeof(float);
 
-        // Check if this is the "Noisy" buffer (Size ~10KB)
-        bool isNoisy = (size > 9000 && size < 11000);
-        
-        static int noiseLogCount = 0;
-        
-        // Log this frame if:
-        // 1. It's NOT the noisy buffer
-        // 2. OR it IS the noisy buffer, but we haven't logged it much yet
-        // 3. AND global log counter is not exhausted (reset counter for this logic)
-        
-        bool shouldLog = false;
-        if (logThisFrame) {
-            if (!isNoisy) {
-                shouldLog = true;
-            } else if (noiseLogCount < 5) {
-                shouldLog = true;
-                noiseLogCount++;
+        // Camera buffer writes from any context are classified, and repeats skipped, without the lock
+        uint64_t cameraHandle = m_cameraBuffer.load(std::memory_order_acquire);
+        if (cameraHandle != 0 && handle == cameraHandle && TryScanCameraWrite(handle, floatData, size)) return;
+
+        // Locked on: other buffers can't change the camera, skip them without locking or copying.
+        // If the camera buffer goes quiet for long (level change, new camera), scanning resumes.
+        if (cameraHandle != 0 && handle != cameraHandle &&
+            m_scansSinceCameraUpdate.fetch_add(1, std::memory_order_relaxed) < kLockTimeoutScans)
+            return;
+
+        // A remembered layout only fits buffers of its size. Until it matched once or the grace
+        // period ran out, other buffers are skipped like after lock-on.
+        bool trySignature = m_hasSignature && cameraHandle == 0 && m_signatureMisses.load(std::memory_order_relaxed) < kSignatureGraceScans;
+        if (trySignature && size != m_signature.bufferSize) {
+            if (m_signatureMisses.fetch_add(1, std::memory_order_relaxed) + 1 == kSignatureGraceScans) {
+                LOG_INFO("No buffer matched the cached camera signature, falling back to the full scan");
             }
+            return;
         }
 
-        bool foundView = false;
-        bool foundProj = false;
+        std::lock_guard<std::mutex> lock(m_mutex);
 
-        if (shouldLog && !foundView && !foundProj && m_cameraBuffer.handle == 0) {
-            // Log first few floats of a candidate buffer if we haven't found a camera yet
-            LOG_INFO("Scanning Buffer ", (void*)handle, " Size: ", size, " (Mapped: ", isMapped, "). F[0-3]: ", floatData[0], ", ", floatData[1], ", ", floatData[2], ", ", floatData[3]);
+        size_t floatCount = size / sizeof(float);
+        bool isCameraBuffer = handle == m_cameraBuffer.load(std::memory_order_relaxed);
+        bool searching = m_cameraBuffer.load(std::memory_order_relaxed) == 0;
+
+        if (searching && !trySignature) {
+            // Log first few floats of a candidate buffer now and then while no camera is found.
+            // The ~10 KB buffer some engines rewrite per draw is only logged a few times.
+            bool isNoisy = (size > 9000 && size < 11000);
+            if (isNoisy) {
+                LOG_FIRST_N(DEBUG, 5, "Scanning Buffer ", (void*)handle, " Size: ", size, " (Mapped: ", isMapped, "). F[0-3]: ", floatData[0], ", ", floatData[1], ", ", floatData[2], ", ", floatData[3]);
+            } else {
+                LOG_EVERY_N(DEBUG, 500, "Scanning Buffer ", (void*)handle, " Size: ", size, " (Mapped: ", isMapped, "). F[0-3]: ", floatData[0], ", ", floatData[1], ", ", floatData[2], ", ", floatData[3]);
+            }
         }
 
         // FULL BUFFER DUMP (Only for medium/small buffers now, OR specifically requested)
-        if (m_cameraBuffer.handle == 0 && !m_deepScanDone && size > 200 && size < 2000) { // Look for standard CB sizes!
+        if (searching && !trySignature && !m_deepScanDone && size > 200 && size < 2000) { // Look for standard CB sizes!
              m_deepScanDone = true; 
-             LOG_INFO("--- FULL BUFFER DUMP START [Buffer ", (void*)handle, " Size ", size, "] ---");
+             LOG_DEBUG("--- FULL BUFFER DUMP START [Buffer ", (void*)handle, " Size ", size, "] ---");
                  
              // Dump all floats in lines of 8
              for (size_t i = 0; i < floatCount; i += 8) {
                  if (i + 7 < floatCount) {
-                     LOG_INFO("OFFSET ", i*4, ": ", 
+                     LOG_DEBUG("OFFSET ", i*4, ": ", 
                          floatData[i], ", ", floatData[i+1], ", ", floatData[i+2], ", ", floatData[i+3], ",    ",
                          floatData[i+4], ", ", floatData[i+5], ", ", floatData[i+6], ", ", floatData[i+7]);
                  }
              }
-             LOG_INFO("--- FULL BUFFER DUMP END ---");
+             LOG_DEBUG("--- FULL BUFFER DUMP END ---");
         }
 
-        // Scan for View Matrix
-        for (size_t i = 0; i <= floatCount - 16; i += 4) {
+        // The camera buffer normally keeps its layout, so its known offsets are checked first
+        MatrixLayout layout;
+        const ConstantBufferState* cached = isCameraBuffer ? m_bufferCache.Find(handle) : nullptr;
+        if (cached) {
+            const ConstantBufferState& known = *cached;
+            if (known.viewMatrixOffset >= 0 && (size_t)known.viewMatrixOffset + 16 <= floatCount &&
+                IsViewMatrix(floatData + known.viewMatrixOffset, &layout.viewTransposed))
+                layout.viewOffset = known.viewMatrixOffset;
+            if (known.projMatrixOffset >= 0 && (size_t)known.projMatrixOffset + 16 <= floatCount &&
+                IsProjectionMatrix(floatData + known.projMatrixOffset))
+                layout.projOffset = known.projMatrixOffset;
+        }
+        if (trySignature) {
+            // Same size as the cached camera buffer: only its known offsets are tested
+            const CameraSignature& sig = m_signature;
             bool transposed = false;
-            // Original logic for view matrix
-            if (IsViewMatrix(floatData + i, &transposed)) {
-                 if (!foundView) {
-                     // LOG_INFO("Found Potential View Matrix at Offset ", i*4);
-                 }
-                 state.viewMatrixOffset = (int)i;
-                 state.isCamera = true;
-                 
-                 LOG_INFO("FOUND VIEW MATRIX! Buffer: ", (void*)handle, " Offset: ", i);
+            if (sig.viewOffset >= 0 && (size_t)sig.viewOffset + 16 <= floatCount &&
+                IsViewMatrix(floatData + sig.viewOffset, &transposed) && transposed == sig.transposed)
+            {
+                layout.viewOffset = sig.viewOffset;
+                layout.viewTransposed = transposed;
+            }
+            if (sig.projOffset >= 0 && (size_t)sig.projOffset + 16 <= floatCount && IsProjectionMatrix(floatData + sig.projOffset))
+                layout.projOffset = sig.projOffset;
+
+            // Both matrices the signature knows about must be present
+            bool matched = (sig.viewOffset < 0 || layout.viewOffset >= 0) && (sig.projOffset < 0 || layout.projOffset >= 0);
+            if (!matched) {
+                m_signatureMisses.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        } else if (layout.viewOffset < 0 && layout.projOffset < 0) {
+            layout = FindMatrices(floatData, (size_t)size);
+        }
 
-                 m_isTransposed = transposed;
-                 DirectX::XMMATRIX viewMat = DirectX::XMLoadFloat4x4((const DirectX::XMFLOAT4X4*)(floatData + i));
-                 if (transposed) viewMat = DirectX::XMMatrixTranspose(viewMat);
+        // Buffers without a candidate matrix are neither copied nor cached
+        bool foundView = layout.viewOffset >= 0;
+        bool foundProj = layout.projOffset >= 0;
+        if (!foundView && !foundProj && !isCameraBuffer) return;
+
+        // Shadow and reflection views neither become the camera nor update it
+        ThreadCameraWrite& write = t_cameraWrite;
+        CameraRole role = Classify(floatData, layout, cached && cached->projMatrixOffset >= 0);
+        if (isCameraBuffer) {
+            write.handle = handle;
+            write.role = role;
+        }
+        if (role != CameraRole::Main) {
+            if (!isCameraBuffer) LOG_EVERY_N(INFO, 500, "Skipping ", GetRoleName(role), " view in buffer ", (void*)handle);
+            return;
+        }
+        if (trySignature) LOG_INFO("Camera buffer ", (void*)handle, " matches the cached signature");
+
+        // Another context may have published the same contents while this one waited for the lock.
+        // m_snapshot is only replaced with m_mutex held, so it can be read directly here.
+        uint64_t contentHash = HashContents(data, size);
+        if (isCameraBuffer) {
+            m_scansSinceCameraUpdate.store(0, std::memory_order_relaxed);
+            if (m_snapshot->contentHash == contentHash) {
+                write.snapshot = m_snapshot;
+                return;
+            }
+        }
 
-                 m_lastGameView = viewMat;
+        // Update cache. The camera buffer is never evicted to make room.
+        ConstantBufferState* cachedState = m_bufferCache.Store(handle, data, (uint32_t)size, m_cameraBuffer.load(std::memory_order_relaxed));
+        if (!cachedState) return;
+        ConstantBufferState& state = *cachedState;
+
+        if (foundView) {
+            int i = layout.viewOffset;
+            // Other candidates can be rewritten every frame, only a new layout is always worth a line
+            if (state.viewMatrixOffset != i) {
+                LOG_INFO("FOUND VIEW MATRIX! Buffer: ", (void*)handle, " Offset: ", i);
+            } else if (!isCameraBuffer) {
+                LOG_EVERY_N(INFO, 500, "FOUND VIEW MATRIX! Buffer: ", (void*)handle, " Offset: ", i);
+            }
+            state.viewMatrixOffset = i;
+            state.isCamera = true;
 
-                 if (!m_upDetected) {
-                     DetectWorldUp(viewMat);
-                 }
+            m_isTransposed = layout.viewTransposed;
+            DirectX::XMMATRIX viewMat = DirectX::XMLoadFloat4x4((const DirectX::XMFLOAT4X4*)(floatData + i));
+            if (layout.viewTransposed) viewMat = DirectX::XMMatrixTranspose(viewMat);
 
-                 m_cameraBuffer = resource; 
-                 foundView = true;
-                 break; 
+            m_lastGameView = viewMat;
+
+            if (!m_upDetected) {
+                DetectWorldUp(viewMat);
             }
-        }
+            // Reference for telling mirrored views apart
+            m_mainViewSign.store(GetViewDeterminant(floatData + i) < 0.0f ? -1 : 1, std::memory_order_relaxed);
 
-        // Scan for Projection Matrix
-        for (size_t i = 0; i <= floatCount - 16; i += 4) {
-            if (IsProjectionMatrix(floatData + i)) {
-                state.projMatrixOffset = (int)i;
-                state.isCamera = true;
+            m_cameraBuffer.store(handle, std::memory_order_release);
+        }
 
+        if (foundProj) {
+            int i = layout.projOffset;
+            if (state.projMatrixOffset != i) {
                 LOG_INFO("FOUND PROJ MATRIX! Buffer: ", (void*)handle, " Offset: ", i);
+            } else if (!isCameraBuffer) {
+                LOG_EVERY_N(INFO, 500, "FOUND PROJ MATRIX! Buffer: ", (void*)handle, " Offset: ", i);
+            }
+            state.projMatrixOffset = i;
+            state.isCamera = true;
+
+            m_isRH = IsRightHandedProjection(floatData + i);
+            // [3][2] is -near*far/(far-near) for a standard depth range, positive when reversed. Index 14
+            // row-major, 11 when the buffer stores its matrices transposed (as the view scan detected).
+            bool transposed = foundView ? layout.viewTransposed : m_isTransposed;
+            m_isReversedZ = (floatData[i + (transposed ? 11 : 14)] > 0.0f);
+            m_lastGameProj = DirectX::XMLoadFloat4x4((const DirectX::XMFLOAT4X4*)(floatData + i));
 
-                m_isRH = IsRightHandedProjection(floatData + i);
-                m_lastGameProj = DirectX::XMLoadFloat4x4((const DirectX::XMFLOAT4X4*)(floatData + i));
+            m_cameraBuffer.store(handle, std::memory_order_release);
+        }
+
+        if (handle != m_cameraBuffer.load(std::memory_order_relaxed)) return;
+        if (handle != cameraHandle) {
+            m_scansSinceCameraUpdate.store(0, std::memory_order_relaxed);
+        }
 
-                m_cameraBuffer = resource;
-                foundProj = true;
-                break;
+        SaveSignature(state);
+        CameraSnapshotPtr snapshot = BuildSnapshot(state, contentHash);
+        std::atomic_store_explicit(&m_snapshot, snapshot, std::memory_order_release);
+        m_dataGeneration.store(snapshot->generation, std::memory_order_release);
+        // What TryScanCameraWrite checks later writes against
+        m_cameraLayout.store(PackLayout(state.size, state.viewMatrixOffset, state.projMatrixOffset, m_isTransposed), std::memory_order_release);
+        m_publishedHash.store(contentHash, std::memory_order_release);
+        write = { handle, CameraRole::Main, std::move(snapshot) };
+    }
+
+    void CameraController::SaveSignature(const ConstantBufferState& state) {
+        CameraSignature signature;
+        signature.bufferSize = state.size;
+        signature.viewOffset = state.viewMatrixOffset;
+        signature.projOffset = state.projMatrixOffset;
+        signature.transposed = m_isTransposed;
+        signature.rightHanded = m_isRH;
+        signature.worldUp[0] = DirectX::XMVectorGetX(m_worldUp);
+        signature.worldUp[1] = DirectX::XMVectorGetY(m_worldUp);
+        signature.worldUp[2] = DirectX::XMVectorGetZ(m_worldUp);
+
+        // Usually written once per game, then whenever the layout changes. The file is written off the render thread.
+        if (signature == m_savedSignature) return;
+        SignatureCache::SaveAsync(signature);
+        m_savedSignature = signature;
+    }
+
+    CameraController::MatrixLayout CameraController::FindMatrices(const float* data, size_t size) {
+        // Candidate matrices start at every 16-byte row, so each row belongs to four overlapping
+        // candidates. Classifying a row once with SSE (which lanes are ~0, ~1, ~+-1) turns every
+        // IsViewMatrix/IsProjectionMatrix test into a few bit tests on the row masks.
+        constexpr uint8_t kLaneW = 1 << 3;
+        static_assert(kMaxScanSize % 16 == 0, "Scan size must be whole rows");
+
+        size_t rowCount = size / 16;
+        uint8_t zero[kMaxScanSize / 16];
+        uint8_t one[kMaxScanSize / 16];
+        uint8_t unit[kMaxScanSize / 16];
+
+        const __m128 epsilon = _mm_set1_ps(0.1f); // Same tolerance as the scalar checks
+        const __m128 ones = _mm_set1_ps(1.0f);
+        const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+        for (size_t r = 0; r < rowCount; ++r) {
+            __m128 v = _mm_loadu_ps(data + r * 4);
+            __m128 a = _mm_and_ps(v, absMask);
+            // NaN compares false and never passes a check
+            zero[r] = (uint8_t)_mm_movemask_ps(_mm_cmplt_ps(a, epsilon));
+            one[r] = (uint8_t)_mm_movemask_ps(_mm_cmplt_ps(_mm_and_ps(_mm_sub_ps(v, ones), absMask), epsilon));
+            unit[r] = (uint8_t)_mm_movemask_ps(_mm_cmplt_ps(_mm_and_ps(_mm_sub_ps(a, ones), absMask), epsilon));
+        }
+
+        MatrixLayout layout;
+        for (size_t r = 0; r + 3 < rowCount && (layout.viewOffset < 0 || layout.projOffset < 0); ++r) {
+            if (layout.viewOffset < 0 && (one[r + 3] & kLaneW)) {
+                // Row major: [x x x 0] x3, [x x x 1]. Column major: last row [0 0 0 1].
+                bool rowMajor = (zero[r] & zero[r + 1] & zero[r + 2] & kLaneW) != 0;
+                bool colMajor = (zero[r + 3] & 0x7) == 0x7;
+                if (rowMajor || colMajor) {
+                    layout.viewOffset = (int)(r * 4);
+                    layout.viewTransposed = colMajor;
+                }
             }
+            if (layout.projOffset < 0 &&
+                (zero[r] & 0xE) == 0xE && (zero[r + 1] & 0xD) == 0xD && (unit[r + 2] & kLaneW) && (zero[r + 3] & kLaneW))
+                layout.projOffset = (int)(r * 4);
         }
+        return layout;
     }
 
-    bool CameraController::GetModifiedBufferData(CubeFace face, std::vector<uint8_t>& outputData) {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        if (m_cameraBuffer.handle == 0) return false;
+    CameraSnapshotPtr CameraController::BuildSnapshot(const ConstantBufferState& state, uint64_t contentHash) {
+        auto built = std::make_shared<CameraSnapshot>();
+        CameraSnapshot& snap = *built;
+        snap.contentHash = contentHash;
+
+        // Inverse of the game view only changes here, not per face or per draw
+        DirectX::XMVECTOR det;
+        DirectX::XMMATRIX invView = DirectX::XMMatrixInverse(&det, m_lastGameView);
+        DirectX::XMVECTOR eyePos = invView.r[3];
+        snap.invGameView = invView;
+        snap.eyePosition = eyePos;
+        snap.viewForward = DirectX::XMVector3Normalize(invView.r[2]);
 
-        auto it = m_bufferCache.find(m_cameraBuffer.handle);
-        if (it == m_bufferCache.end()) return false;
+        for (int i = 0; i < 6; ++i) {
+            snap.faceViews[i] = ComputeViewMatrixForFace((CubeFace)i, eyePos);
+        }
 
-        auto& state = it->second;
-        outputData = state.data; // Copy original data
+        // Force 90 degree FOV. Swapping near and far keeps reversed-Z depth tests and clears valid.
+        float nearZ = m_isReversedZ ? 1000.0f : 0.1f;
+        float farZ = m_isReversedZ ? 0.1f : 1000.0f;
+        if (m_isRH) {
+            snap.faceProj = DirectX::XMMatrixPerspectiveFovRH(DirectX::XM_PIDIV2, 1.0f, nearZ, farZ);
+        } else {
+            snap.faceProj = DirectX::XMMatrixPerspectiveFovLH(DirectX::XM_PIDIV2, 1.0f, nearZ, farZ);
+        }
 
-        float* outFloats = (float*)outputData.data();
-        size_t floatCount = outputData.size() / sizeof(float);
+        size_t floatCount = state.size / sizeof(float);
+        bool patchView = state.viewMatrixOffset >= 0 && (size_t)(state.viewMatrixOffset + 16) <= floatCount;
+        bool patchProj = state.projMatrixOffset >= 0 && (size_t)(state.projMatrixOffset + 16) <= floatCount;
 
-        // Replace View Matrix
-        if (state.viewMatrixOffset >= 0 && (size_t)(state.viewMatrixOffset + 16) <= floatCount) {
-            DirectX::XMMATRIX newView = GetViewMatrixForFace(face);
-            if (m_isTransposed) newView = DirectX::XMMatrixTranspose(newView);
+        for (int i = 0; i < 6; ++i) {
+            std::vector<uint8_t>& out = snap.faceData[i];
+            out.assign(state.data, state.data + state.size);
+            float* outFloats = (float*)out.data();
 
-            DirectX::XMStoreFloat4x4((DirectX::XMFLOAT4X4*)(outFloats + state.viewMatrixOffset), newView);
+            if (patchView) {
+                DirectX::XMMATRIX newView = snap.faceViews[i];
+                if (m_isTransposed) newView = DirectX::XMMatrixTranspose(newView);
+                DirectX::XMStoreFloat4x4((DirectX::XMFLOAT4X4*)(outFloats + state.viewMatrixOffset), newView);
+            }
+            if (patchProj) {
+                DirectX::XMStoreFloat4x4((DirectX::XMFLOAT4X4*)(outFloats + state.projMatrixOffset), snap.faceProj);
+            }
         }
 
-        // Replace Projection Matrix (Force 90 degree FOV)
-        if (state.projMatrixOffset >= 0 && (size_t)(state.projMatrixOffset + 16) <= floatCount) {
-            DirectX::XMMATRIX newProj;
-            if (m_isRH) {
-                newProj = DirectX::XMMatrixPerspectiveFovRH(DirectX::XM_PIDIV2, 1.0f, 0.1f, 1000.0f);
-            } else {
-                newProj = DirectX::XMMatrixPerspectiveFovLH(DirectX::XM_PIDIV2, 1.0f, 0.1f, 1000.0f);
+        snap.hasClipTransforms = patchView && patchProj;
+        if (snap.hasClipTransforms) {
+            DirectX::XMMATRIX invGameViewProj = DirectX::XMMatrixInverse(&det, DirectX::XMMatrixMultiply(m_lastGameView, m_lastGameProj));
+            for (int i = 0; i < 6; ++i) {
+                snap.faceClipTransforms[i] = DirectX::XMMatrixMultiply(invGameViewProj, DirectX::XMMatrixMultiply(snap.faceViews[i], snap.faceProj));
             }
-            DirectX::XMStoreFloat4x4((DirectX::XMFLOAT4X4*)(outFloats + state.projMatrixOffset), newProj);
         }
 
-        return true;
+        snap.valid = state.size != 0;
+        // Counted once published, so a reader that sees the new generation finds the snapshot too
+        snap.generation = m_dataGeneration.load(std::memory_order_relaxed) + 1;
+        return built;
     }
 
-    DirectX::XMMATRIX CameraController::GetViewMatrixForFace(CubeFace face) {
-        DirectX::XMVECTOR det;
-        DirectX::XMMATRIX invView = DirectX::XMMatrixInverse(&det, m_lastGameView);
-        DirectX::XMVECTOR eyePos = invView.r[3];
-
+    DirectX::XMMATRIX CameraController::ComputeViewMatrixForFace(CubeFace face, DirectX::FXMVECTOR eyePos) const {
         bool isZUp = (std::abs(DirectX::XMVectorGetZ(m_worldUp)) > 0.9f);
 
         DirectX::XMVECTOR vRight, vLeft, vUp, vDown, vFront, vBack;
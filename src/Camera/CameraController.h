@@ -2,9 +2,12 @@
 #include <reshade.hpp>
 #include <d3d11.h>
 #include <DirectXMath.h>
+#include <memory>
 #include <vector>
 #include <mutex>
-#include <map>
+#include <atomic>
+#include "BufferCache.h"
+#include "SignatureCache.h"
 
 namespace Camera {
 
@@ -17,48 +20,148 @@ namespace Camera {
         Back = 5
     };
 
-    struct ConstantBufferState {
-        std::vector<uint8_t> data;
-        bool isCamera = false;
-        int viewMatrixOffset = -1;
-        int projMatrixOffset = -1;
+    // What a view written into a camera candidate renders, told apart by its matrices. Engines often
+    // share one constant buffer layout (or one buffer) between their views; only the main view is
+    // replicated into the faces.
+    enum class CameraRole : uint8_t {
+        Main,       // The game camera
+        Shadow,     // Square light frustum, or no perspective projection where the camera has one
+        Reflection, // Mirrored view (planar reflections, water)
     };
 
+    // Everything the draw path needs for one camera buffer write. Built by ScanBufferImpl for each
+    // new main view contents, immutable once published and shared by reference count, so draws on
+    // any thread can keep using one while newer writes are published.
+    struct CameraSnapshot {
+        uint64_t generation = 0;
+        uint64_t contentHash = 0; // Of the camera buffer contents it was built from, 0 if none
+        bool valid = false;
+        DirectX::XMMATRIX faceViews[6];
+        DirectX::XMMATRIX faceProj;
+        // Maps a game clip-space position to each face's clip space (inverse(gameView * gameProj) * faceView * faceProj).
+        // Only meaningful when both the view and projection matrices were located.
+        DirectX::XMMATRIX faceClipTransforms[6];
+        bool hasClipTransforms = false;
+        std::vector<uint8_t> faceData[6]; // Fully patched camera buffer image per face
+        // Game camera position and forward axis in world space, to tell how far it moved between frames
+        DirectX::XMVECTOR eyePosition;
+        DirectX::XMVECTOR viewForward;
+        DirectX::XMMATRIX invGameView; // Game view space to world space
+    };
+    using CameraSnapshotPtr = std::shared_ptr<const CameraSnapshot>;
+
     class CameraController {
     public:
         CameraController();
-        
+        ~CameraController();
+
         void OnUpdateBuffer(reshade::api::resource resource, const void* data, uint64_t size);
         void OnScanBuffer(reshade::api::resource resource, const void* data, uint64_t size);
+        // Drops everything cached for a destroyed buffer
+        void OnDestroyResource(reshade::api::resource resource);
         
         // Returns the handle of the buffer detected as the camera constant buffer
-        reshade::api::resource GetCameraBuffer() const { return m_cameraBuffer; }
-        
-        // Calculates the View Matrix for a specific face based on the last detected game view
-        DirectX::XMMATRIX GetViewMatrixForFace(CubeFace face);
+        reshade::api::resource GetCameraBuffer() const { return { m_cameraBuffer.load(std::memory_order_acquire) }; }
+
+        // Role of the view last written into the camera buffer on the calling thread. A D3D11 context
+        // is recorded by one thread at a time, so this is the view that thread's next draws render.
+        // Main if the thread hasn't written the camera buffer.
+        CameraRole GetCurrentRole() const;
+
+        // Back buffer aspect ratio (width / height). A square game view isn't taken for a light frustum.
+        void SetOutputAspect(float aspect) { m_outputAspect.store(aspect, std::memory_order_relaxed); }
+
+        // Incremented every time new data for the camera buffer is seen.
+        // Consumers compare against their last value to know when derived data is stale.
+        uint64_t GetDataGeneration() const { return m_dataGeneration.load(std::memory_order_acquire); }
+
+        // Returns the most recently published face data, from any thread. Never null.
+        CameraSnapshotPtr GetSnapshot() const { return std::atomic_load_explicit(&m_snapshot, std::memory_order_acquire); }
+
+        // The snapshot of the main view contents the calling thread last wrote into the current camera
+        // buffer, nullptr if it wrote none. Contexts recorded on other threads write their own camera
+        // contents, their draws replicate from these rather than from whatever was published last.
+        // Valid until the thread's next camera buffer write.
+        const CameraSnapshotPtr* GetThreadSnapshot() const;
 
-        // Fills the provided buffer with the modified constant buffer data for the given face
-        // Returns true if successful (and outputData is filled)
-        bool GetModifiedBufferData(CubeFace face, std::vector<uint8_t>& outputData);
+        // Handedness of the detected game projection
+        bool IsRightHanded() const { return m_isRH; }
+
+        // Heuristic for an affine (view or world) matrix, row or column major. Shared with the face culler.
+        static bool IsViewMatrix(const float* data, bool* outIsTransposed);
+
+        // True if the game's projection maps the near plane to depth 1 (reversed-Z). Face projections follow it.
+        bool IsReversedZ() const { return m_isReversedZ; }
+
+        // Returns the View Matrix for a specific face, derived from the last detected game view
+        DirectX::XMMATRIX GetViewMatrixForFace(CubeFace face) const { return GetSnapshot()->faceViews[(int)face]; }
 
     private:
+        // D3D11 constant buffers are at most 4096 float4 rows, larger updates are never scanned
+        static constexpr uint64_t kMaxScanSize = D3D11_REQ_CONSTANT_BUFFER_ELEMENT_COUNT * 16;
+        // Scans of other buffers skipped after lock-on before the camera buffer counts as gone quiet
+        static constexpr uint32_t kLockTimeoutScans = 1u << 20;
+        // Scans that may miss a remembered signature before the full scan takes over
+        static constexpr uint32_t kSignatureGraceScans = 1u << 18;
+
+        // Float offsets of the first view and projection matrix candidates, -1 if none
+        struct MatrixLayout {
+            int viewOffset = -1;
+            bool viewTransposed = false;
+            int projOffset = -1;
+        };
+        static MatrixLayout FindMatrices(const float* data, size_t size);
+
+        // expectProj: the buffer is known to hold a projection, so a write without one is a light view
+        CameraRole Classify(const float* data, const MatrixLayout& layout, bool expectProj) const;
+        static const char* GetRoleName(CameraRole role);
+
+        // Lock-free path for writes to the locked camera buffer: checks the published layout and sets
+        // the thread's role and snapshot. Returns true if there is nothing to build (not the main view,
+        // or contents this thread or another context already built), false if the write needs the locked scan.
+        bool TryScanCameraWrite(uint64_t handle, const float* data, uint64_t size);
+        static uint64_t HashContents(const void* data, uint64_t size);
+
         void ScanBufferImpl(reshade::api::resource resource, const void* data, uint64_t size, bool isMapped);
         bool IsProjectionMatrix(const float* data);
-        bool IsViewMatrix(const float* data, bool* outIsTransposed);
         bool IsRightHandedProjection(const float* data);
         void DetectWorldUp(DirectX::XMMATRIX viewMat);
 
-        reshade::api::resource m_cameraBuffer = { 0 };
+        // Computes face matrices and patched buffer images for the camera contents in state.
+        // Must be called with m_mutex held.
+        CameraSnapshotPtr BuildSnapshot(const ConstantBufferState& state, uint64_t contentHash);
+        DirectX::XMMATRIX ComputeViewMatrixForFace(CubeFace face, DirectX::FXMVECTOR eyePos) const;
+
+        std::atomic<uint64_t> m_cameraBuffer = 0; // Handle, written with m_mutex held
+        // Camera buffer layout (see PackLayout in the .cpp) and the published snapshot's contentHash,
+        // both stored with m_mutex held for TryScanCameraWrite
+        std::atomic<uint64_t> m_cameraLayout = 0;
+        std::atomic<uint64_t> m_publishedHash = 0;
+        std::atomic<float> m_outputAspect = 0.0f;
+        std::atomic<int> m_mainViewSign = 0; // Sign of the main view's determinant, 0 until one was found
+        std::atomic<uint64_t> m_dataGeneration = 0;
+        CameraSnapshotPtr m_snapshot; // Replaced with m_mutex held, loaded atomically anywhere
         std::mutex m_mutex;
-        std::map<uint64_t, ConstantBufferState> m_bufferCache; // Key is resource handle value
+        BufferCache m_bufferCache; // Candidate buffers, key is resource handle value
 
-        DirectX::XMMATRIX m_lastGameView;
-        DirectX::XMMATRIX m_lastGameProj;
+        DirectX::XMMATRIX m_lastGameView = DirectX::XMMatrixIdentity();
+        DirectX::XMMATRIX m_lastGameProj = DirectX::XMMatrixIdentity();
         DirectX::XMVECTOR m_worldUp = DirectX::XMVectorSet(0, 1, 0, 0);
         bool m_upDetected = false;
         bool m_isRH = false; // Right-Handed
         bool m_isTransposed = false; // Matrix layout in buffer
+        bool m_isReversedZ = false;
         
+        std::atomic<uint32_t> m_scansSinceCameraUpdate = 0;
+
+        // Layout remembered from an earlier session (SignatureCache), checked before any full scan
+        CameraSignature m_signature;
+        bool m_hasSignature = false;
+        CameraSignature m_savedSignature;
+        std::atomic<uint32_t> m_signatureMisses = 0;
+        // Queues the camera buffer's layout for the cache once it differs from what was saved. m_mutex held.
+        void SaveSignature(const ConstantBufferState& state);
+
         bool m_deepScanDone = false;
         int m_deepScanAttempts = 0;
     };
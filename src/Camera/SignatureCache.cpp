@@ -0,0 +1,267 @@
+#include "pch.h"
+#include "SignatureCache.h"
+#include "../Core/Logger.h"
+#include <cctype>
+#include <cstdlib>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace Camera {
+
+    namespace {
+        std::mutex g_saveMutex;
+        CameraSignature g_pendingSave;
+        bool g_hasPendingSave = false;
+        bool g_saveRunning = false; // The thread exits only after clearing this with g_saveMutex held
+        std::thread g_saveThread;
+
+        void SaveThread() {
+            for (;;) {
+                CameraSignature signature;
+                {
+                    std::lock_guard<std::mutex> lock(g_saveMutex);
+                    if (!g_hasPendingSave) {
+                        g_saveRunning = false;
+                        return;
+                    }
+                    signature = g_pendingSave;
+                    g_hasPendingSave = false;
+                }
+                if (SignatureCache::Save(signature)) {
+                    LOG_INFO("Saved camera signature: ", signature.bufferSize, " byte buffer, view offset ", signature.viewOffset, ", proj offset ", signature.projOffset);
+                }
+            }
+        }
+    }
+
+    bool CameraSignature::operator==(const CameraSignature& other) const {
+        return bufferSize == other.bufferSize && viewOffset == other.viewOffset && projOffset == other.projOffset &&
+               transposed == other.transposed && rightHanded == other.rightHanded &&
+               worldUp[0] == other.worldUp[0] && worldUp[1] == other.worldUp[1] && worldUp[2] == other.worldUp[2];
+    }
+
+    // Just enough JSON for the cache: an object of executable name -> flat signature object.
+    // Unknown keys are skipped, anything malformed makes the whole file count as empty.
+    class SignatureReader {
+    public:
+        explicit SignatureReader(const std::string& text) : m_text(text) {}
+
+        bool Parse(std::map<std::string, CameraSignature>& entries) {
+            if (!Expect('{')) return false;
+            if (Peek() == '}') return Expect('}');
+            do {
+                std::string name;
+                CameraSignature signature;
+                if (!ReadString(name) || !Expect(':') || !ReadSignature(signature)) return false;
+                entries[name] = signature;
+            } while (Accept(','));
+            return Expect('}');
+        }
+
+    private:
+        char Peek() {
+            while (m_pos < m_text.size() && std::isspace((unsigned char)m_text[m_pos])) ++m_pos;
+            return m_pos < m_text.size() ? m_text[m_pos] : '\0';
+        }
+
+        bool Accept(char c) {
+            if (Peek() != c) return false;
+            ++m_pos;
+            return true;
+        }
+
+        bool Expect(char c) { return Accept(c); }
+
+        bool ReadString(std::string& out) {
+            if (!Expect('"')) return false;
+            out.clear();
+            while (m_pos < m_text.size() && m_text[m_pos] != '"') {
+                if (m_text[m_pos] == '\\' && m_pos + 1 < m_text.size()) ++m_pos;
+                out += m_text[m_pos++];
+            }
+            return Expect('"');
+        }
+
+        bool ReadNumber(double& out) {
+            Peek();
+            const char* begin = m_text.c_str() + m_pos;
+            char* end = nullptr;
+            out = std::strtod(begin, &end);
+            if (end == begin) return false;
+            m_pos += end - begin;
+            return true;
+        }
+
+        bool ReadBool(bool& out) {
+            Peek();
+            if (m_text.compare(m_pos, 4, "true") == 0) { out = true; m_pos += 4; return true; }
+            if (m_text.compare(m_pos, 5, "false") == 0) { out = false; m_pos += 5; return true; }
+            return false;
+        }
+
+        bool SkipValue() {
+            char c = Peek();
+            if (c == '"') { std::string ignored; return ReadString(ignored); }
+            if (c == 't' || c == 'f') { bool ignored; return ReadBool(ignored); }
+            if (c == '[' || c == '{') {
+                char close = c == '[' ? ']' : '}';
+                ++m_pos;
+                if (Accept(close)) return true;
+                do {
+                    if (close == '}') {
+                        std::string key;
+                        if (!ReadString(key) || !Expect(':')) return false;
+                    }
+                    if (!SkipValue()) return false;
+                } while (Accept(','));
+                return Expect(close);
+            }
+            double ignored;
+            return ReadNumber(ignored);
+        }
+
+        bool ReadSignature(CameraSignature& out) {
+            if (!Expect('{')) return false;
+            if (Accept('}')) return true;
+            do {
+                std::string key;
+                if (!ReadString(key) || !Expect(':')) return false;
+
+                double number;
+                bool ok = true;
+                if (key == "bufferSize")       { ok = ReadNumber(number); out.bufferSize = (uint32_t)number; }
+                else if (key == "viewOffset")  { ok = ReadNumber(number); out.viewOffset = (int)number; }
+                else if (key == "projOffset")  { ok = ReadNumber(number); out.projOffset = (int)number; }
+                else if (key == "transposed")  { ok = ReadBool(out.transposed); }
+                else if (key == "rightHanded") { ok = ReadBool(out.rightHanded); }
+                else if (key == "worldUp") {
+                    ok = Expect('[');
+                    for (int i = 0; ok && i < 3; ++i) {
+                        ok = (i == 0 || Expect(',')) && ReadNumber(number);
+                        out.worldUp[i] = (float)number;
+                    }
+                    ok = ok && Expect(']');
+                }
+                else ok = SkipValue();
+                if (!ok) return false;
+            } while (Accept(','));
+            return Expect('}');
+        }
+
+        const std::string& m_text;
+        size_t m_pos = 0;
+    };
+
+    static bool ReadEntries(const std::wstring& path, std::map<std::string, CameraSignature>& entries) {
+        std::ifstream file(path);
+        if (!file.is_open()) return false;
+
+        std::stringstream text;
+        text << file.rdbuf();
+        std::string content = text.str();
+        if (!SignatureReader(content).Parse(entries)) {
+            entries.clear();
+            return false;
+        }
+        return true;
+    }
+
+    static std::string Escape(const std::string& value) {
+        std::string out;
+        for (char c : value) {
+            if (c == '"' || c == '\\') out += '\\';
+            out += c;
+        }
+        return out;
+    }
+
+    std::wstring SignatureCache::GetCachePath() {
+        // The directory of the addon DLL, not the game's working directory
+        HMODULE module = nullptr;
+        wchar_t path[MAX_PATH] = {};
+        if (GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                               (LPCWSTR)&SignatureCache::GetCachePath, &module) &&
+            GetModuleFileNameW(module, path, MAX_PATH) != 0)
+        {
+            return (std::filesystem::path(path).parent_path() / L"WideCapture.cache.json").wstring();
+        }
+        return L"WideCapture.cache.json";
+    }
+
+    std::string SignatureCache::GetExecutableName() {
+        wchar_t path[MAX_PATH] = {};
+        if (GetModuleFileNameW(nullptr, path, MAX_PATH) == 0) return {};
+
+        std::string name = std::filesystem::path(path).filename().u8string();
+        for (char& c : name) c = (char)std::tolower((unsigned char)c);
+        return name;
+    }
+
+    bool SignatureCache::Load(CameraSignature& signature) {
+        std::string exe = GetExecutableName();
+        if (exe.empty()) return false;
+
+        std::map<std::string, CameraSignature> entries;
+        if (!ReadEntries(GetCachePath(), entries)) return false;
+
+        auto it = entries.find(exe);
+        if (it == entries.end()) return false;
+        signature = it->second;
+        return signature.bufferSize != 0 && (signature.viewOffset >= 0 || signature.projOffset >= 0);
+    }
+
+    bool SignatureCache::Save(const CameraSignature& signature) {
+        std::string exe = GetExecutableName();
+        if (exe.empty()) return false;
+
+        std::wstring path = GetCachePath();
+        std::map<std::string, CameraSignature> entries;
+        ReadEntries(path, entries);
+        entries[exe] = signature;
+
+        std::ofstream file(path, std::ios::out | std::ios::trunc);
+        if (!file.is_open()) {
+            LOG_WARNING("Failed to write camera signature cache");
+            return false;
+        }
+
+        // Loaded signatures are compared exactly, so the floats must read back bit for bit
+        file << std::setprecision(std::numeric_limits<float>::max_digits10);
+        file << "{\n";
+        size_t index = 0;
+        for (const auto& [name, entry] : entries) {
+            file << "  \"" << Escape(name) << "\": { \"bufferSize\": " << entry.bufferSize
+                 << ", \"viewOffset\": " << entry.viewOffset << ", \"projOffset\": " << entry.projOffset
+                 << ", \"transposed\": " << (entry.transposed ? "true" : "false")
+                 << ", \"rightHanded\": " << (entry.rightHanded ? "true" : "false")
+                 << ", \"worldUp\": [" << entry.worldUp[0] << ", " << entry.worldUp[1] << ", " << entry.worldUp[2] << "] }"
+                 << (++index < entries.size() ? ",\n" : "\n");
+        }
+        file << "}\n";
+        return true;
+    }
+
+    void SignatureCache::SaveAsync(const CameraSignature& signature) {
+        std::lock_guard<std::mutex> lock(g_saveMutex);
+        g_pendingSave = signature;
+        g_hasPendingSave = true;
+        if (g_saveRunning) return; // Picked up before the thread exits
+
+        // A finished thread is only joined here, it no longer needs the lock
+        if (g_saveThread.joinable()) g_saveThread.join();
+        g_saveRunning = true;
+        g_saveThread = std::thread(SaveThread);
+    }
+
+    void SignatureCache::Flush() {
+        std::thread thread;
+        {
+            std::lock_guard<std::mutex> lock(g_saveMutex);
+            thread = std::move(g_saveThread);
+        }
+        if (thread.joinable()) thread.join();
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+namespace Camera {
+
+    // Where the camera lives in a game's constant buffers, as found by a previous session
+    struct CameraSignature {
+        uint32_t bufferSize = 0;
+        int viewOffset = -1; // In floats, -1 if not found
+        int projOffset = -1;
+        bool transposed = false;
+        bool rightHanded = false;
+        float worldUp[3] = { 0, 1, 0 };
+
+        bool operator==(const CameraSignature& other) const;
+        bool operator!=(const CameraSignature& other) const { return !(*this == other); }
+    };
+
+    // One signature per game executable in WideCapture.cache.json, next to the addon.
+    // The file is small and only touched at startup and when a new layout locks on; the writes
+    // happen on a background thread.
+    class SignatureCache {
+    public:
+        // Loads the running executable's entry. Returns false if there is none or the file is unreadable.
+        static bool Load(CameraSignature& signature);
+
+        // Adds or replaces the running executable's entry, keeping the other games'
+        static bool Save(const CameraSignature& signature);
+
+        // Queues Save on a background thread, so the caller never waits for the file. A signature
+        // queued while a write is running replaces any other still waiting.
+        static void SaveAsync(const CameraSignature& signature);
+        // Waits until every queued signature is written
+        static void Flush();
+
+    private:
+        static std::wstring GetCachePath();
+        static std::string GetExecutableName();
+    };
+}
@@ -1,4 +1,10 @@
-Texture2D<float4> InputTexture : register(t0);
+// ColorConvert.hlsl
+// Fused cube projection (layout from Projection.hlsli) + RGB -> NV12 conversion.
+// Each thread owns one 2x2 block of the output: it samples the cubemap four times,
+// writes four luma texels and one averaged chroma texel straight into the NV12 planes.
+
+#include "Projection.hlsli"
+
 RWTexture2D<unorm float> OutputY : register(u0);
 RWTexture2D<unorm float2> OutputUV : register(u1);
 
@@ -10,51 +16,27 @@ static const float3 RGB2V  = float3(0.5000, -0.4542, -0.0458);
 [numthreads(16, 16, 1)]
 void main(uint3 dispatchThreadId : SV_DispatchThreadID)
 {
-    uint2 pos = dispatchThreadId.xy;
     uint width, height;
-    InputTexture.GetDimensions(width, height);
-
-    if (pos.x >= width || pos.y >= height) return;
-
-    // Read RGB (2x2 block logic handled by thread ID mapping?)
-    // NV12 has full res Y, half res UV.
-    // We can compute Y for every pixel.
-    // For UV, we compute only on even coordinates (2x2 block top-left).
-    
-    // Sample directly texelFetch
-    float4 pixel = InputTexture[pos];
-    // Gamma correction? Assuming Input is sRGB (UNORM), shader reads linear? 
-    // Usually R8G8B8A8_UNORM SRV reads as linearized float. 
-    // NVENC expects YUV usually in limited range or full range. 
-    // We'll output YUV.
-
-    float y = dot(pixel.rgb, RGB2Y);
-    OutputY[pos] = y;
-
-    // Subsample UV
-    if ((pos.x % 2 == 0) && (pos.y % 2 == 0)) {
-        // Average 4 pixels for better quality? 
-        // Or simple subsample (top-left). Let's do simple for speed first.
-        
-        // Better: Average.
-        // float4 p00 = InputTexture[pos]; // Already fetched
-        // float4 p01 = InputTexture[uint2(pos.x+1, pos.y)];
-        // float4 p10 = InputTexture[uint2(pos.x, pos.y+1)];
-        // float4 p11 = InputTexture[uint2(pos.x+1, pos.y+1)];
-        // float3 avgRGB = (p00.rgb + p01.rgb + p10.rgb + p11.rgb) * 0.25;
-        
-        // But checking bounds:
-        float3 avgRGB = pixel.rgb; // Fallback
-        if (pos.x + 1 < width && pos.y + 1 < height) {
-             float3 p01 = InputTexture[uint2(pos.x+1, pos.y)].rgb;
-             float3 p10 = InputTexture[uint2(pos.x, pos.y+1)].rgb;
-             float3 p11 = InputTexture[uint2(pos.x+1, pos.y+1)].rgb;
-             avgRGB = (pixel.rgb + p01 + p10 + p11) * 0.25;
-        }
-
-        float u = dot(avgRGB, RGB2U) + 0.5;
-        float v = dot(avgRGB, RGB2V) + 0.5;
-        
-        OutputUV[uint2(pos.x / 2, pos.y / 2)] = float2(u, v);
+    OutputY.GetDimensions(width, height);
+
+    uint2 block = dispatchThreadId.xy;
+    uint2 origin = block * 2;
+    if (origin.x >= width || origin.y >= height) return;
+
+    float2 size = float2(width, height);
+    float3 sum = 0;
+
+    [unroll] for (uint i = 0; i < 4; ++i) {
+        // Clamp so odd sizes still average four valid samples
+        uint2 pos = min(origin + uint2(i & 1, i >> 1), uint2(width - 1, height - 1));
+        float4 color;
+        SampleProjection(pos, size, color); // Empty pixels come out black
+        float3 rgb = color.rgb;
+
+        OutputY[pos] = dot(rgb, RGB2Y); // Full range, as in RGBToNV12.hlsl
+        sum += rgb;
     }
+
+    float3 avgRGB = sum * 0.25;
+    OutputUV[block] = float2(dot(avgRGB, RGB2U) + 0.5, dot(avgRGB, RGB2V) + 0.5);
 }
@@ -0,0 +1,63 @@
+#pragma once
+#include <d3d11.h>
+#include <cstdint>
+
+namespace Compute {
+
+    // Output layouts produced from the cubemap. Values are the Projection option in ReShade.ini
+    // and the PROJECTION define seen by Projection.hlsli.
+    enum class ProjectionType : uint32_t {
+        Equirectangular = 0,    // 2:1 lat/long
+        EquiAngularCubemap = 1, // 3x2 EAC, YouTube layout
+        CubeStrip = 2,          // 3x2 faces with plain perspective sampling
+        DualFisheye = 3         // Two 180 degree equidistant circles, front and back
+    };
+
+    struct OutputSize {
+        uint32_t width;
+        uint32_t height;
+    };
+
+    inline ProjectionType ToProjectionType(uint32_t value) {
+        return value <= (uint32_t)ProjectionType::DualFisheye ? (ProjectionType)value : ProjectionType::Equirectangular;
+    }
+
+    // Output size that keeps roughly the cube's angular resolution at the view centre.
+    // Both dimensions are multiples of 16 (even sizes are required by NV12 anyway).
+    inline OutputSize GetOutputSize(ProjectionType type, uint32_t faceSize) {
+        OutputSize size = {};
+        switch (type) {
+            case ProjectionType::EquiAngularCubemap:
+            case ProjectionType::CubeStrip:
+                // 6 f^2 pixels, 25% less than equirect
+                size = { faceSize * 3, faceSize * 2 };
+                break;
+            case ProjectionType::DualFisheye:
+                // A 180 degree circle spans two faces
+                size = { faceSize * 4, faceSize * 2 };
+                break;
+            case ProjectionType::Equirectangular:
+            default:
+                size = { faceSize * 4, faceSize * 2 };
+                break;
+        }
+        size.width = (size.width + 15) & ~15u;
+        size.height = (size.height + 15) & ~15u;
+        return size;
+    }
+
+    inline const char* GetProjectionName(ProjectionType type) {
+        switch (type) {
+            case ProjectionType::EquiAngularCubemap: return "EAC";
+            case ProjectionType::CubeStrip: return "cube strip";
+            case ProjectionType::DualFisheye: return "dual fisheye";
+            default: return "equirectangular";
+        }
+    }
+
+    // Value for the PROJECTION shader define
+    inline const char* GetProjectionDefine(ProjectionType type) {
+        static const char* values[] = { "0", "1", "2", "3" };
+        return values[(uint32_t)type];
+    }
+}
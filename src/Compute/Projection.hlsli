@@ -0,0 +1,193 @@
+// Projection.hlsli
+// Output pixel -> view direction -> cube sample, shared by the projection kernels.
+// PROJECTION selects the layout, values match Compute::ProjectionType.
+// USE_DIRECTION_LUT reads the face/UV per pixel from a baked table (ProjectionLUT.hlsl).
+// FACE_SUBRECTS samples faces that were rendered into only part of their slice.
+
+#ifndef PROJECTION
+#define PROJECTION 0
+#endif
+
+#define PROJECTION_EQUIRECT    0
+#define PROJECTION_EAC         1
+#define PROJECTION_CUBE_STRIP  2
+#define PROJECTION_FISHEYE     3
+
+static const float PI = 3.14159265359f;
+
+// Equirectangular, Y-up
+float3 EquirectDirection(uint2 pixel, float2 size)
+{
+    float2 uv = float2(pixel) / size;
+
+    // Theta (Longitude): [-PI, PI], Phi (Latitude): [-PI/2, PI/2]
+    float theta = uv.x * 2.0f * PI - PI;
+    float phi = uv.y * PI - PI / 2.0f;
+
+    float3 dir;
+    dir.x = cos(phi) * sin(theta);
+    dir.y = sin(phi);
+    dir.z = cos(phi) * cos(theta);
+    return normalize(dir);
+}
+
+// Inverse of DirectionToFaceUV, D3D cube map face layout (0 = +X ... 5 = -Z)
+float3 FaceUVToDirection(uint face, float2 uv)
+{
+    float2 p = uv * 2.0f - 1.0f;
+    float3 dir;
+    switch (face) {
+        case 0:  dir = float3(1, -p.y, -p.x); break;
+        case 1:  dir = float3(-1, -p.y, p.x); break;
+        case 2:  dir = float3(p.x, 1, p.y); break;
+        case 3:  dir = float3(p.x, -1, -p.y); break;
+        case 4:  dir = float3(p.x, -p.y, 1); break;
+        default: dir = float3(-p.x, -p.y, -1); break;
+    }
+    return normalize(dir);
+}
+
+// 3x2 layout: Left Front Right on top, Down Back Up below, rotated 90 degrees so the
+// bottom row stays continuous. EAC additionally spaces samples evenly in angle.
+float3 CubeLayoutDirection(uint2 pixel, float2 size, bool equiAngular)
+{
+    static const uint faces[6] = { 1, 4, 0, 3, 5, 2 };
+
+    float2 tileSize = size / float2(3, 2);
+    float2 pos = float2(pixel) + 0.5f;
+    uint2 tile = min((uint2)(pos / tileSize), uint2(2, 1));
+    float2 uv = (pos - tile * tileSize) / tileSize;
+
+    if (tile.y == 1) uv = float2(uv.y, 1.0f - uv.x);
+
+    if (equiAngular) {
+        // Face coordinate is linear in angle: p = tan(q * PI/4)
+        uv = tan((uv * 2.0f - 1.0f) * (PI / 4.0f)) * 0.5f + 0.5f;
+    }
+
+    return FaceUVToDirection(faces[tile.y * 3 + tile.x], uv);
+}
+
+// Two equidistant 180 degree circles side by side, front (+Z) then back (-Z)
+bool FisheyeDirection(uint2 pixel, float2 size, out float3 dir)
+{
+    float2 circleSize = size / float2(2, 1);
+    float2 pos = float2(pixel) + 0.5f;
+    uint eye = pos.x >= circleSize.x ? 1 : 0;
+    float2 p = (pos - float2(eye * circleSize.x, 0)) / circleSize * 2.0f - 1.0f;
+
+    float r = length(p);
+    dir = float3(0, 0, 1);
+    if (r > 1.0f) return false;
+
+    float theta = r * (PI / 2.0f);
+    float2 s = r > 0.0f ? p / r * sin(theta) : float2(0, 0);
+    dir = float3(s.x, -s.y, cos(theta));
+    if (eye == 1) dir = float3(-dir.x, dir.y, -dir.z);
+    return true;
+}
+
+// Returns false for pixels the layout leaves empty (outside the fisheye circles)
+bool OutputDirection(uint2 pixel, float2 size, out float3 dir)
+{
+#if PROJECTION == PROJECTION_EAC
+    dir = CubeLayoutDirection(pixel, size, true);
+    return true;
+#elif PROJECTION == PROJECTION_CUBE_STRIP
+    dir = CubeLayoutDirection(pixel, size, false);
+    return true;
+#elif PROJECTION == PROJECTION_FISHEYE
+    return FisheyeDirection(pixel, size, dir);
+#else
+    dir = EquirectDirection(pixel, size);
+    return true;
+#endif
+}
+
+// Direction LUT entries: face in bits 29-31, 14-bit u in bits 0-13, 14-bit v in bits 14-27.
+// 14 bits still leave four sub-texel steps at a 4096 face. Face 7 marks an empty pixel.
+static const uint LUT_EMPTY = 7u << 29;
+
+// Cube face and face UV for a direction, using the D3D cube map face layout
+float3 DirectionToFaceUV(float3 dir)
+{
+    float3 a = abs(dir);
+    float face;
+    float2 sc;
+    float ma;
+
+    if (a.x >= a.y && a.x >= a.z) {
+        face = dir.x >= 0 ? 0 : 1;
+        sc = float2(dir.x >= 0 ? -dir.z : dir.z, -dir.y);
+        ma = a.x;
+    } else if (a.y >= a.z) {
+        face = dir.y >= 0 ? 2 : 3;
+        sc = float2(dir.x, dir.y >= 0 ? dir.z : -dir.z);
+        ma = a.y;
+    } else {
+        face = dir.z >= 0 ? 4 : 5;
+        sc = float2(dir.z >= 0 ? dir.x : -dir.x, -dir.y);
+        ma = a.z;
+    }
+
+    return float3(sc / ma * 0.5f + 0.5f, face);
+}
+
+uint PackFaceUV(float3 faceUV)
+{
+    uint2 uv = (uint2)round(saturate(faceUV.xy) * 16383.0f);
+    return ((uint)faceUV.z << 29) | (uv.y << 14) | uv.x;
+}
+
+// Returns false for LUT_EMPTY
+bool UnpackFaceUV(uint packed, out float3 faceUV)
+{
+    faceUV = float3(float2(packed & 0x3FFF, (packed >> 14) & 0x3FFF) / 16383.0f, (float)(packed >> 29));
+    return (packed >> 29) < 6;
+}
+
+// Inputs shared by the kernels that sample the cube
+TextureCube<float4> g_InputCubemap : register(t0);
+Texture2D<uint> g_DirectionLut : register(t1);
+Texture2DArray<float4> g_InputFaces : register(t2); // Same cube, as six slices
+SamplerState g_Sampler : register(s0);
+
+#ifdef FACE_SUBRECTS
+// Per face: x = rendered fraction of the slice, y/z = max/min UV that keeps bilinear taps inside it
+cbuffer FaceRects : register(b0)
+{
+    float4 g_FaceUV[6];
+};
+
+float3 ToFaceSubRect(float3 faceUV)
+{
+    float4 rect = g_FaceUV[(uint)faceUV.z];
+    return float3(clamp(faceUV.xy * rect.x, rect.z, rect.y), faceUV.z);
+}
+#endif
+
+// Color of an output pixel, false for pixels the layout leaves empty
+bool SampleProjection(uint2 pos, float2 size, out float4 color)
+{
+    color = float4(0, 0, 0, 1);
+    float3 faceUV;
+
+#ifdef USE_DIRECTION_LUT
+    if (!UnpackFaceUV(g_DirectionLut[pos], faceUV)) return false;
+#else
+    float3 dir;
+    if (!OutputDirection(pos, size, dir)) return false;
+#ifndef FACE_SUBRECTS
+    // Seamless cube filtering when the full slices are valid
+    color = g_InputCubemap.SampleLevel(g_Sampler, dir, 0);
+    return true;
+#endif
+    faceUV = DirectionToFaceUV(dir);
+#endif
+
+#ifdef FACE_SUBRECTS
+    faceUV = ToFaceSubRect(faceUV);
+#endif
+    color = g_InputFaces.SampleLevel(g_Sampler, faceUV, 0);
+    return true;
+}
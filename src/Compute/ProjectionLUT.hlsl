@@ -0,0 +1,20 @@
+// ProjectionLUT.hlsl
+// Bakes the output pixel -> (cube face, face UV) mapping once per output size,
+// so the per-frame kernels do a single texture fetch instead of the trig.
+
+#include "Projection.hlsli"
+
+RWTexture2D<uint> g_DirectionLut : register(u0);
+
+[numthreads(16, 16, 1)]
+void main(uint3 DTid : SV_DispatchThreadID)
+{
+    uint width, height;
+    g_DirectionLut.GetDimensions(width, height);
+
+    if (DTid.x >= width || DTid.y >= height) return;
+
+    float3 dir;
+    bool covered = OutputDirection(DTid.xy, float2(width, height), dir);
+    g_DirectionLut[DTid.xy] = covered ? PackFaceUV(DirectionToFaceUV(dir)) : LUT_EMPTY;
+}
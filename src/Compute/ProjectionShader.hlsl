@@ -1,12 +1,9 @@
 // ProjectionShader.hlsl
-// Converts a Cubemap (or Texture2DArray of 6 faces) to Equirectangular Projection
+// Converts a Cubemap (or Texture2DArray of 6 faces) to the output layout selected by PROJECTION
 
-TextureCube<float4> g_InputCubemap : register(t0);
-RWTexture2D<float4> g_OutputTexture : register(u0);
-
-SamplerState g_Sampler : register(s0);
+#include "Projection.hlsli"
 
-static const float PI = 3.14159265359f;
+RWTexture2D<float4> g_OutputTexture : register(u0);
 
 [numthreads(16, 16, 1)]
 void main(uint3 DTid : SV_DispatchThreadID)
@@ -16,25 +13,9 @@ void main(uint3 DTid : SV_DispatchThreadID)
 
     if (DTid.x >= width || DTid.y >= height) return;
 
-    // Normalizing coordinates to [0, 1]
-    float2 uv = float2(DTid.x, DTid.y) / float2(width, height);
-
-    // Spherical coordinates
-    // Theta (Longitude): [-PI, PI]
-    // Phi (Latitude): [-PI/2, PI/2]
-    float theta = uv.x * 2.0f * PI - PI;
-    float phi = uv.y * PI - PI / 2.0f;
-
-    // Converting to direction vector
-    // Assuming Y-up coordinate system
-    float3 dir;
-    dir.x = cos(phi) * sin(theta);
-    dir.y = sin(phi);      
-    dir.z = cos(phi) * cos(theta);
-
-    // Sampling the cubemap
-    // We sample LoD 0 directly
-    float4 color = g_InputCubemap.SampleLevel(g_Sampler, normalize(dir), 0);
+    // We sample LoD 0 directly. Pixels outside the layout stay black.
+    float4 color;
+    SampleProjection(DTid.xy, float2(width, height), color);
 
     g_OutputTexture[DTid.xy] = color;
 }
@@ -1,55 +1,130 @@
 #include "pch.h"
 #include "ShaderCompiler.h"
+#include "../Core/Config.h"
 #include "../Core/Logger.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    struct EmbeddedShader {
+        const char* key; // file|entry|NAME=VALUE... with the defines sorted by name
+        const BYTE* data;
+        size_t size;
+    };
+}
+
+#ifdef WIDECAPTURE_EMBEDDED_SHADERS
+// Generated by CMake, includes the fxc headers and defines kEmbeddedShaders
+#include "EmbeddedShaderTable.h"
+#endif
 
 namespace Compute {
-    HRESULT ShaderCompiler::CompileComputeShader(
-        ID3D11Device* device, 
-        const std::wstring& filename,
-        const std::string& entryPoint, 
-        ID3D11ComputeShader** ppShader,
-        ID3D10Blob** ppBlob
-    ) {
-        Microsoft::WRL::ComPtr<ID3D10Blob> shaderBlob;
-        Microsoft::WRL::ComPtr<ID3D10Blob> errorBlob;
-        
+    static std::string GetShaderKey(const char* filename, const char* entryPoint, const D3D_SHADER_MACRO* defines) {
+        std::vector<std::string> parts;
+        for (const D3D_SHADER_MACRO* d = defines; d && d->Name; ++d) {
+            parts.push_back(std::string(d->Name) + "=" + (d->Definition ? d->Definition : ""));
+        }
+        std::sort(parts.begin(), parts.end());
+
+        std::string key = std::string(filename) + "|" + entryPoint;
+        for (const std::string& part : parts) key += "|" + part;
+        return key;
+    }
+
+    bool ShaderCompiler::FindEmbedded(const char* filename, const char* entryPoint, const D3D_SHADER_MACRO* defines, Bytecode& bytecode) {
+#ifdef WIDECAPTURE_EMBEDDED_SHADERS
+        std::string key = GetShaderKey(filename, entryPoint, defines);
+        for (const EmbeddedShader& shader : kEmbeddedShaders) {
+            if (key == shader.key) {
+                bytecode.data = shader.data;
+                bytecode.size = shader.size;
+                return true;
+            }
+        }
+        LOG_WARNING("No embedded shader for ", key);
+#endif
+        return false;
+    }
+
+    bool ShaderCompiler::CompileFromFile(const char* filename, const char* entryPoint, const char* target, const D3D_SHADER_MACRO* defines, Bytecode& bytecode) {
         DWORD flags = D3DCOMPILE_ENABLE_STRICTNESS;
 #if defined(DEBUG) || defined(_DEBUG)
         flags |= D3DCOMPILE_DEBUG;
 #endif
 
-        HRESULT hr = D3DCompileFromFile(
-            filename.c_str(),
-            nullptr,
-            D3D_COMPILE_STANDARD_FILE_INCLUDE,
-            entryPoint.c_str(),
-            "cs_5_0", // Compute Shader 5.0
-            flags,
-            0,
-            shaderBlob.GetAddressOf(),
-            errorBlob.GetAddressOf()
-        );
+        std::wstring name(filename, filename + strlen(filename));
+        const wchar_t* directories[] = { L"shaders/", L"", L"src/Compute/", L"src/Graphics/" };
+        for (const wchar_t* directory : directories) {
+            std::wstring path = directory + name;
+            if (GetFileAttributesW(path.c_str()) == INVALID_FILE_ATTRIBUTES) continue;
 
-        if (FAILED(hr)) {
-            if (errorBlob) {
-                LOG_ERROR("Shader Compilation Error: ", (char*)errorBlob->GetBufferPointer());
-            } else {
-                LOG_ERROR("Shader Compilation Failed. HR: ", std::hex, hr);
+            Microsoft::WRL::ComPtr<ID3DBlob> shaderBlob;
+            Microsoft::WRL::ComPtr<ID3DBlob> errorBlob;
+            HRESULT hr = D3DCompileFromFile(path.c_str(), defines, D3D_COMPILE_STANDARD_FILE_INCLUDE,
+                entryPoint, target, flags, 0, shaderBlob.GetAddressOf(), errorBlob.GetAddressOf());
+            if (FAILED(hr)) {
+                if (errorBlob) {
+                    LOG_ERROR("Shader Compilation Error: ", (char*)errorBlob->GetBufferPointer());
+                } else {
+                    LOG_ERROR("Shader Compilation Failed. HR: ", std::hex, hr);
+                }
+                return false;
             }
-            return hr;
+
+            bytecode.blob = shaderBlob;
+            bytecode.data = shaderBlob->GetBufferPointer();
+            bytecode.size = shaderBlob->GetBufferSize();
+            return true;
         }
+        return false;
+    }
+
+    bool ShaderCompiler::LoadBytecode(const char* filename, const char* entryPoint, const char* target, const D3D_SHADER_MACRO* defines, Bytecode& bytecode) {
+        // The override lets shader edits be tried without rebuilding the addon
+        if (Config::ShaderOverride && CompileFromFile(filename, entryPoint, target, defines, bytecode)) return true;
+        if (FindEmbedded(filename, entryPoint, defines, bytecode)) return true;
+        if (!Config::ShaderOverride && CompileFromFile(filename, entryPoint, target, defines, bytecode)) return true;
+
+        LOG_ERROR("Shader not available: ", filename, " ", entryPoint);
+        return false;
+    }
+
+    HRESULT ShaderCompiler::CreateComputeShader(
+        ID3D11Device* device,
+        const char* filename,
+        const char* entryPoint,
+        ID3D11ComputeShader** ppShader,
+        const D3D_SHADER_MACRO* defines
+    ) {
+        Bytecode bytecode;
+        if (!LoadBytecode(filename, entryPoint, "cs_5_0", defines, bytecode)) return E_FAIL;
 
-        hr = device->CreateComputeShader(shaderBlob->GetBufferPointer(), shaderBlob->GetBufferSize(), nullptr, ppShader);
-        
+        HRESULT hr = device->CreateComputeShader(bytecode.data, bytecode.size, nullptr, ppShader);
         if (FAILED(hr)) {
             LOG_ERROR("Failed to create Compute Shader. HR: ", std::hex, hr);
-            return hr;
         }
+        return hr;
+    }
+
+    HRESULT ShaderCompiler::CreateVertexShader(ID3D11Device* device, const char* filename, const char* entryPoint, ID3D11VertexShader** ppShader) {
+        Bytecode bytecode;
+        if (!LoadBytecode(filename, entryPoint, "vs_5_0", nullptr, bytecode)) return E_FAIL;
 
-        if (ppBlob) {
-            *ppBlob = shaderBlob.Detach();
+        HRESULT hr = device->CreateVertexShader(bytecode.data, bytecode.size, nullptr, ppShader);
+        if (FAILED(hr)) {
+            LOG_ERROR("Failed to create Vertex Shader. HR: ", std::hex, hr);
         }
+        return hr;
+    }
 
-        return S_OK;
+    HRESULT ShaderCompiler::CreatePixelShader(ID3D11Device* device, const char* filename, const char* entryPoint, ID3D11PixelShader** ppShader) {
+        Bytecode bytecode;
+        if (!LoadBytecode(filename, entryPoint, "ps_5_0", nullptr, bytecode)) return E_FAIL;
+
+        HRESULT hr = device->CreatePixelShader(bytecode.data, bytecode.size, nullptr, ppShader);
+        if (FAILED(hr)) {
+            LOG_ERROR("Failed to create Pixel Shader. HR: ", std::hex, hr);
+        }
+        return hr;
     }
 }
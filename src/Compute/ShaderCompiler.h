@@ -5,14 +5,31 @@
 #include <wrl/client.h>
 
 namespace Compute {
+    // Shaders are looked up by source file name, entry point and defines. Builds with fxc embed every
+    // variant as bytecode (see CMakeLists.txt), so nothing has to be found on disk or compiled at startup.
+    // The .hlsl files are compiled at runtime only when the variant isn't embedded, or first when
+    // Config::ShaderOverride is set, searching shaders/, the working directory and the source tree.
     class ShaderCompiler {
     public:
-        static HRESULT CompileComputeShader(
-            ID3D11Device* device, 
-            const std::wstring& filename,
-            const std::string& entryPoint, 
+        static HRESULT CreateComputeShader(
+            ID3D11Device* device,
+            const char* filename, // e.g. "ProjectionShader.hlsl"
+            const char* entryPoint,
             ID3D11ComputeShader** ppShader,
-            ID3D10Blob** ppBlob = nullptr
+            const D3D_SHADER_MACRO* defines = nullptr // nullptr-terminated, like D3DCompile
         );
+        static HRESULT CreateVertexShader(ID3D11Device* device, const char* filename, const char* entryPoint, ID3D11VertexShader** ppShader);
+        static HRESULT CreatePixelShader(ID3D11Device* device, const char* filename, const char* entryPoint, ID3D11PixelShader** ppShader);
+
+    private:
+        struct Bytecode {
+            const void* data = nullptr;
+            size_t size = 0;
+            Microsoft::WRL::ComPtr<ID3DBlob> blob; // Set when compiled at runtime
+        };
+
+        static bool LoadBytecode(const char* filename, const char* entryPoint, const char* target, const D3D_SHADER_MACRO* defines, Bytecode& bytecode);
+        static bool FindEmbedded(const char* filename, const char* entryPoint, const D3D_SHADER_MACRO* defines, Bytecode& bytecode);
+        static bool CompileFromFile(const char* filename, const char* entryPoint, const char* target, const D3D_SHADER_MACRO* defines, Bytecode& bytecode);
     };
 }
@@ -0,0 +1,116 @@
+#pragma once
+#include <reshade.hpp>
+
+// Runtime options, read once from the [WideCapture] section of ReShade.ini.
+// Anything missing from the file keeps the default below.
+class Config {
+public:
+    static void Load() {
+        reshade::get_config_value(nullptr, "WideCapture", "SinglePassLayered", SinglePassLayered);
+        reshade::get_config_value(nullptr, "WideCapture", "FaceCulling", FaceCulling);
+        reshade::get_config_value(nullptr, "WideCapture", "MainViewOnly", MainViewOnly);
+        reshade::get_config_value(nullptr, "WideCapture", "FaceResolution", FaceResolution);
+        reshade::get_config_value(nullptr, "WideCapture", "Projection", Projection);
+        reshade::get_config_value(nullptr, "WideCapture", "ProjectionLUT", ProjectionLUT);
+        reshade::get_config_value(nullptr, "WideCapture", "EncoderQueueDepth", EncoderQueueDepth);
+        reshade::get_config_value(nullptr, "WideCapture", "EncoderDropOldest", EncoderDropOldest);
+        reshade::get_config_value(nullptr, "WideCapture", "EncoderCodec", EncoderCodec);
+        reshade::get_config_value(nullptr, "WideCapture", "EncoderBitrate", EncoderBitrate);
+        reshade::get_config_value(nullptr, "WideCapture", "EncoderKeyframeInterval", EncoderKeyframeInterval);
+        reshade::get_config_value(nullptr, "WideCapture", "EncoderTiles", EncoderTiles);
+        reshade::get_config_value(nullptr, "WideCapture", "EncoderTileRows", EncoderTileRows);
+        reshade::get_config_value(nullptr, "WideCapture", "OutputFragmented", OutputFragmented);
+        reshade::get_config_value(nullptr, "WideCapture", "OutputSegmentMinutes", OutputSegmentMinutes);
+        reshade::get_config_value(nullptr, "WideCapture", "DynamicResolution", DynamicResolution);
+        reshade::get_config_value(nullptr, "WideCapture", "GpuBudgetMs", GpuBudgetMs);
+        reshade::get_config_value(nullptr, "WideCapture", "DynamicResolutionMinScale", DynamicResolutionMinScale);
+        reshade::get_config_value(nullptr, "WideCapture", "FaceScaleFront", FaceScaleFront);
+        reshade::get_config_value(nullptr, "WideCapture", "FaceScaleSides", FaceScaleSides);
+        reshade::get_config_value(nullptr, "WideCapture", "FaceScaleBack", FaceScaleBack);
+        reshade::get_config_value(nullptr, "WideCapture", "FaceScaleVertical", FaceScaleVertical);
+        reshade::get_config_value(nullptr, "WideCapture", "TemporalReuseFaces", TemporalReuseFaces);
+        reshade::get_config_value(nullptr, "WideCapture", "TemporalReuseInterval", TemporalReuseInterval);
+        reshade::get_config_value(nullptr, "WideCapture", "TemporalReuseMaxMove", TemporalReuseMaxMove);
+        reshade::get_config_value(nullptr, "WideCapture", "TemporalReuseMaxRotation", TemporalReuseMaxRotation);
+        reshade::get_config_value(nullptr, "WideCapture", "ShaderOverride", ShaderOverride);
+        reshade::get_config_value(nullptr, "WideCapture", "Profiling", Profiling);
+        reshade::get_config_value(nullptr, "WideCapture", "ProfilingCsv", ProfilingCsv);
+    }
+
+    // Render all six faces with one draw through a generated layered geometry shader.
+    // Draws whose shaders can't be wrapped keep using the per-face path.
+    static inline bool SinglePassLayered = false;
+
+    // Skip faces whose frustum can't see a draw's bounding sphere (heuristic, see Graphics::FaceCuller).
+    static inline bool FaceCulling = false;
+
+    // Replicate only draws of the main view. Shadow and reflection passes written through the same
+    // camera buffer layout are told apart by their matrices (see Camera::CameraRole) and drawn once.
+    static inline bool MainViewOnly = true;
+
+    // Cube face size in pixels (e.g. 1024, 1536, 2048). 0 follows the back buffer's shorter side.
+    static inline uint32_t FaceResolution = 0;
+
+    // Output layout, see Compute::ProjectionType: 0 equirect, 1 EAC, 2 3x2 cube strip, 3 dual fisheye.
+    static inline uint32_t Projection = 0;
+
+    // Bake each output pixel's cube face and UV into a lookup texture instead of computing it per frame.
+    static inline bool ProjectionLUT = false;
+
+    // Frames that may wait for the encoder thread (1-8). When the queue is full the oldest frame
+    // is dropped, or with EncoderDropOldest off the render thread waits for a free slot.
+    static inline uint32_t EncoderQueueDepth = 4;
+    static inline bool EncoderDropOldest = true;
+
+    // Codec to try first: 0 picks by output size (H.264 up to 4096 wide, HEVC/AV1 beyond), 1 H.264,
+    // 2 HEVC, 3 AV1. If no hardware encoder opens with it, the others that fit are tried.
+    // EncoderBitrate is in Mbps, EncoderKeyframeInterval in seconds.
+    static inline uint32_t EncoderCodec = 0;
+    static inline uint32_t EncoderBitrate = 50;
+    static inline float EncoderKeyframeInterval = 2.0f;
+
+    // Encode the output as this many tiles (1-8), each with its own encoder session, for sizes one
+    // session can't handle. Tiles are columns, or rows with EncoderTileRows. The MP4 then holds one
+    // synchronized video stream per tile, left to right or top to bottom.
+    static inline uint32_t EncoderTiles = 1;
+    static inline bool EncoderTileRows = false;
+
+    // Write fragmented MP4 (nothing to rewrite when the capture stops, a crash loses at most one
+    // fragment), and/or start a new numbered file every OutputSegmentMinutes (0 for one file).
+    // Either one moves disk writes to a dedicated writer thread.
+    static inline bool OutputFragmented = false;
+    static inline uint32_t OutputSegmentMinutes = 0;
+
+    // Shrink the rendered part of each face while the capture's GPU time (face draws, projection,
+    // encoder copy) exceeds GpuBudgetMs, and grow it back when there is headroom.
+    // Faces never go below DynamicResolutionMinScale of their full size.
+    static inline bool DynamicResolution = false;
+    static inline float GpuBudgetMs = 4.0f;
+    static inline float DynamicResolutionMinScale = 0.5f;
+
+    // Per-face resolution tiers as a fraction of the face size (0.25-1), e.g. 1 / 0.75 / 0.5 / 0.5
+    // to spend fewer pixels where viewers rarely look. Sides are Left/Right, vertical is Up/Down.
+    // Combined with DynamicResolution, the dynamic scale multiplies these.
+    static inline float FaceScaleFront = 1.0f;
+    static inline float FaceScaleSides = 1.0f;
+    static inline float FaceScaleBack = 1.0f;
+    static inline float FaceScaleVertical = 1.0f;
+
+    // Faces (bit i = Camera::CubeFace i, e.g. 12 for Up + Down) that are re-rendered only every
+    // TemporalReuseInterval frames and otherwise keep last frame's contents. A face is refreshed early
+    // once the camera moved more than TemporalReuseMaxMove world units or turned more than
+    // TemporalReuseMaxRotation degrees since its last refresh.
+    static inline uint32_t TemporalReuseFaces = 0;
+    static inline uint32_t TemporalReuseInterval = 4;
+    static inline float TemporalReuseMaxMove = 0.5f;
+    static inline float TemporalReuseMaxRotation = 5.0f;
+
+    // Compile the .hlsl files found next to the game (shaders/ or the working directory) instead of
+    // using the bytecode embedded at build time, for trying shader changes without a rebuild
+    static inline bool ShaderOverride = false;
+
+    // Time the capture stages on CPU and GPU (see Profiler), shown in the ReShade overlay.
+    // ProfilingCsv also writes one row per frame to WideCapture.profile.csv.
+    static inline bool Profiling = false;
+    static inline bool ProfilingCsv = false;
+};
@@ -0,0 +1,180 @@
+#include "pch.h"
+#include "Logger.h"
+#include <cstdio>
+
+namespace {
+    // Bounded MPMC ring (Vyukov) used with a single consumer. A slot's sequence equals the position
+    // a producer may claim it at; the producer publishes it as position + 1, and the writer hands
+    // it back for the next lap as position + capacity.
+    constexpr size_t kCapacity = 2048;
+
+    struct Ring {
+        Ring() {
+            for (size_t i = 0; i < kCapacity; ++i) records[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        Logger::Record records[kCapacity];
+        alignas(64) std::atomic<size_t> enqueuePos{ 0 };
+        alignas(64) size_t dequeuePos = 0; // Writer thread only
+        std::atomic<uint64_t> dropped{ 0 };
+    };
+    Ring g_ring;
+
+    std::thread g_writer;
+    std::atomic<bool> g_stopWriter{ false };
+    std::ofstream g_logFile;
+
+    // Writes into a record's text and silently cuts what doesn't fit
+    class RecordBuffer : public std::streambuf {
+    public:
+        void Reset(char* begin, size_t size) { setp(begin, begin + size); }
+        size_t Length() const { return (size_t)(pptr() - pbase()); }
+
+    protected:
+        int_type overflow(int_type ch) override { return traits_type::not_eof(ch); }
+    };
+
+    struct RecordStream {
+        RecordBuffer buffer;
+        std::ostream stream{ &buffer };
+        std::ios::fmtflags defaultFlags = stream.flags();
+    };
+    thread_local RecordStream t_stream;
+
+    const char* GetPrefix(Logger::Level level) {
+        switch (level) {
+            case Logger::Level::Debug: return "[DBG] ";
+            case Logger::Level::Warning: return "[WARN] ";
+            case Logger::Level::Error: return "[ERR] ";
+            default: return "[INFO] ";
+        }
+    }
+
+    void AppendTimestamp(std::string& out, std::time_t time) {
+        // Records arrive in bursts from the same second, localtime only runs when it changes
+        static std::time_t lastTime = -1;
+        static char lastStamp[16] = {};
+        if (time != lastTime) {
+            std::tm tm;
+            localtime_s(&tm, &time);
+            strftime(lastStamp, sizeof(lastStamp), "[%H:%M:%S] ", &tm);
+            lastTime = time;
+        }
+        out += lastStamp;
+    }
+
+    // Appends every published record to out, returns false if there was none
+    bool Drain(std::string& out) {
+        bool any = false;
+        for (;;) {
+            Logger::Record& record = g_ring.records[g_ring.dequeuePos % kCapacity];
+            if (record.sequence.load(std::memory_order_acquire) != g_ring.dequeuePos + 1) break;
+
+            AppendTimestamp(out, record.time);
+            out += GetPrefix(record.level);
+            out.append(record.text, record.length);
+            out += '\n';
+
+            record.sequence.store(g_ring.dequeuePos + kCapacity, std::memory_order_release);
+            g_ring.dequeuePos++;
+            any = true;
+        }
+
+        uint64_t dropped = g_ring.dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped > 0) {
+            AppendTimestamp(out, std::time(nullptr));
+            out += GetPrefix(Logger::Level::Warning);
+            out += "Log queue full, dropped " + std::to_string(dropped) + " messages\n";
+            any = true;
+        }
+        return any;
+    }
+
+    void WriteBatch(const std::string& batch) {
+        fwrite(batch.data(), 1, batch.size(), stdout);
+        fflush(stdout);
+        if (g_logFile.is_open()) {
+            g_logFile.write(batch.data(), (std::streamsize)batch.size());
+            g_logFile.flush();
+        }
+    }
+}
+
+void Logger::Init() {
+    if (g_writer.joinable()) return;
+
+    AllocConsole();
+    FILE* f;
+    freopen_s(&f, "CONOUT$", "w", stdout);
+    freopen_s(&f, "CONOUT$", "w", stderr);
+
+    g_logFile.open("WideCapture.log", std::ios::out | std::ios::trunc);
+
+    g_stopWriter.store(false, std::memory_order_relaxed);
+    g_writer = std::thread(WriterThread);
+}
+
+void Logger::Shutdown() {
+    if (g_writer.joinable()) {
+        g_stopWriter.store(true, std::memory_order_release);
+        g_writer.join();
+    }
+    if (g_logFile.is_open()) {
+        g_logFile.close();
+    }
+    FreeConsole();
+}
+
+Logger::Record* Logger::BeginRecord(Level level) {
+    size_t pos = g_ring.enqueuePos.load(std::memory_order_relaxed);
+    for (;;) {
+        Record& record = g_ring.records[pos % kCapacity];
+        size_t sequence = record.sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+        if (diff == 0) {
+            if (g_ring.enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                record.level = level;
+                record.time = std::time(nullptr);
+                return &record;
+            }
+            // pos was reloaded by the failed exchange
+        } else if (diff < 0) {
+            // The writer hasn't freed this slot from the previous lap
+            g_ring.dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        } else {
+            pos = g_ring.enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+std::ostream& Logger::GetStream(Record& record) {
+    t_stream.buffer.Reset(record.text, kRecordText);
+    t_stream.stream.clear();
+    t_stream.stream.flags(t_stream.defaultFlags);
+    t_stream.stream.precision(6);
+    t_stream.stream.fill(' ');
+    return t_stream.stream;
+}
+
+void Logger::CommitRecord(Record& record) {
+    record.length = (uint32_t)t_stream.buffer.Length();
+    // Claimed positions map 1:1 to slots, the published sequence is the claimed position + 1
+    size_t pos = record.sequence.load(std::memory_order_relaxed);
+    record.sequence.store(pos + 1, std::memory_order_release);
+}
+
+void Logger::WriterThread() {
+    std::string batch;
+    batch.reserve(64 * 1024);
+
+    for (;;) {
+        // Checked before draining so the records of the last lap are still written
+        bool stop = g_stopWriter.load(std::memory_order_acquire);
+
+        batch.clear();
+        if (Drain(batch)) WriteBatch(batch);
+        else if (stop) break;
+        else std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+}
@@ -1,71 +1,79 @@
 #pragma once
-#include <iostream>
-#include <fstream>
-#include <sstream>
-#include <string>
-#include <mutex>
+#include <atomic>
+#include <cstdint>
 #include <ctime>
-#include <iomanip>
+#include <ostream>
 
-// Simple macro for logging
-#define LOG_INFO(...) Logger::Log(Logger::Level::Info, __VA_ARGS__)
-#define LOG_WARNING(...) Logger::Log(Logger::Level::Warning, __VA_ARGS__)
-#define LOG_ERROR(...) Logger::Log(Logger::Level::Error, __VA_ARGS__)
+// Messages below this level are compiled out: 0 Debug, 1 Info, 2 Warning, 3 Error.
+// Debug builds keep everything, release builds start at Info unless the build overrides it.
+#ifndef WIDECAPTURE_LOG_LEVEL
+#if defined(DEBUG) || defined(_DEBUG)
+#define WIDECAPTURE_LOG_LEVEL 0
+#else
+#define WIDECAPTURE_LOG_LEVEL 1
+#endif
+#endif
 
-class Logger {
-public:
-    enum class Level { Info, Warning, Error };
+#define WIDECAPTURE_LOG(level, ...) do { if constexpr ((int)(level) >= WIDECAPTURE_LOG_LEVEL) Logger::Log(level, __VA_ARGS__); } while (0)
 
-    static void Init() {
-        AllocConsole();
-        FILE* f;
-        freopen_s(&f, "CONOUT$", "w", stdout);
-        freopen_s(&f, "CONOUT$", "w", stderr);
-        
-        m_logFile.open("WideCapture.log", std::ios::out | std::ios::trunc);
-    }
+#define LOG_DEBUG(...) WIDECAPTURE_LOG(Logger::Level::Debug, __VA_ARGS__)
+#define LOG_INFO(...) WIDECAPTURE_LOG(Logger::Level::Info, __VA_ARGS__)
+#define LOG_WARNING(...) WIDECAPTURE_LOG(Logger::Level::Warning, __VA_ARGS__)
+#define LOG_ERROR(...) WIDECAPTURE_LOG(Logger::Level::Error, __VA_ARGS__)
 
-    static void Shutdown() {
-        if (m_logFile.is_open()) {
-            m_logFile.close();
-        }
-        FreeConsole();
-    }
+// Rate-limited variants, counted per call site. LEVEL is DEBUG, INFO, WARNING or ERROR.
+#define LOG_ONCE(LEVEL, ...) do { \
+        static std::atomic<bool> logged_{ false }; \
+        if (!logged_.exchange(true, std::memory_order_relaxed)) LOG_##LEVEL(__VA_ARGS__); \
+    } while (0)
+#define LOG_FIRST_N(LEVEL, n, ...) do { \
+        static std::atomic<uint32_t> count_{ 0 }; \
+        if (count_.load(std::memory_order_relaxed) < (n) && count_.fetch_add(1, std::memory_order_relaxed) < (n)) LOG_##LEVEL(__VA_ARGS__); \
+    } while (0)
+#define LOG_EVERY_N(LEVEL, n, ...) do { \
+        static std::atomic<uint32_t> count_{ 0 }; \
+        if (count_.fetch_add(1, std::memory_order_relaxed) % (n) == 0) LOG_##LEVEL(__VA_ARGS__); \
+    } while (0)
 
-    template<typename... Args>
-    static void Log(Level level, Args&&... args) {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        
-        std::stringstream ss;
-        (ss << ... << args);
-        
-        std::string prefix;
-        switch (level) {
-            case Level::Info: prefix = "[INFO] "; break;
-            case Level::Warning: prefix = "[WARN] "; break;
-            case Level::Error: prefix = "[ERR] "; break;
-        }
+// Asynchronous logger. Log formats the message in place into a fixed-size record of a bounded
+// lock-free ring (any number of producer threads), a background thread writes the records to the
+// console and WideCapture.log and flushes once per batch. A full ring drops the message instead of
+// blocking the caller; the writer reports how many were lost. Messages longer than a record are cut.
+class Logger {
+public:
+    enum class Level { Debug, Info, Warning, Error };
 
-        std::time_t t = std::time(nullptr);
-        std::tm tm;
-        localtime_s(&tm, &t);
+    static constexpr size_t kRecordText = 480;
 
-        std::stringstream timestamp;
-        timestamp << std::put_time(&tm, "%H:%M:%S");
+    struct Record {
+        std::atomic<size_t> sequence{ 0 }; // Ring bookkeeping, see Logger.cpp
+        Level level = Level::Info;
+        uint32_t length = 0;
+        std::time_t time = 0;
+        char text[kRecordText];
+    };
 
-        std::string msg = "[" + timestamp.str() + "] " + prefix + ss.str();
+    // Opens the console and the log file and starts the writer thread
+    static void Init();
+    // Writes what is still queued, then stops the writer thread
+    static void Shutdown();
 
-        // Console
-        std::cout << msg << std::endl;
+    template<typename... Args>
+    static void Log(Level level, Args&&... args) {
+        Record* record = BeginRecord(level);
+        if (!record) return;
 
-        // File
-        if (m_logFile.is_open()) {
-            m_logFile << msg << std::endl;
-            m_logFile.flush();
-        }
+        std::ostream& stream = GetStream(*record);
+        (stream << ... << args);
+        CommitRecord(*record);
     }
 
 private:
-    static inline std::mutex m_mutex;
-    static inline std::ofstream m_logFile;
+    // nullptr if the ring is full
+    static Record* BeginRecord(Level level);
+    // Stream writing into the record's text, per thread and reset for every record
+    static std::ostream& GetStream(Record& record);
+    static void CommitRecord(Record& record);
+
+    static void WriterThread();
 };
@@ -0,0 +1,145 @@
+#include "pch.h"
+#include "Profiler.h"
+#include "Logger.h"
+#include <reshade.hpp>
+#include <iterator>
+
+namespace {
+    const char* kCpuStageNames[] = { "ProcessDraw", "ScanBuffer", "MapTracking", "StateBlock", "EncoderSubmit" };
+    const char* kGpuStageNames[] = { "FaceDraws", "Projection", "NV12Convert", "EncoderCopy" };
+    const char* kCounterNames[] = { "InterceptedDraws", "FaceDraws", "ScannedBuffers", "SecondaryViewDraws" };
+
+    struct FrameSample {
+        double frameMs = 0.0;
+        double cpuMs[(uint32_t)Profiler::CpuStage::Count] = {};
+        double gpuMs[(uint32_t)Profiler::GpuStage::Count] = {};
+        uint64_t counters[(uint32_t)Profiler::Counter::Count] = {};
+        uint64_t droppedFrames = 0;
+        uint64_t queuedFrames = 0;
+    };
+
+    // Render thread only, the overlay runs inside present on the same thread
+    struct FrameState {
+        double ticksToMs = 0.0;
+        LARGE_INTEGER lastPresent = {};
+        uint64_t frameIndex = 0;
+        FrameSample current;  // GPU and encoder values, filled as they arrive
+        FrameSample smoothed; // What the overlay shows
+        std::ofstream csv;
+    };
+    FrameState g_frame;
+
+    void WriteCsvHeader(std::ofstream& csv) {
+        csv << "frame,frame_ms";
+        for (const char* name : kCpuStageNames) csv << ",cpu_" << name << "_ms";
+        for (const char* name : kGpuStageNames) csv << ",gpu_" << name << "_ms";
+        for (const char* name : kCounterNames) csv << "," << name;
+        csv << ",EncoderDropped,EncoderQueued\n";
+    }
+
+    void WriteCsvRow(std::ofstream& csv, uint64_t frame, const FrameSample& sample) {
+        csv << frame << "," << sample.frameMs;
+        for (double ms : sample.cpuMs) csv << "," << ms;
+        for (double ms : sample.gpuMs) csv << "," << ms;
+        for (uint64_t count : sample.counters) csv << "," << count;
+        csv << "," << sample.droppedFrames << "," << sample.queuedFrames << "\n";
+    }
+}
+
+static_assert(std::size(kCpuStageNames) == (size_t)Profiler::CpuStage::Count, "CPU stage names out of date");
+static_assert(std::size(kGpuStageNames) == (size_t)Profiler::GpuStage::Count, "GPU stage names out of date");
+static_assert(std::size(kCounterNames) == (size_t)Profiler::Counter::Count, "Counter names out of date");
+
+void Profiler::Enable(bool writeCsv) {
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    g_frame.ticksToMs = 1000.0 / (double)frequency.QuadPart;
+    g_frame.lastPresent = {};
+    g_frame.frameIndex = 0;
+
+    if (writeCsv) {
+        g_frame.csv.open("WideCapture.profile.csv", std::ios::out | std::ios::trunc);
+        if (g_frame.csv.is_open()) WriteCsvHeader(g_frame.csv);
+        else LOG_WARNING("Failed to open WideCapture.profile.csv");
+    }
+
+    s_enabled.store(true, std::memory_order_relaxed);
+    LOG_INFO("Profiling enabled", writeCsv ? ", writing WideCapture.profile.csv" : "");
+}
+
+void Profiler::Shutdown() {
+    s_enabled.store(false, std::memory_order_relaxed);
+    if (g_frame.csv.is_open()) g_frame.csv.close();
+}
+
+void Profiler::SetGpuTime(GpuStage stage, double milliseconds) {
+    g_frame.current.gpuMs[(uint32_t)stage] = milliseconds;
+}
+
+void Profiler::SetEncoderStats(uint64_t droppedFrames, uint64_t queuedFrames) {
+    g_frame.current.droppedFrames = droppedFrames;
+    g_frame.current.queuedFrames = queuedFrames;
+}
+
+void Profiler::EndFrame() {
+    if (!IsEnabled()) return;
+
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    FrameSample& sample = g_frame.current;
+    sample.frameMs = g_frame.lastPresent.QuadPart ? (double)(now.QuadPart - g_frame.lastPresent.QuadPart) * g_frame.ticksToMs : 0.0;
+    g_frame.lastPresent = now;
+
+    for (uint32_t i = 0; i < kCpuStages; ++i) {
+        sample.cpuMs[i] = (double)s_cpuTicks[i].exchange(0, std::memory_order_relaxed) * g_frame.ticksToMs;
+    }
+    for (uint32_t i = 0; i < kCounters; ++i) {
+        sample.counters[i] = s_counters[i].exchange(0, std::memory_order_relaxed);
+    }
+
+    if (g_frame.csv.is_open()) WriteCsvRow(g_frame.csv, g_frame.frameIndex, sample);
+
+    // Times are smoothed for reading, counts show the last frame
+    FrameSample& shown = g_frame.smoothed;
+    const double blend = g_frame.frameIndex == 0 ? 1.0 : 0.1;
+    shown.frameMs += (sample.frameMs - shown.frameMs) * blend;
+    for (uint32_t i = 0; i < kCpuStages; ++i) shown.cpuMs[i] += (sample.cpuMs[i] - shown.cpuMs[i]) * blend;
+    for (uint32_t i = 0; i < kGpuStages; ++i) shown.gpuMs[i] += (sample.gpuMs[i] - shown.gpuMs[i]) * blend;
+    for (uint32_t i = 0; i < kCounters; ++i) shown.counters[i] = sample.counters[i];
+    shown.droppedFrames = sample.droppedFrames;
+    shown.queuedFrames = sample.queuedFrames;
+
+    g_frame.frameIndex++;
+}
+
+void Profiler::DrawOverlay() {
+#ifdef WIDECAPTURE_OVERLAY
+    if (!IsEnabled()) {
+        ImGui::TextUnformatted("Set Profiling=1 in the [WideCapture] section to enable.");
+        return;
+    }
+
+    const FrameSample& shown = g_frame.smoothed;
+    ImGui::Text("Frame %.2f ms", shown.frameMs);
+
+    ImGui::SeparatorText("GPU");
+    double gpuTotal = 0.0;
+    for (uint32_t i = 0; i < kGpuStages; ++i) {
+        ImGui::Text("%-16s %7.3f ms", kGpuStageNames[i], shown.gpuMs[i]);
+        gpuTotal += shown.gpuMs[i];
+    }
+    ImGui::Text("%-16s %7.3f ms", "Total", gpuTotal);
+
+    ImGui::SeparatorText("CPU");
+    for (uint32_t i = 0; i < kCpuStages; ++i) {
+        ImGui::Text("%-16s %7.3f ms", kCpuStageNames[i], shown.cpuMs[i]);
+    }
+
+    ImGui::SeparatorText("Per frame");
+    for (uint32_t i = 0; i < kCounters; ++i) {
+        ImGui::Text("%-16s %7llu", kCounterNames[i], (unsigned long long)shown.counters[i]);
+    }
+    ImGui::Text("%-16s %7llu", "EncoderQueued", (unsigned long long)shown.queuedFrames);
+    ImGui::Text("%-16s %7llu", "EncoderDropped", (unsigned long long)shown.droppedFrames);
+#endif
+}
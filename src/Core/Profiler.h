@@ -0,0 +1,87 @@
+#pragma once
+#include <windows.h>
+#include <atomic>
+#include <cstdint>
+
+// Where the capture cost goes (Config::Profiling). CPU stages are timed with QueryPerformanceCounter
+// from any thread; GPU stages are measured by Graphics::CubemapManager with timestamp queries and
+// reported here a few frames late. Once per present EndFrame turns the totals into a frame sample,
+// shown in the ReShade overlay and, with Config::ProfilingCsv, appended to WideCapture.profile.csv.
+// Until Enable() every call is a relaxed load and a branch.
+class Profiler {
+public:
+    // Inclusive: ProcessDraw contains the StateBlock time of its face loop
+    enum class CpuStage : uint32_t {
+        ProcessDraw,   // Intercepted draws: culling, face setup and replay submission
+        ScanBuffer,    // CameraController::ScanBufferImpl
+        MapTracking,   // Constant buffer map/unmap bookkeeping
+        StateBlock,    // State capture and restore
+        EncoderSubmit, // Surface acquire/submit, including queue waits
+        Count
+    };
+
+    enum class GpuStage : uint32_t {
+        FaceDraws,   // Replayed draws, immediate context only
+        Projection,  // Projection kernel (the fused kernel includes the NV12 conversion)
+        NV12Convert, // Y and UV raster passes of the separate path
+        EncoderCopy, // Surface submission, the per-tile copies with EncoderTiles
+        Count
+    };
+
+    enum class Counter : uint32_t {
+        InterceptedDraws, // Draws with the camera buffer bound
+        FaceDraws,        // Draws issued into the faces (a layered draw counts once per face)
+        ScannedBuffers,
+        SecondaryViewDraws, // Camera buffer draws of shadow or reflection views, not replicated
+        Count
+    };
+
+    static void Enable(bool writeCsv);
+    static void Shutdown();
+    static bool IsEnabled() { return s_enabled.load(std::memory_order_relaxed); }
+
+    static void AddCpuTicks(CpuStage stage, int64_t ticks) {
+        s_cpuTicks[(uint32_t)stage].fetch_add(ticks, std::memory_order_relaxed);
+    }
+    static void Increment(Counter counter, uint64_t amount = 1) {
+        if (IsEnabled()) s_counters[(uint32_t)counter].fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    // Render thread: latest resolved GPU time of a stage and the encoder queue state
+    static void SetGpuTime(GpuStage stage, double milliseconds);
+    static void SetEncoderStats(uint64_t droppedFrames, uint64_t queuedFrames);
+
+    // Render thread, once per present. Closes the CPU totals into a frame sample.
+    static void EndFrame();
+
+    // ReShade overlay callback body, only built with WIDECAPTURE_OVERLAY
+    static void DrawOverlay();
+
+    class CpuScope {
+    public:
+        explicit CpuScope(CpuStage stage) : m_stage(stage) {
+            if (IsEnabled()) QueryPerformanceCounter(&m_start);
+        }
+        ~CpuScope() {
+            if (m_start.QuadPart == 0) return;
+            LARGE_INTEGER end;
+            QueryPerformanceCounter(&end);
+            AddCpuTicks(m_stage, end.QuadPart - m_start.QuadPart);
+        }
+        CpuScope(const CpuScope&) = delete;
+        CpuScope& operator=(const CpuScope&) = delete;
+
+    private:
+        CpuStage m_stage;
+        LARGE_INTEGER m_start = {};
+    };
+
+private:
+    static constexpr uint32_t kCpuStages = (uint32_t)CpuStage::Count;
+    static constexpr uint32_t kGpuStages = (uint32_t)GpuStage::Count;
+    static constexpr uint32_t kCounters = (uint32_t)Counter::Count;
+
+    static inline std::atomic<bool> s_enabled{ false };
+    static inline std::atomic<int64_t> s_cpuTicks[kCpuStages] = {};
+    static inline std::atomic<uint64_t> s_counters[kCounters] = {};
+};
@@ -0,0 +1,53 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
+
+// Bounded lock-free ring with a single producer and a single consumer.
+// TryPop is also safe to call from the producer, so a full ring can give up its oldest entry
+// (drop-oldest backpressure) without a lock. That is why slots are atomics and the read
+// index is claimed with compare-exchange instead of a plain store.
+template <typename T, size_t Capacity>
+class SpscRing {
+    static_assert(std::is_trivially_copyable_v<T>, "SpscRing slots must be trivially copyable");
+    static_assert(Capacity > 0, "SpscRing needs at least one slot");
+
+public:
+    // Producer only
+    bool TryPush(const T& item, size_t limit = Capacity) {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head - m_tail.load(std::memory_order_acquire) >= (limit < Capacity ? limit : Capacity)) return false;
+
+        m_slots[head % Capacity].store(item, std::memory_order_relaxed);
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer, or the producer when reclaiming the oldest entry
+    bool TryPop(T& item) {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        for (;;) {
+            if (tail == m_head.load(std::memory_order_acquire)) return false;
+
+            T candidate = m_slots[tail % Capacity].load(std::memory_order_relaxed);
+            if (m_tail.compare_exchange_weak(tail, tail + 1, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+                item = candidate;
+                return true;
+            }
+            // Lost the slot to the other side, tail now holds the current value
+        }
+    }
+
+    size_t Size() const {
+        // Tail first, head can only have moved further since
+        size_t tail = m_tail.load(std::memory_order_acquire);
+        return m_head.load(std::memory_order_acquire) - tail;
+    }
+
+    bool Empty() const { return Size() == 0; }
+
+private:
+    std::atomic<T> m_slots[Capacity] = {};
+    alignas(64) std::atomic<size_t> m_head{ 0 };
+    alignas(64) std::atomic<size_t> m_tail{ 0 };
+};
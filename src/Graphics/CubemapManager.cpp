@@ -1,16 +1,35 @@
 #include "pch.h"
 #include "CubemapManager.h"
-#include "../Compute/ShaderCompiler.h"
+#include "../Compute/Projection.h"
 #include "../Core/Logger.h"
+#include "../Core/Config.h"
+#include "../Video/EncoderFactory.h"
 #include <d3dcompiler.h>
 #include <algorithm>
+#include <bitset>
+#include <cmath>
 #include "StateBlock.h"
 
 namespace Graphics {
 
-    CubemapManager::CubemapManager(reshade::api::device* device) : m_device(device) {
+    namespace {
+        // Tells command list state left behind by an earlier manager apart from the current one's
+        std::atomic<uint32_t> g_managerInstances = 0;
+
+        // Per-thread memo of the last command list looked up, so draws don't query the private data
+        // each time. Destroying any command list invalidates every memo.
+        std::atomic<uint64_t> g_commandListsDestroyed = 0;
+        struct CommandListMemo {
+            reshade::api::command_list* cmdList = nullptr;
+            void* state = nullptr;
+            uint64_t destroyed = 0;
+        };
+        thread_local CommandListMemo t_commandListMemo;
+    }
+
+    CubemapManager::CubemapManager(reshade::api::device* device, LayeredShimCache* layeredShims, FaceCuller* faceCuller)
+        : m_device(device), m_instanceId(++g_managerInstances), m_layeredShims(layeredShims), m_faceCuller(faceCuller) {
         m_cameraController = std::make_unique<Camera::CameraController>();
-        m_encoder = std::make_unique<Video::FFmpegBackend>();
     }
 
     CubemapManager::~CubemapManager() {
@@ -18,251 +37,587 @@ namespace Graphics {
     }
 
     void CubemapManager::DestroyResources() {
+        DestroyFaceResources();
+        DestroyOutputResources();
+        // Only called once nothing records anymore
+        ReleaseRetiredFaceDepths(true);
+    }
+
+    void CubemapManager::DestroyFaceResources() {
         if (m_device) {
             for (int i = 0; i < 6; ++i) {
                 if (m_faceRtvs[i].handle) m_device->destroy_resource_view(m_faceRtvs[i]);
-                if (m_faceSrvs[i].handle) m_device->destroy_resource_view(m_faceSrvs[i]);
-                if (m_faceTextures[i].handle) m_device->destroy_resource(m_faceTextures[i]);
+                m_faceRtvs[i] = {};
             }
+            if (m_cubeArrayRtv.handle) m_device->destroy_resource_view(m_cubeArrayRtv);
+            m_cubeArrayRtv = {};
+            RetireFaceDepths();
             if (m_cubeSrv.handle) m_device->destroy_resource_view(m_cubeSrv);
+            if (m_cubeArraySrv.handle) m_device->destroy_resource_view(m_cubeArraySrv);
             if (m_cubeTexture.handle) m_device->destroy_resource(m_cubeTexture);
-            if (m_equirectUAV.handle) m_device->destroy_resource_view(m_equirectUAV);
-            if (m_equirectSRV.handle) m_device->destroy_resource_view(m_equirectSRV);
-            if (m_equirectTexture.handle) m_device->destroy_resource(m_equirectTexture);
         }
+        m_cubeSrv = {};
+        m_cubeArraySrv = {};
+        m_cubeTexture = {};
+
+        // New slices start out empty, nothing can be reused
+        m_refreshFaces = FaceCuller::AllFaces;
+        m_staleFaces = FaceCuller::AllFaces;
+    }
+
+    void CubemapManager::DestroyOutputResources() {
+        m_faceRectCB.Reset();
+        m_gpuTimer.Reset();
+        m_gpuTimingEnabled = false;
+        for (GpuTimer& timer : m_stageTimers) timer.Reset();
+        m_stageTimingEnabled = false;
+        m_captureGpuMs = 0.0;
+        m_faceScale = 1.0f;
 
-        m_nv12Y_RTV.Reset();
-        m_nv12UV_RTV.Reset();
-        m_equirectNV12.Reset();
-        m_projectionShader.Reset();
-        m_convertVS.Reset();
-        m_convertPS_Y.Reset();
-        m_convertPS_UV.Reset();
-        m_linearSampler.Reset();
+        m_projector.Reset();
 
         if (m_encoder) m_encoder->Finish();
+        m_encoder.reset();
+        m_outputReady = false;
     }
 
     bool CubemapManager::InitResources(uint32_t width, uint32_t height) {
         if (width == 0 || height == 0) return false;
-        if (m_width == width && m_height == height && m_faceTextures[0].handle != 0) return true;
-        
-        DestroyResources();
+        if (m_width == width && m_height == height && m_cubeTexture.handle != 0 && m_outputReady) return true;
 
         m_width = width;
         m_height = height;
-        // Keep it square and aligned to 16 to avoid driver quirks with odd RenderTarget sizes
-        m_faceSize = std::min(width, height);
-        m_faceSize = (m_faceSize + 15) & ~15;
+        // Keep it square and aligned to 16 to avoid driver quirks with odd RenderTarget sizes.
+        // A configured face resolution overrides the back buffer derived one.
+        uint32_t faceSize = Config::FaceResolution ? std::clamp(Config::FaceResolution, 256u, 8192u) : std::min(width, height);
+        faceSize = (faceSize + 15) & ~15;
+
+        // A resize only reallocates the cube when the face size actually changes
+        if (faceSize != m_faceSize || m_cubeTexture.handle == 0) {
+            if (m_outputReady) LOG_INFO("Face size ", m_faceSize, " -> ", faceSize, ", output stays ", m_projector.GetWidth(), "x", m_projector.GetHeight());
+            DestroyFaceResources();
+            m_faceSize = faceSize;
+            if (!InitFaceResources()) return false;
+        }
 
-        // 1. Create Face Textures (R8G8B8A8 UNORM)
-        for (int i = 0; i < 6; ++i) {
-            if (!m_device->create_resource(
-                reshade::api::resource_desc(m_faceSize, m_faceSize, 1, 1, reshade::api::format::r8g8b8a8_unorm, 1, reshade::api::memory_heap::gpu_only, reshade::api::resource_usage::render_target | reshade::api::resource_usage::copy_source | reshade::api::resource_usage::shader_resource),
-                nullptr, reshade::api::resource_usage::shader_resource, &m_faceTextures[i]))
-            {
-                LOG_ERROR("Failed to create face texture ", i);
+        // The output and the encoder session outlive resizes. The projection samples the cube by
+        // direction, so a different face size just scales into the same output and file.
+        if (!m_outputReady) {
+            if (m_outputRetryDelay > 0) {
+                --m_outputRetryDelay;
                 return false;
             }
-
-            if (!m_device->create_resource_view(m_faceTextures[i], reshade::api::resource_usage::render_target,
-                reshade::api::resource_view_desc(reshade::api::resource_view_type::texture_2d, reshade::api::format::r8g8b8a8_unorm, 0, 1, 0, 1), &m_faceRtvs[i]))
-                return false;
-
-            if (!m_device->create_resource_view(m_faceTextures[i], reshade::api::resource_usage::shader_resource,
-                reshade::api::resource_view_desc(reshade::api::resource_view_type::texture_2d, reshade::api::format::r8g8b8a8_unorm, 0, 1, 0, 1), &m_faceSrvs[i]))
+            if (!InitOutputResources()) {
+                // Nothing half-initialized is kept, the next attempt starts from scratch
+                DestroyOutputResources();
+                m_outputRetryDelay = kOutputRetryPresents;
+                LOG_WARNING("Output setup failed, retrying in ", kOutputRetryPresents, " frames");
                 return false;
+            }
+            m_outputReady = true;
         }
+        return true;
+    }
 
-        // 2. Create Cube Texture Array (for Compute Shader)
+    bool CubemapManager::InitFaceResources() {
+        UpdateFaceRects();
+        m_faceRectsDirty = true; // The half-texel clamps depend on the face size even if the rects don't change
+
+        // 1. Create Cube Texture Array (R8G8B8A8 UNORM). Faces are rendered straight into its slices.
         if (!m_device->create_resource(
-            reshade::api::resource_desc(reshade::api::resource_type::texture_2d, m_faceSize, m_faceSize, 6, 1, reshade::api::format::r8g8b8a8_unorm, 1, reshade::api::memory_heap::gpu_only, reshade::api::resource_usage::copy_dest | reshade::api::resource_usage::shader_resource),
+            reshade::api::resource_desc(reshade::api::resource_type::texture_2d, m_faceSize, m_faceSize, 6, 1, reshade::api::format::r8g8b8a8_unorm, 1, reshade::api::memory_heap::gpu_only, reshade::api::resource_usage::render_target | reshade::api::resource_usage::shader_resource),
             nullptr, reshade::api::resource_usage::shader_resource, &m_cubeTexture))
+        {
+            LOG_ERROR("Failed to create cube texture");
             return false;
+        }
+
+        // 2. One RTV per slice for the per-face path, plus the cube SRV for the Compute Shader
+        for (int i = 0; i < 6; ++i) {
+            if (!m_device->create_resource_view(m_cubeTexture, reshade::api::resource_usage::render_target,
+                reshade::api::resource_view_desc(reshade::api::resource_view_type::texture_2d_array, reshade::api::format::r8g8b8a8_unorm, 0, 1, i, 1), &m_faceRtvs[i]))
+                return false;
+        }
 
         if (!m_device->create_resource_view(m_cubeTexture, reshade::api::resource_usage::shader_resource,
             reshade::api::resource_view_desc(reshade::api::resource_view_type::texture_cube, reshade::api::format::r8g8b8a8_unorm, 0, 1, 0, 6), &m_cubeSrv))
             return false;
 
-        // 3. Equirectangular Output
-        UINT eqW = m_faceSize * 4;
-        UINT eqH = eqW / 2;
-        // Align to 16
-        eqW = (eqW + 15) & ~15;
-        eqH = (eqH + 15) & ~15;
-
-        if (!m_device->create_resource(
-            reshade::api::resource_desc(eqW, eqH, 1, 1, reshade::api::format::r8g8b8a8_unorm, 1, reshade::api::memory_heap::gpu_only, reshade::api::resource_usage::unordered_access | reshade::api::resource_usage::shader_resource),
-            nullptr, reshade::api::resource_usage::unordered_access, &m_equirectTexture))
+        // Plain array view for sampling by face index (direction LUT, face sub-rects)
+        if (!m_device->create_resource_view(m_cubeTexture, reshade::api::resource_usage::shader_resource,
+            reshade::api::resource_view_desc(reshade::api::resource_view_type::texture_2d_array, reshade::api::format::r8g8b8a8_unorm, 0, 1, 0, 6), &m_cubeArraySrv))
             return false;
 
-        if (!m_device->create_resource_view(m_equirectTexture, reshade::api::resource_usage::unordered_access,
-            reshade::api::resource_view_desc(reshade::api::resource_view_type::texture_2d, reshade::api::format::r8g8b8a8_unorm, 0, 1, 0, 1), &m_equirectUAV))
-            return false;
+        // 2b. Layered targets: the GS shim writes all six slices at once
+        if (Config::SinglePassLayered) {
+            if (!m_device->create_resource_view(m_cubeTexture, reshade::api::resource_usage::render_target,
+                reshade::api::resource_view_desc(reshade::api::resource_view_type::texture_2d_array, reshade::api::format::r8g8b8a8_unorm, 0, 1, 0, 6), &m_cubeArrayRtv))
+                return false;
+        }
+        return true;
+    }
 
-        if (!m_device->create_resource_view(m_equirectTexture, reshade::api::resource_usage::shader_resource,
-            reshade::api::resource_view_desc(reshade::api::resource_view_type::texture_2d, reshade::api::format::r8g8b8a8_unorm, 0, 1, 0, 1), &m_equirectSRV))
-            return false;
+    bool CubemapManager::InitOutputResources() {
+        // Leftovers of an attempt that failed halfway
+        DestroyOutputResources();
+
+        // 3. Projected output, its size depends on the layout and the face size it was created with
+        Compute::ProjectionType projection = Compute::ToProjectionType(Config::Projection);
+        Compute::OutputSize outputSize = Compute::GetOutputSize(projection, m_faceSize);
+        UINT eqW = outputSize.width;
+        UINT eqH = outputSize.height;
+        LOG_INFO("Output projection: ", Compute::GetProjectionName(projection), " ", eqW, "x", eqH);
 
         // 4. Native D3D11 Initialization for Shaders/FFmpeg
         ID3D11Device* d3d11Dev = (ID3D11Device*)m_device->get_native();
         if (!d3d11Dev) return false;
 
-        // Compile Projection Shader
-        if (FAILED(Compute::ShaderCompiler::CompileComputeShader(d3d11Dev, L"shaders/ProjectionShader.hlsl", "main", m_projectionShader.GetAddressOf()))) {
-             // Fallback try local
-             if (FAILED(Compute::ShaderCompiler::CompileComputeShader(d3d11Dev, L"ProjectionShader.hlsl", "main", m_projectionShader.GetAddressOf()))) {
-                 LOG_ERROR("Failed to compile ProjectionShader");
-                 // Continue anyway to allow build
-             }
+        if (UsesFaceSubRects()) {
+            D3D11_BUFFER_DESC cbDesc = {};
+            cbDesc.ByteWidth = 6 * 4 * sizeof(float);
+            cbDesc.Usage = D3D11_USAGE_DYNAMIC;
+            cbDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+            cbDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+            if (FAILED(d3d11Dev->CreateBuffer(&cbDesc, nullptr, m_faceRectCB.GetAddressOf()))) {
+                LOG_ERROR("Failed to create face rect constant buffer");
+                return false;
+            }
+            m_faceRectsDirty = true;
         }
 
-        // Compile RGB->NV12
-        ID3DBlob* vsBlob = nullptr;
-        ID3DBlob* psYBlob = nullptr;
-        ID3DBlob* psUVBlob = nullptr;
-        
-        if (FAILED(D3DCompileFromFile(L"RGBToNV12.hlsl", nullptr, nullptr, "VS", "vs_5_0", 0, 0, &vsBlob, nullptr))) {
-             if (FAILED(D3DCompileFromFile(L"src/Graphics/RGBToNV12.hlsl", nullptr, nullptr, "VS", "vs_5_0", 0, 0, &vsBlob, nullptr)))
-                LOG_ERROR("Failed RGBToNV12 VS");
+        if (Config::DynamicResolution) {
+            // Enough intervals for a typical frame's intercepted draws, the rest is extrapolated
+            m_gpuTimingEnabled = m_gpuTimer.Initialize(d3d11Dev, 512);
+            if (m_gpuTimingEnabled) LOG_INFO("Dynamic resolution: ", Config::GpuBudgetMs, " ms GPU budget");
+            else LOG_WARNING("GPU timing unavailable, dynamic resolution disabled");
         }
-        if (vsBlob) {
-            d3d11Dev->CreateVertexShader(vsBlob->GetBufferPointer(), vsBlob->GetBufferSize(), nullptr, m_convertVS.GetAddressOf());
-            vsBlob->Release();
+
+        if (Profiler::IsEnabled()) {
+            m_stageTimingEnabled = true;
+            for (uint32_t i = 0; i < (uint32_t)Profiler::GpuStage::Count; ++i) {
+                // Face draws are timed per intercepted draw, the other stages once or twice per frame
+                uint32_t intervals = i == (uint32_t)Profiler::GpuStage::FaceDraws ? 512 : 4;
+                m_stageTimingEnabled = m_stageTimingEnabled && m_stageTimers[i].Initialize(d3d11Dev, intervals);
+            }
+            if (!m_stageTimingEnabled) LOG_WARNING("GPU timing unavailable, profiling CPU stages only");
         }
 
-        if (FAILED(D3DCompileFromFile(L"RGBToNV12.hlsl", nullptr, nullptr, "PS_Y", "ps_5_0", 0, 0, &psYBlob, nullptr))) {
-             if (FAILED(D3DCompileFromFile(L"src/Graphics/RGBToNV12.hlsl", nullptr, nullptr, "PS_Y", "ps_5_0", 0, 0, &psYBlob, nullptr))) {}
+        // Init Encoder first, its surfaces decide which conversion path can write them
+        Video::EncoderSettings encoderSettings;
+        encoderSettings.width = (int)eqW;
+        encoderSettings.height = (int)eqH;
+        encoderSettings.fps = 60;
+        encoderSettings.bitRate = (int64_t)Config::EncoderBitrate * 1000000;
+        encoderSettings.gopSize = std::max(1, (int)(Config::EncoderKeyframeInterval * encoderSettings.fps));
+        encoderSettings.filename = "widecapture_reshade.mp4";
+        encoderSettings.queueDepth = Config::EncoderQueueDepth;
+        encoderSettings.dropOldest = Config::EncoderDropOldest;
+        encoderSettings.tiles = std::clamp(Config::EncoderTiles, 1u, 8u);
+        encoderSettings.tileRows = Config::EncoderTileRows;
+        encoderSettings.output.fragmented = Config::OutputFragmented;
+        encoderSettings.output.segmentSeconds = Config::OutputSegmentMinutes * 60;
+        m_encoder = Video::EncoderFactory::Create(d3d11Dev, encoderSettings, Config::EncoderCodec);
+        if (!m_encoder) return false;
+
+        OutputProjector::Settings projectorSettings;
+        projectorSettings.projection = projection;
+        projectorSettings.width = eqW;
+        projectorSettings.height = eqH;
+        projectorSettings.directionLut = Config::ProjectionLUT;
+        projectorSettings.faceSubRects = UsesFaceSubRects();
+        projectorSettings.surfaceBindFlags = m_encoder->GetSurfaceBindFlags();
+        return m_projector.Initialize(d3d11Dev, projectorSettings);
+    }
+
+    bool CubemapManager::UsesFaceSubRects() const {
+        if (Config::DynamicResolution) return true;
+        for (int i = 0; i < 6; ++i) {
+            if (GetFaceTierScale((Camera::CubeFace)i) < 1.0f) return true;
         }
-        if (psYBlob) {
-            d3d11Dev->CreatePixelShader(psYBlob->GetBufferPointer(), psYBlob->GetBufferSize(), nullptr, m_convertPS_Y.GetAddressOf());
-            psYBlob->Release();
+        return false;
+    }
+
+    float CubemapManager::GetFaceTierScale(Camera::CubeFace face) {
+        float scale = 1.0f;
+        switch (face) {
+            case Camera::CubeFace::Front: scale = Config::FaceScaleFront; break;
+            case Camera::CubeFace::Left:
+            case Camera::CubeFace::Right: scale = Config::FaceScaleSides; break;
+            case Camera::CubeFace::Back:  scale = Config::FaceScaleBack; break;
+            case Camera::CubeFace::Up:
+            case Camera::CubeFace::Down:  scale = Config::FaceScaleVertical; break;
         }
+        return std::clamp(scale, 0.25f, 1.0f);
+    }
 
-        if (FAILED(D3DCompileFromFile(L"RGBToNV12.hlsl", nullptr, nullptr, "PS_UV", "ps_5_0", 0, 0, &psUVBlob, nullptr))) {
-             if (FAILED(D3DCompileFromFile(L"src/Graphics/RGBToNV12.hlsl", nullptr, nullptr, "PS_UV", "ps_5_0", 0, 0, &psUVBlob, nullptr))) {}
+    void CubemapManager::UpdateFaceRects() {
+        for (int i = 0; i < 6; ++i) {
+            // Multiples of 8 keep the sub-rects friendly to tiled rasterizers and stop the size from flickering
+            float scale = m_faceScale * GetFaceTierScale((Camera::CubeFace)i);
+            LONG size = (LONG)((float)m_faceSize * scale) & ~7;
+            size = std::clamp(size, (LONG)16, (LONG)m_faceSize);
+
+            if (m_faceRects[i].right == size && m_faceRects[i].bottom == size) continue;
+            m_faceRects[i] = { 0, 0, size, size };
+            m_faceRectsDirty = true;
+            m_staleFaces |= 1u << i; // A reused image would no longer match its rect
         }
-        if (psUVBlob) {
-            d3d11Dev->CreatePixelShader(psUVBlob->GetBufferPointer(), psUVBlob->GetBufferSize(), nullptr, m_convertPS_UV.GetAddressOf());
-            psUVBlob->Release();
+    }
+
+    void CubemapManager::UploadFaceRects(ID3D11DeviceContext* ctx) {
+        if (!m_faceRectCB || !m_faceRectsDirty) return;
+
+        D3D11_MAPPED_SUBRESOURCE mapped;
+        if (FAILED(ctx->Map(m_faceRectCB.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped))) return;
+        float* faceUV = (float*)mapped.pData;
+        float texel = 1.0f / (float)m_faceSize;
+        for (int i = 0; i < 6; ++i) {
+            float extent = (float)m_faceRects[i].right * texel;
+            faceUV[i * 4 + 0] = extent;
+            faceUV[i * 4 + 1] = extent - 0.5f * texel; // Bilinear taps stay inside the rendered rect
+            faceUV[i * 4 + 2] = 0.5f * texel;
+            faceUV[i * 4 + 3] = 0.0f;
         }
+        ctx->Unmap(m_faceRectCB.Get(), 0);
+        m_faceRectsDirty = false;
+    }
 
-        D3D11_SAMPLER_DESC sampDesc = {};
-        sampDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
-        sampDesc.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
-        sampDesc.AddressV = D3D11_TEXTURE_ADDRESS_CLAMP;
-        sampDesc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
-        d3d11Dev->CreateSamplerState(&sampDesc, m_linearSampler.GetAddressOf());
+    void CubemapManager::ScheduleFaceRefresh() {
+        ++m_frameIndex;
+        uint32_t reuse = Config::TemporalReuseFaces & FaceCuller::AllFaces;
+        uint32_t interval = std::max(Config::TemporalReuseInterval, 1u);
 
-        // Create NV12 Resources
-        D3D11_TEXTURE2D_DESC nv12Desc = {};
-        nv12Desc.Width = eqW;
-        nv12Desc.Height = eqH;
-        nv12Desc.MipLevels = 1;
-        nv12Desc.ArraySize = 1;
-        nv12Desc.Format = DXGI_FORMAT_NV12;
-        nv12Desc.SampleDesc.Count = 1;
-        nv12Desc.Usage = D3D11_USAGE_DEFAULT;
-        nv12Desc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
+        Camera::CameraSnapshotPtr snapshot = m_cameraController->GetSnapshot();
+        const Camera::CameraSnapshot& snap = *snapshot;
+        float maxRotationCos = std::cos(Config::TemporalReuseMaxRotation * (DirectX::XM_PI / 180.0f));
 
-        if (FAILED(d3d11Dev->CreateTexture2D(&nv12Desc, nullptr, m_equirectNV12.GetAddressOf()))) return false;
+        uint32_t refresh = FaceCuller::AllFaces & ~reuse;
+        for (int i = 0; i < 6; ++i) {
+            uint32_t bit = 1u << i;
+            if (!(reuse & bit)) continue;
+
+            // Staggered so the reused faces don't all come due on the same frame
+            bool due = (m_staleFaces & bit) || !snap.valid || interval <= 1 || (m_frameIndex + i) % interval == 0;
+            if (!due) {
+                float moved = DirectX::XMVectorGetX(DirectX::XMVector3Length(DirectX::XMVectorSubtract(snap.eyePosition, m_faceRefreshEye[i])));
+                float turnedCos = DirectX::XMVectorGetX(DirectX::XMVector3Dot(snap.viewForward, m_faceRefreshForward[i]));
+                due = moved > Config::TemporalReuseMaxMove || turnedCos < maxRotationCos;
+            }
+            if (!due) continue;
 
-        D3D11_RENDER_TARGET_VIEW_DESC rtvDesc = {};
-        rtvDesc.ViewDimension = D3D11_RTV_DIMENSION_TEXTURE2D;
-        rtvDesc.Format = DXGI_FORMAT_R8_UNORM;
-        d3d11Dev->CreateRenderTargetView(m_equirectNV12.Get(), &rtvDesc, m_nv12Y_RTV.GetAddressOf());
+            refresh |= bit;
+            m_faceRefreshEye[i] = snap.eyePosition;
+            m_faceRefreshForward[i] = snap.viewForward;
+        }
 
-        rtvDesc.Format = DXGI_FORMAT_R8G8_UNORM;
-        d3d11Dev->CreateRenderTargetView(m_equirectNV12.Get(), &rtvDesc, m_nv12UV_RTV.GetAddressOf());
+        m_refreshFaces = refresh | m_staleFaces;
+        m_staleFaces = 0;
+    }
 
-        // Init Encoder
-        if (m_encoder && !m_encoder->Initialize(d3d11Dev, eqW, eqH, 60, "widecapture_reshade.mp4")) return false;
+    void CubemapManager::PublishFaceParams() {
+        uint32_t target = 1 - m_faceParamsIndex.load(std::memory_order_relaxed);
+        FaceParams& params = m_faceParams[target];
+        params.refreshFaces = m_refreshFaces;
+        std::copy(std::begin(m_faceRects), std::end(m_faceRects), params.rects);
+        m_faceParamsIndex.store(target, std::memory_order_release);
+    }
 
-        return true;
+    void CubemapManager::UpdateDynamicResolution(ID3D11DeviceContext* ctx) {
+        m_gpuTimer.EndFrame(ctx);
+
+        // Results arrive a few frames late, after a hitch several at once
+        bool resolved = false;
+        double ms;
+        while (m_gpuTimer.Resolve(ctx, ms)) {
+            m_captureGpuMs = m_captureGpuMs > 0.0 ? m_captureGpuMs * 0.8 + ms * 0.2 : ms;
+            resolved = true;
+        }
+
+        if (resolved) {
+            double budget = std::max((double)Config::GpuBudgetMs, 0.1);
+            float minScale = std::clamp(Config::DynamicResolutionMinScale, 0.25f, 1.0f);
+            float scale = m_faceScale;
+
+            if (m_captureGpuMs > budget * 1.05) {
+                // Face cost roughly follows the pixel count, step down by at most 10% per frame
+                scale *= std::max(0.9f, (float)std::sqrt(budget / m_captureGpuMs));
+            } else if (m_captureGpuMs < budget * 0.85) {
+                scale *= 1.02f;
+            }
+
+            m_faceScale = std::clamp(scale, minScale, 1.0f);
+            UpdateFaceRects();
+        }
+
+        m_gpuTimer.BeginFrame(ctx);
+    }
+
+    void CubemapManager::UpdateStageTimers(ID3D11DeviceContext* ctx) {
+        for (uint32_t i = 0; i < (uint32_t)Profiler::GpuStage::Count; ++i) {
+            GpuTimer& timer = m_stageTimers[i];
+            timer.EndFrame(ctx);
+            double ms;
+            while (timer.Resolve(ctx, ms)) {
+                Profiler::SetGpuTime((Profiler::GpuStage)i, ms);
+            }
+            timer.BeginFrame(ctx);
+        }
+        if (m_encoder) Profiler::SetEncoderStats(m_encoder->GetDroppedFrames(), m_encoder->GetQueuedFrames());
     }
 
     void CubemapManager::OnUpdateBuffer(reshade::api::device* /*device*/, reshade::api::resource resource, const void* data, uint64_t size) {
         if (m_cameraController) {
             m_cameraController->OnUpdateBuffer(resource, data, size);
         }
+        if (m_faceCuller && Config::FaceCulling) {
+            m_faceCuller->OnBufferData(resource, data, size);
+        }
     }
 
-    void CubemapManager::OnBindPipeline(reshade::api::command_list* /*cmd_list*/, reshade::api::pipeline_stage /*stages*/, reshade::api::pipeline /*pipeline*/) {
-        // Track pipeline if necessary
+    void CubemapManager::OnDestroyResource(reshade::api::resource resource) {
+        if (m_cameraController) {
+            m_cameraController->OnDestroyResource(resource);
+        }
     }
 
-    void CubemapManager::ProcessDraw(reshade::api::command_list* cmd_list, bool indexed, uint32_t count, uint32_t /*instance_count*/, uint32_t first, int32_t offset_or_vertex, uint32_t /*first_instance*/) {
-        if (!m_isRecording) return;
-        
-        reshade::api::resource cameraBuffer = m_cameraController->GetCameraBuffer();
-        if (cameraBuffer.handle == 0) return;
+    void CubemapManager::OnBindPipeline(reshade::api::command_list* cmd_list, reshade::api::pipeline_stage stages, reshade::api::pipeline pipeline) {
+        using reshade::api::pipeline_stage;
 
-        ID3D11DeviceContext* ctx = (ID3D11DeviceContext*)cmd_list->get_native();
-        if (!ctx) return;
+        CommandListState& list = GetCommandListState(cmd_list);
+        if ((stages & pipeline_stage::vertex_shader) == pipeline_stage::vertex_shader) {
+            list.currentVertexShader = pipeline.handle;
+        }
 
-        // Check if camera buffer is bound to VS slot 0, 1, or 2
-        ID3D11Buffer* nativeCamBuf = (ID3D11Buffer*)cameraBuffer.handle;
-        ID3D11Buffer* vsBuffers[3] = { nullptr };
-        ctx->VSGetConstantBuffers(0, 3, vsBuffers);
+        const pipeline_stage geometryStages[] = { pipeline_stage::hull_shader, pipeline_stage::domain_shader, pipeline_stage::geometry_shader };
+        for (pipeline_stage stage : geometryStages) {
+            if ((stages & stage) != stage) continue;
+            if (pipeline.handle) list.boundGeometryStages |= (uint32_t)stage;
+            else                 list.boundGeometryStages &= ~(uint32_t)stage;
+        }
+    }
+
+    void CubemapManager::OnPushDescriptors(reshade::api::command_list* cmd_list, reshade::api::shader_stage stages, reshade::api::pipeline_layout /*layout*/, uint32_t /*param_index*/, const reshade::api::descriptor_table_update& update) {
+        using reshade::api::shader_stage;
+
+        // On D3D11 every VSSetConstantBuffers arrives here as a push of buffer ranges starting at the first slot
+        if ((stages & shader_stage::vertex) != shader_stage::vertex) return;
+        if (update.type != reshade::api::descriptor_type::constant_buffer || !update.descriptors) return;
 
-        int slot = -1;
-        for(int i=0; i<3; ++i) {
-            if (vsBuffers[i] == nativeCamBuf) {
-                slot = i;
+        CommandListState& list = GetCommandListState(cmd_list);
+        const auto* ranges = (const reshade::api::buffer_range*)update.descriptors;
+        for (uint32_t i = 0; i < update.count; ++i) {
+            uint32_t slot = update.binding + i;
+            if (slot >= D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT) break;
+            list.vsConstantBuffers[slot] = ranges[i].buffer.handle;
+        }
+
+        UpdateCameraSlot(list, m_cameraController->GetCameraBuffer().handle);
+    }
+
+    void CubemapManager::UpdateCameraSlot(CommandListState& list, uint64_t cameraHandle) {
+        list.trackedCameraBuffer = cameraHandle;
+        list.cameraSlot = -1;
+        if (cameraHandle != 0) {
+            for (int i = 0; i < D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT; ++i) {
+                if (list.vsConstantBuffers[i] == cameraHandle) {
+                    list.cameraSlot = i;
+                    break;
+                }
             }
-            if (vsBuffers[i]) vsBuffers[i]->Release();
-            if (slot != -1) break;
         }
+        list.isCameraBufferBound = list.cameraSlot >= 0;
+    }
 
-        if (slot == -1) return;
+    const Camera::CameraSnapshot& CubemapManager::GetListSnapshot(CommandListState& list) {
+        // Only a new write or publish swaps the reference, draws in between just compare pointers
+        if (const Camera::CameraSnapshotPtr* written = m_cameraController->GetThreadSnapshot()) {
+            if (written->get() != list.snapshot.get()) list.snapshot = *written;
+        } else if (!list.snapshot || list.snapshot->generation != m_cameraController->GetDataGeneration()) {
+            list.snapshot = m_cameraController->GetSnapshot();
+        }
+        return *list.snapshot;
+    }
 
-        // Save State
-        StateBlock state(ctx);
+    CubemapManager::CommandListState& CubemapManager::GetCommandListState(reshade::api::command_list* cmd_list) {
+        CommandListMemo& memo = t_commandListMemo;
+        uint64_t destroyed = g_commandListsDestroyed.load(std::memory_order_acquire);
+        CommandListState* state = (memo.cmdList == cmd_list && memo.destroyed == destroyed) ? (CommandListState*)memo.state : nullptr;
+
+        if (!state) {
+            state = cmd_list->get_private_data<CommandListState>();
+            if (!state) {
+                state = cmd_list->create_private_data<CommandListState>();
+                ID3D11DeviceContext* ctx = (ID3D11DeviceContext*)cmd_list->get_native();
+                state->deferred = ctx && ctx->GetType() == D3D11_DEVICE_CONTEXT_DEFERRED;
+                state->owner = m_instanceId;
+            }
+            memo = { cmd_list, state, destroyed };
+        }
 
-        // Loop 6 Faces
-        std::vector<uint8_t> modData;
+        // Left behind by an earlier manager: the bindings still hold, its buffers and generations don't
+        if (state->owner != m_instanceId) {
+            state->owner = m_instanceId;
+            state->faceCBPool.clear();
+            state->layeredCB.Reset();
+            state->layeredCBGeneration = 0;
+            state->layeredCBFaceMask = 0;
+        }
+        return *state;
+    }
 
-        // Create a temporary buffer for injection if not cached.
-        // For performance in a real scenario, we should have a pool.
-        // Here we create one per draw call which is slow but correct for logic.
-        D3D11_BUFFER_DESC desc = {};
-        nativeCamBuf->GetDesc(&desc);
-        desc.Usage = D3D11_USAGE_DYNAMIC;
-        desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-        desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+    void CubemapManager::CommandListState::ClearBindings() {
+        std::fill(std::begin(vsConstantBuffers), std::end(vsConstantBuffers), 0);
+        trackedCameraBuffer = 0;
+        cameraSlot = -1;
+        isCameraBufferBound = false;
+        currentVertexShader = 0;
+        boundGeometryStages = 0;
+    }
 
-        ComPtr<ID3D11Buffer> tempCB;
-        ComPtr<ID3D11Device> device;
-        ctx->GetDevice(&device);
-        if (FAILED(device->CreateBuffer(&desc, nullptr, tempCB.GetAddressOf()))) return;
+    void CubemapManager::CommandListState::SyncBindings(ID3D11DeviceContext* ctx) {
+        using reshade::api::pipeline_stage;
 
-        // Get Current Depth View to reuse (assuming face render target matches size)
-        ComPtr<ID3D11DepthStencilView> currentDSV;
-        ctx->OMGetRenderTargets(0, nullptr, currentDSV.GetAddressOf());
+        // ReShade's buffer and pipeline handles are the native interface pointers
+        ID3D11Buffer* buffers[D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT] = {};
+        ctx->VSGetConstantBuffers(0, D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT, buffers);
+        for (UINT i = 0; i < D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT; ++i) {
+            vsConstantBuffers[i] = (uint64_t)(uintptr_t)buffers[i];
+            if (buffers[i]) buffers[i]->Release();
+        }
+        trackedCameraBuffer = 0;
+        cameraSlot = -1;
+        isCameraBufferBound = false;
+
+        Microsoft::WRL::ComPtr<ID3D11VertexShader> vs;
+        Microsoft::WRL::ComPtr<ID3D11HullShader> hs;
+        Microsoft::WRL::ComPtr<ID3D11DomainShader> ds;
+        Microsoft::WRL::ComPtr<ID3D11GeometryShader> gs;
+        ctx->VSGetShader(&vs, nullptr, nullptr);
+        ctx->HSGetShader(&hs, nullptr, nullptr);
+        ctx->DSGetShader(&ds, nullptr, nullptr);
+        ctx->GSGetShader(&gs, nullptr, nullptr);
+        currentVertexShader = (uint64_t)(uintptr_t)vs.Get();
+        boundGeometryStages = 0;
+        if (hs) boundGeometryStages |= (uint32_t)pipeline_stage::hull_shader;
+        if (ds) boundGeometryStages |= (uint32_t)pipeline_stage::domain_shader;
+        if (gs) boundGeometryStages |= (uint32_t)pipeline_stage::geometry_shader;
+    }
 
-        for (int i = 0; i < 6; ++i) {
-            if (!m_cameraController->GetModifiedBufferData((Camera::CubeFace)i, modData)) continue;
+    void CubemapManager::CommandListState::EndRecording() {
+        for (auto& entry : faceCBPool) entry.second.generation = 0;
+        layeredCBGeneration = 0;
+    }
 
-            // Update Temp Buffer
-            D3D11_MAPPED_SUBRESOURCE mapped;
-            if (SUCCEEDED(ctx->Map(tempCB.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped))) {
-                memcpy(mapped.pData, modData.data(), std::min((size_t)desc.ByteWidth, modData.size()));
-                ctx->Unmap(tempCB.Get(), 0);
+    void CubemapManager::OnResetCommandList(reshade::api::command_list* cmd_list) {
+        CommandListState* state = cmd_list->get_private_data<CommandListState>();
+        if (state) state->ClearBindings();
+    }
+
+    void CubemapManager::OnExecuteSecondaryCommandList(reshade::api::command_list* cmd_list, reshade::api::command_list* secondary_cmd_list) {
+        // One argument is a context (the deferred one that finished recording, or the immediate one that
+        // executed), the other an ID3D11CommandList, which never gets any state. Either kind of context may
+        // have been reset to defaults, so the bindings are queried once here instead of assumed.
+        for (reshade::api::command_list* list : { cmd_list, secondary_cmd_list }) {
+            if (!list) continue;
+            CommandListState* state = list->get_private_data<CommandListState>();
+            ID3D11DeviceContext* ctx = (ID3D11DeviceContext*)list->get_native();
+            if (!state || !ctx) continue;
+
+            if (state->deferred) state->EndRecording();
+            state->SyncBindings(ctx);
+            UpdateCameraSlot(*state, m_cameraController->GetCameraBuffer().handle);
+        }
+    }
+
+    void CubemapManager::OnDestroyCommandList(reshade::api::command_list* cmd_list) {
+        if (!cmd_list->get_private_data<CommandListState>()) return;
+        g_commandListsDestroyed.fetch_add(1, std::memory_order_release);
+        cmd_list->destroy_private_data<CommandListState>();
+    }
+
+    void CubemapManager::ProcessDraw(reshade::api::command_list* cmd_list, bool indexed, uint32_t count, uint32_t instance_count, uint32_t first, int32_t offset_or_vertex, uint32_t first_instance) {
+        if (!m_isRecording) return;
+        Profiler::CpuScope profile(Profiler::CpuStage::ProcessDraw);
+        CommandListState& list = GetCommandListState(cmd_list);
+
+        // Camera detection can move to another buffer, the slot is re-resolved only then
+        uint64_t cameraHandle = m_cameraController->GetCameraBuffer().handle;
+        if (cameraHandle != list.trackedCameraBuffer) UpdateCameraSlot(list, cameraHandle);
+        if (!list.isCameraBufferBound) return;
+        Profiler::Increment(Profiler::Counter::InterceptedDraws);
+
+        // Shadow and reflection passes through the same camera buffer render once, for the game only
+        if (Config::MainViewOnly && m_cameraController->GetCurrentRole() != Camera::CameraRole::Main) {
+            Profiler::Increment(Profiler::Counter::SecondaryViewDraws);
+            return;
+        }
+
+        ID3D11DeviceContext* ctx = (ID3D11DeviceContext*)cmd_list->get_native();
+        if (!ctx) return;
+
+        ID3D11Buffer* nativeCamBuf = (ID3D11Buffer*)cameraHandle;
+        int slot = list.cameraSlot;
+
+        // Faces reused from the previous frame aren't replayed at all
+        const FaceParams& faceParams = GetFaceParams();
+        uint32_t faceMask = faceParams.refreshFaces;
+        if (faceMask == 0) return;
+        const Camera::CameraSnapshot& snap = GetListSnapshot(list);
+
+        // Per-face culling against the draw's bounding sphere. Instanced draws carry per-instance
+        // transforms we can't see, so they are always drawn to every face.
+        if (Config::FaceCulling && m_faceCuller && instance_count <= 1) {
+            ComPtr<ID3D11Buffer> vertexBuffer;
+            UINT stride = 0, vbOffset = 0;
+            ctx->IAGetVertexBuffers(0, 1, vertexBuffer.GetAddressOf(), &stride, &vbOffset);
+            if (vertexBuffer) {
+                // Every other bound VS buffer may hold the object's world matrix
+                uint64_t objectBuffers[D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT];
+                uint32_t objectBufferCount = 0;
+                for (uint64_t buffer : list.vsConstantBuffers) {
+                    if (buffer && buffer != cameraHandle) objectBuffers[objectBufferCount++] = buffer;
+                }
+                faceMask &= m_faceCuller->GetVisibleFaces(snap, m_cameraController->IsRightHanded(),
+                                                         (uint64_t)vertexBuffer.Get(), objectBuffers, objectBufferCount);
             }
+            if (faceMask == 0) return;
+        }
+
+        // Faces get their own depth, but only where the game draw itself uses depth
+        ComPtr<ID3D11DepthStencilView> gameDSV;
+        ctx->OMGetRenderTargets(0, nullptr, gameDSV.GetAddressOf());
+        const FaceDepth* faceDepth = gameDSV ? PrepareFaceDepth(ctx, gameDSV.Get()) : nullptr;
+
+        // Deferred contexts execute at an unknown point, only immediate work is timed
+        bool immediate = ctx->GetType() == D3D11_DEVICE_CONTEXT_IMMEDIATE;
+        GpuTimer::Interval timing(immediate && m_gpuTimingEnabled ? &m_gpuTimer : nullptr, ctx);
+        GpuTimer::Interval stageTiming(immediate ? GetStageTimer(Profiler::GpuStage::FaceDraws) : nullptr, ctx);
+
+        if (Config::SinglePassLayered && DrawLayered(list, ctx, faceParams.rects, faceMask, faceDepth, indexed, count, instance_count, first, offset_or_vertex, first_instance)) {
+            Profiler::Increment(Profiler::Counter::FaceDraws, std::bitset<6>(faceMask).count());
+            return;
+        }
+
+        FaceConstantBuffers* faceCBs = AcquireFaceConstantBuffers(list, ctx, nativeCamBuf);
+        if (!faceCBs) return;
+
+        // Save only what the face loop changes
+        StateBlock<State::VS_CB | State::OM_RT | State::RS_VP> state(ctx);
+        float minDepth, maxDepth;
+        GetGameDepthRange(ctx, minDepth, maxDepth);
+
+        for (int i = 0; i < 6; ++i) {
+            if (!faceCBs->valid[i] || !(faceMask & (1u << i))) continue;
 
             // Bind Modified Camera
-            ID3D11Buffer* cbArray[] = { tempCB.Get() };
+            ID3D11Buffer* cbArray[] = { faceCBs->buffers[i].Get() };
             ctx->VSSetConstantBuffers(slot, 1, cbArray);
 
-            // Bind Face Render Target
-            // Note: We reuse current DSV. If Face Size != Screen Size, this is invalid!
-            // But we init Face Size = min(w, h).
-            // If the game uses a depth buffer of different size, this will fail or warn.
-            // A robust solution needs a dedicated Depth Buffer for the Face Size.
-            // For now, we assume the user configured the game resolution to match or we accept artifacts.
-
+            // Bind Face Render Target with the matching face depth slice
             ID3D11RenderTargetView* faceRTV = (ID3D11RenderTargetView*)m_faceRtvs[i].handle;
-            ctx->OMSetRenderTargets(1, &faceRTV, currentDSV.Get()); // Re-bind DSV
+            ID3D11DepthStencilView* faceDSV = faceDepth ? (ID3D11DepthStencilView*)faceDepth->faceDsvs[i].handle : nullptr;
+            ctx->OMSetRenderTargets(1, &faceRTV, faceDSV);
+            SetFaceViewports(ctx, &faceParams.rects[i], 1, minDepth, maxDepth);
 
             // Draw
             if (indexed) {
@@ -270,11 +625,243 @@ namespace Graphics {
             } else {
                 ctx->Draw(count, first);
             }
+            Profiler::Increment(Profiler::Counter::FaceDraws);
         }
 
         // StateBlock destructor restores state automatically
     }
 
+    bool CubemapManager::DrawLayered(CommandListState& list, ID3D11DeviceContext* ctx, const D3D11_RECT* faceRects, uint32_t faceMask, const FaceDepth* faceDepth, bool indexed, uint32_t count, uint32_t instance_count, uint32_t first, int32_t offset_or_vertex, uint32_t first_instance) {
+        if (!m_layeredShims || !m_cubeArrayRtv.handle) return false;
+
+        // The shim occupies the GS stage, so draws that already use GS or tessellation stay on the per-face path
+        if (list.boundGeometryStages != 0 || list.currentVertexShader == 0) return false;
+
+        D3D11_PRIMITIVE_TOPOLOGY topology;
+        ctx->IAGetPrimitiveTopology(&topology);
+        if (topology != D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST && topology != D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP) return false;
+
+        // ProcessDraw brought it up to date
+        const Camera::CameraSnapshot& snap = *list.snapshot;
+        if (!snap.hasClipTransforms) return false;
+
+        ID3D11Device* device = (ID3D11Device*)m_device->get_native();
+        if (!device) return false;
+
+        ID3D11GeometryShader* shim = m_layeredShims->GetShim(list.currentVertexShader);
+        if (!shim) return false;
+
+        if (!list.layeredCB) {
+            D3D11_BUFFER_DESC desc = {};
+            desc.ByteWidth = sizeof(LayeredShimCache::FaceTransforms);
+            desc.Usage = D3D11_USAGE_DYNAMIC;
+            desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+            desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+            if (FAILED(device->CreateBuffer(&desc, nullptr, list.layeredCB.GetAddressOf()))) return false;
+            list.layeredCBGeneration = 0;
+        }
+
+        if (list.layeredCBGeneration != snap.generation || list.layeredCBFaceMask != faceMask) {
+            D3D11_MAPPED_SUBRESOURCE mapped;
+            if (FAILED(ctx->Map(list.layeredCB.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped))) return false;
+            auto* transforms = (LayeredShimCache::FaceTransforms*)mapped.pData;
+            for (int i = 0; i < 6; ++i) {
+                DirectX::XMStoreFloat4x4((DirectX::XMFLOAT4X4*)transforms->clip[i], snap.faceClipTransforms[i]);
+            }
+            transforms->faceMask = faceMask;
+            ctx->Unmap(list.layeredCB.Get(), 0);
+            list.layeredCBGeneration = snap.generation;
+            list.layeredCBFaceMask = faceMask;
+        }
+
+        StateBlock<State::GS | State::OM_RT | State::RS_VP> state(ctx);
+        float minDepth, maxDepth;
+        GetGameDepthRange(ctx, minDepth, maxDepth);
+
+        ID3D11DepthStencilView* dsv = faceDepth ? (ID3D11DepthStencilView*)faceDepth->arrayDsv.handle : nullptr;
+        ID3D11RenderTargetView* rtv = (ID3D11RenderTargetView*)m_cubeArrayRtv.handle;
+        ctx->OMSetRenderTargets(1, &rtv, dsv);
+        ctx->GSSetShader(shim, nullptr, 0);
+        ctx->GSSetConstantBuffers(0, 1, list.layeredCB.GetAddressOf());
+        // The shim routes each face to the viewport with its index
+        SetFaceViewports(ctx, faceRects, 6, minDepth, maxDepth);
+
+        // Replay the original call unchanged, the GS instances it six times
+        if (indexed) {
+            ctx->DrawIndexedInstanced(count, instance_count, first, offset_or_vertex, first_instance);
+        } else {
+            ctx->DrawInstanced(count, instance_count, first, first_instance);
+        }
+
+        return true;
+    }
+
+    void CubemapManager::GetGameDepthRange(ID3D11DeviceContext* ctx, float& minDepth, float& maxDepth) {
+        D3D11_VIEWPORT gameViewport = {};
+        UINT numViewports = 1;
+        ctx->RSGetViewports(&numViewports, &gameViewport);
+        minDepth = numViewports ? gameViewport.MinDepth : 0.0f;
+        maxDepth = numViewports ? gameViewport.MaxDepth : 1.0f;
+    }
+
+    void CubemapManager::SetFaceViewports(ID3D11DeviceContext* ctx, const D3D11_RECT* rects, UINT count, float minDepth, float maxDepth) {
+        // The game's viewport is sized for its own targets, faces get exactly their rect.
+        // The scissor matters only for games that enable it, but then it must not clip the face.
+        D3D11_VIEWPORT vps[6];
+        for (UINT i = 0; i < count; ++i) {
+            const D3D11_RECT& rect = rects[i];
+            vps[i] = { (float)rect.left, (float)rect.top, (float)(rect.right - rect.left), (float)(rect.bottom - rect.top), minDepth, maxDepth };
+        }
+        ctx->RSSetViewports(count, vps);
+        ctx->RSSetScissorRects(count, rects);
+    }
+
+    const CubemapManager::FaceDepth* CubemapManager::PrepareFaceDepth(ID3D11DeviceContext* ctx, ID3D11DepthStencilView* gameDSV) {
+        if (!m_cubeTexture.handle) return nullptr;
+
+        D3D11_DEPTH_STENCIL_VIEW_DESC gameDesc;
+        gameDSV->GetDesc(&gameDesc);
+        for (const auto& slot : m_faceDepths) {
+            const FaceDepth* depth = slot.load(std::memory_order_acquire);
+            if (!depth) break;
+            if (depth->format == gameDesc.Format) return depth->usable ? depth : nullptr;
+        }
+
+        // Contexts recorded in parallel can get here together, the first one creates it
+        std::lock_guard<std::mutex> lock(m_faceDepthMutex);
+        uint32_t index = 0;
+        for (; index < kMaxFaceDepthFormats; ++index) {
+            const FaceDepth* depth = m_faceDepths[index].load(std::memory_order_relaxed);
+            if (!depth) break;
+            if (depth->format == gameDesc.Format) return depth->usable ? depth : nullptr;
+        }
+        if (index == kMaxFaceDepthFormats) {
+            LOG_ONCE(WARNING, "Camera passes use more than ", kMaxFaceDepthFormats, " depth formats, the others render faces without depth");
+            return nullptr;
+        }
+
+        // Match the game's depth format so depth precision and stencil behave the same, at face size
+        auto created = std::make_unique<FaceDepth>();
+        FaceDepth* depth = created.get();
+        depth->format = gameDesc.Format;
+        depth->hasStencil = gameDesc.Format == DXGI_FORMAT_D24_UNORM_S8_UINT || gameDesc.Format == DXGI_FORMAT_D32_FLOAT_S8X24_UINT;
+        depth->usable = CreateFaceDepth(*depth);
+        if (depth->usable) {
+            // A new buffer starts cleared in the context about to use it, later frames are cleared at present
+            ClearFaceDepth(ctx, *depth);
+            LOG_INFO("Created face depth buffer ", m_faceSize, "x", m_faceSize, "x6 (format ", (int)gameDesc.Format, ")");
+        } else {
+            LOG_ERROR("Failed to create face depth buffer (format ", (int)gameDesc.Format, ")");
+            DestroyFaceDepth(*depth);
+        }
+
+        // A failed format is published too, so it isn't retried every draw
+        m_faceDepths[index].store(created.release(), std::memory_order_release);
+        return depth->usable ? depth : nullptr;
+    }
+
+    bool CubemapManager::CreateFaceDepth(FaceDepth& depth) {
+        reshade::api::format format = (reshade::api::format)depth.format;
+        if (!m_device->create_resource(
+            reshade::api::resource_desc(reshade::api::resource_type::texture_2d, m_faceSize, m_faceSize, 6, 1, format, 1, reshade::api::memory_heap::gpu_only, reshade::api::resource_usage::depth_stencil),
+            nullptr, reshade::api::resource_usage::depth_stencil_write, &depth.texture))
+            return false;
+
+        for (int i = 0; i < 6; ++i) {
+            if (!m_device->create_resource_view(depth.texture, reshade::api::resource_usage::depth_stencil,
+                reshade::api::resource_view_desc(reshade::api::resource_view_type::texture_2d_array, format, 0, 1, i, 1), &depth.faceDsvs[i]))
+                return false;
+        }
+
+        return m_device->create_resource_view(depth.texture, reshade::api::resource_usage::depth_stencil,
+            reshade::api::resource_view_desc(reshade::api::resource_view_type::texture_2d_array, format, 0, 1, 0, 6), &depth.arrayDsv);
+    }
+
+    void CubemapManager::ClearFaceDepth(ID3D11DeviceContext* ctx, const FaceDepth& depth) {
+        if (!depth.arrayDsv.handle) return;
+        UINT flags = D3D11_CLEAR_DEPTH | (depth.hasStencil ? D3D11_CLEAR_STENCIL : 0);
+        float clearDepth = m_cameraController->IsReversedZ() ? 0.0f : 1.0f;
+        ctx->ClearDepthStencilView((ID3D11DepthStencilView*)depth.arrayDsv.handle, flags, clearDepth, 0);
+    }
+
+    void CubemapManager::DestroyFaceDepth(FaceDepth& depth) {
+        if (m_device) {
+            for (int i = 0; i < 6; ++i) {
+                if (depth.faceDsvs[i].handle) m_device->destroy_resource_view(depth.faceDsvs[i]);
+                depth.faceDsvs[i] = {};
+            }
+            if (depth.arrayDsv.handle) m_device->destroy_resource_view(depth.arrayDsv);
+            if (depth.texture.handle) m_device->destroy_resource(depth.texture);
+        }
+        depth.arrayDsv = {};
+        depth.texture = {};
+        depth.usable = false;
+    }
+
+    void CubemapManager::RetireFaceDepths() {
+        std::lock_guard<std::mutex> lock(m_faceDepthMutex);
+        for (auto& slot : m_faceDepths) {
+            FaceDepth* depth = slot.exchange(nullptr, std::memory_order_acq_rel);
+            if (depth) m_retiredFaceDepths.push_back({ std::unique_ptr<FaceDepth>(depth), m_frameIndex });
+        }
+    }
+
+    void CubemapManager::ReleaseRetiredFaceDepths(bool all) {
+        // Draws recorded in the frame a depth was retired in are done two presents later
+        auto expired = [&](RetiredFaceDepth& retired) {
+            if (!all && m_frameIndex < retired.frame + 2) return false;
+            DestroyFaceDepth(*retired.depth);
+            return true;
+        };
+        m_retiredFaceDepths.erase(std::remove_if(m_retiredFaceDepths.begin(), m_retiredFaceDepths.end(), expired), m_retiredFaceDepths.end());
+    }
+
+    CubemapManager::FaceConstantBuffers* CubemapManager::AcquireFaceConstantBuffers(CommandListState& list, ID3D11DeviceContext* ctx, ID3D11Buffer* cameraBuffer) {
+        D3D11_BUFFER_DESC desc = {};
+        cameraBuffer->GetDesc(&desc);
+
+        FaceConstantBuffers& set = list.faceCBPool[desc.ByteWidth];
+        if (!set.buffers[0]) {
+            ID3D11Device* device = (ID3D11Device*)m_device->get_native();
+            if (!device) return nullptr;
+
+            desc.Usage = D3D11_USAGE_DYNAMIC;
+            desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+            desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+            desc.MiscFlags = 0;
+            desc.StructureByteStride = 0;
+
+            for (int i = 0; i < 6; ++i) {
+                if (FAILED(device->CreateBuffer(&desc, nullptr, set.buffers[i].GetAddressOf()))) {
+                    LOG_ERROR("Failed to create face constant buffer ", i, " (", desc.ByteWidth, " bytes)");
+                    list.faceCBPool.erase(desc.ByteWidth);
+                    return nullptr;
+                }
+            }
+            set.generation = 0;
+        }
+
+        // Only refill when the camera data changed since the last upload in this command list
+        // ProcessDraw brought it up to date
+        const Camera::CameraSnapshot& snap = *list.snapshot;
+        if (set.generation == snap.generation) return &set;
+
+        for (int i = 0; i < 6; ++i) {
+            set.valid[i] = false;
+            if (!snap.valid) continue;
+
+            D3D11_MAPPED_SUBRESOURCE mapped;
+            if (SUCCEEDED(ctx->Map(set.buffers[i].Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped))) {
+                memcpy(mapped.pData, snap.faceData[i].data(), std::min((size_t)desc.ByteWidth, snap.faceData[i].size()));
+                ctx->Unmap(set.buffers[i].Get(), 0);
+                set.valid[i] = true;
+            }
+        }
+        set.generation = snap.generation;
+
+        return &set;
+    }
+
     void CubemapManager::OnDraw(reshade::api::command_list* cmd_list, uint32_t vertex_count, uint32_t instance_count, uint32_t first_vertex, uint32_t first_instance) {
         ProcessDraw(cmd_list, false, vertex_count, instance_count, first_vertex, 0, first_instance);
     }
@@ -284,114 +871,126 @@ namespace Graphics {
     }
 
     void CubemapManager::OnPresent(reshade::api::command_queue* queue, reshade::api::swapchain* swapchain) {
+        // Follows the back buffer, the manager is kept across swapchain resizes. The camera scan
+        // needs its aspect ratio before lock-on to tell the game view from light views.
+        reshade::api::resource backBuffer = swapchain->get_current_back_buffer();
+        reshade::api::resource_desc desc = m_device->get_resource_desc(backBuffer);
+        if (desc.texture.height != 0) m_cameraController->SetOutputAspect((float)desc.texture.width / (float)desc.texture.height);
+
         // Optimization: Don't initialize or capture if we haven't found a camera yet (e.g. loading screen)
         if (m_cameraController->GetCameraBuffer().handle == 0) return;
+        if (!InitResources((uint32_t)desc.texture.width, (uint32_t)desc.texture.height)) return;
+
+        // Execute Compute Shader to Stitch/Project
+        ID3D11DeviceContext* ctx = (ID3D11DeviceContext*)queue->get_native();
 
-        if (m_width == 0 || m_height == 0 || !InitResources(m_width, m_height)) {
-             reshade::api::resource backBuffer = swapchain->get_current_back_buffer();
-             reshade::api::resource_desc desc = m_device->get_resource_desc(backBuffer);
-             if (!InitResources((uint32_t)desc.texture.width, (uint32_t)desc.texture.height)) return;
+        // This frame's face draws are done, the next frame's start from a clean depth buffer
+        for (const auto& slot : m_faceDepths) {
+            const FaceDepth* depth = slot.load(std::memory_order_acquire);
+            if (!depth) break;
+            if (depth->usable) ClearFaceDepth(ctx, *depth);
         }
+        if (!m_retiredFaceDepths.empty()) ReleaseRetiredFaceDepths(false);
 
-        // Copy Faces to Cube Texture (Array)
-        reshade::api::command_list* cmd_list = queue->get_immediate_command_list();
-        if (cmd_list) {
-            for (int i = 0; i < 6; ++i) {
-                cmd_list->copy_texture_region(m_faceTextures[i], 0, nullptr, m_cubeTexture, i, nullptr);
-            }
+        // The projection must see the rects this frame's faces were rendered with, so new
+        // rects from the GPU budget only take effect for the next frame's draws.
+        UploadFaceRects(ctx);
+        if (m_gpuTimingEnabled) {
+            UpdateDynamicResolution(ctx);
+        }
+        if (m_stageTimingEnabled) {
+            UpdateStageTimers(ctx);
         }
+        ScheduleFaceRefresh();
+        PublishFaceParams();
 
-        // Execute Compute Shader to Stitch/Project
-        ID3D11DeviceContext* ctx = (ID3D11DeviceContext*)queue->get_native();
+        // Timed as part of the next frame, together with its face draws
+        GpuTimer::Interval timing(m_gpuTimingEnabled ? &m_gpuTimer : nullptr, ctx);
+        ProjectAndEncode(ctx);
+    }
 
-        if (m_projectionShader) {
-            ctx->CSSetShader(m_projectionShader.Get(), nullptr, 0);
-            ID3D11ShaderResourceView* srv = (ID3D11ShaderResourceView*)m_cubeSrv.handle;
-            ctx->CSSetShaderResources(0, 1, &srv);
-            ID3D11UnorderedAccessView* uav = (ID3D11UnorderedAccessView*)m_equirectUAV.handle;
-            ctx->CSSetUnorderedAccessViews(0, 1, &uav, nullptr);
-            
-            reshade::api::resource_desc desc = m_device->get_resource_desc(m_equirectTexture);
-            UINT x = (desc.texture.width + 15) / 16;
-            UINT y = (desc.texture.height + 15) / 16;
-            ctx->Dispatch(x, y, 1);
-            
-            ID3D11UnorderedAccessView* nullUAV[] = { nullptr };
-            ctx->CSSetUnorderedAccessViews(0, 1, nullUAV, nullptr);
-            ID3D11ShaderResourceView* nullSRV[] = { nullptr };
-            ctx->CSSetShaderResources(0, 1, nullSRV);
-        }
-
-        // Convert to NV12 and Encode
-        // We render a full-screen quad to the NV12 targets using the Equirect texture as input
-        if (m_equirectNV12) {
-             // Setup Viewport
-             D3D11_TEXTURE2D_DESC eqDesc;
-             m_equirectNV12->GetDesc(&eqDesc);
-
-             ctx->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-             ctx->VSSetShader(m_convertVS.Get(), nullptr, 0);
-
-             ID3D11ShaderResourceView* srv = (ID3D11ShaderResourceView*)m_equirectSRV.handle;
-             ctx->PSSetShaderResources(0, 1, &srv);
-             ctx->PSSetSamplers(0, 1, m_linearSampler.GetAddressOf());
-
-             // Y Pass
-             D3D11_VIEWPORT vp = {};
-             vp.Width = (float)eqDesc.Width;
-             vp.Height = (float)eqDesc.Height;
-             vp.MaxDepth = 1.0f;
-             ctx->RSSetViewports(1, &vp);
-             ctx->OMSetRenderTargets(1, m_nv12Y_RTV.GetAddressOf(), nullptr);
-             ctx->PSSetShader(m_convertPS_Y.Get(), nullptr, 0);
-             ctx->Draw(3, 0); // Full screen triangle
-
-             // UV Pass
-             vp.Width = (float)eqDesc.Width / 2.0f;
-             vp.Height = (float)eqDesc.Height / 2.0f;
-             ctx->RSSetViewports(1, &vp);
-             ctx->OMSetRenderTargets(1, m_nv12UV_RTV.GetAddressOf(), nullptr);
-             ctx->PSSetShader(m_convertPS_UV.Get(), nullptr, 0);
-             ctx->Draw(3, 0);
-
-             // Encode
-             m_encoder->EncodeFrame(m_equirectNV12.Get());
-
-             // Cleanup
-             ID3D11RenderTargetView* nullRTV = nullptr;
-             ctx->OMSetRenderTargets(1, &nullRTV, nullptr);
+    void CubemapManager::ProjectAndEncode(ID3D11DeviceContext* ctx) {
+        // Nothing this frame if the encoder is out of surfaces (the queue policy already waited or dropped)
+        Video::EncoderSurface surface;
+        {
+            Profiler::CpuScope profile(Profiler::CpuStage::EncoderSubmit);
+            if (!m_encoder || !m_encoder->AcquireSurface(surface)) return;
         }
+
+        // Everything the projection and conversion passes bind, handed back before ReShade and the game continue
+        StateBlock<State::CS | State::IA | State::VS | State::PS | State::PS_SRV | State::PS_SAMPLER | State::RS_VP | State::OM_RT> state(ctx);
+
+        if (!m_projector.Project(ctx, (ID3D11ShaderResourceView*)m_cubeSrv.handle, (ID3D11ShaderResourceView*)m_cubeArraySrv.handle,
+                                 m_faceRectCB.Get(), surface, GetStageTimer(Profiler::GpuStage::Projection),
+                                 GetStageTimer(Profiler::GpuStage::NV12Convert)))
+        {
+            m_encoder->DiscardSurface(surface);
+            return;
+        }
+        SubmitSurface(ctx, surface);
+    }
+
+    void CubemapManager::SubmitSurface(ID3D11DeviceContext* ctx, Video::EncoderSurface& surface) {
+        Profiler::CpuScope profile(Profiler::CpuStage::EncoderSubmit);
+        GpuTimer::Interval stageTiming(GetStageTimer(Profiler::GpuStage::EncoderCopy), ctx);
+        m_encoder->SubmitSurface(surface);
     }
     
-    void CubemapManager::OnMapBuffer(reshade::api::device* device, reshade::api::resource resource, uint64_t size, void* data) {
-         if (!data) return;
-         
-         if (size == UINT64_MAX) {
-             reshade::api::resource_desc desc = device->get_resource_desc(resource);
-             size = desc.buffer.size;
-         }
+    // Maps in flight on the calling thread. A buffer is mapped and unmapped through the same context,
+    // and a context is only used by one thread at a time, so this needs neither locks nor allocation.
+    struct PendingMap {
+        uint64_t handle;
+        const void* data;
+        uint64_t size;
+    };
+    static thread_local PendingMap t_pendingMaps[8] = {};
 
-         std::lock_guard<std::mutex> lock(m_mapMutex);
-         m_mappedBuffers[resource.handle] = { data, size };
+    void CubemapManager::OnMapBuffer(reshade::api::device* device, reshade::api::resource resource, uint64_t size, void* data) {
+        if (!data) return;
+        Profiler::CpuScope profile(Profiler::CpuStage::MapTracking);
+
+        // Only CPU-written constant buffers can carry the camera or object transforms
+        reshade::api::resource_desc desc = device->get_resource_desc(resource);
+        if ((desc.usage & reshade::api::resource_usage::constant_buffer) != reshade::api::resource_usage::constant_buffer) return;
+        if (size == UINT64_MAX) size = desc.buffer.size;
+
+        // The camera scan reads mapped memory only up to 4 KB, the face culler needs any constant buffer
+        uint64_t maxSize = (m_faceCuller && Config::FaceCulling) ? D3D11_REQ_CONSTANT_BUFFER_ELEMENT_COUNT * 16 : 4096;
+        if (size < 64 || size > maxSize) return;
+
+        PendingMap* slot = nullptr;
+        for (PendingMap& pending : t_pendingMaps) {
+            if (pending.handle == resource.handle) { slot = &pending; break; }
+            if (!slot && pending.handle == 0) slot = &pending;
+        }
+        // Full (maps without unmaps), overwrite a slot picked by handle rather than growing. Handles are
+        // aligned pointers, so the slot comes from the top bits of a multiplicative hash, not the low bits.
+        if (!slot) slot = &t_pendingMaps[(resource.handle * 0x9E3779B97F4A7C15ull) >> 61];
+        *slot = { resource.handle, data, size };
     }
 
-    void CubemapManager::OnUnmapBuffer(reshade::api::device* device, reshade::api::resource resource) {
+    void CubemapManager::OnUnmapBuffer(reshade::api::device* /*device*/, reshade::api::resource resource) {
         // Read data on unmap
-        void* dataPtr = nullptr;
+        const void* dataPtr = nullptr;
         uint64_t size = 0;
 
         {
-             std::lock_guard<std::mutex> lock(m_mapMutex);
-             auto it = m_mappedBuffers.find(resource.handle);
-             if (it != m_mappedBuffers.end()) {
-                 dataPtr = it->second.data;
-                 size = it->second.size;
-                 m_mappedBuffers.erase(it);
-             }
+            Profiler::CpuScope profile(Profiler::CpuStage::MapTracking);
+            for (PendingMap& pending : t_pendingMaps) {
+                if (pending.handle != resource.handle) continue;
+                dataPtr = pending.data;
+                size = pending.size;
+                pending = {};
+                break;
+            }
         }
+        if (!dataPtr) return;
 
-        if (dataPtr && size > 0 && m_cameraController) {
+        if (m_cameraController) {
              m_cameraController->OnScanBuffer(resource, dataPtr, size);
         }
+        if (m_faceCuller && Config::FaceCulling) {
+             m_faceCuller->OnBufferData(resource, dataPtr, size);
+        }
     }
 }
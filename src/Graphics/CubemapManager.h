@@ -4,15 +4,23 @@
 #include <wrl/client.h>
 #include <memory>
 #include "../Camera/CameraController.h"
-#include "../Video/FFmpegBackend.h"
+#include "../Video/Encoder.h"
+#include "../Compute/Projection.h"
+#include "../Core/Profiler.h"
+#include "LayeredShim.h"
+#include "FaceCuller.h"
+#include "GpuTimer.h"
+#include "OutputProjector.h"
+#include <atomic>
 #include <map>
 #include <mutex>
+#include <vector>
 
 namespace Graphics {
 
     class CubemapManager {
     public:
-        CubemapManager(reshade::api::device* device);
+        CubemapManager(reshade::api::device* device, LayeredShimCache* layeredShims = nullptr, FaceCuller* faceCuller = nullptr);
         ~CubemapManager();
 
         void OnPresent(reshade::api::command_queue* queue, reshade::api::swapchain* swapchain);
@@ -20,66 +28,217 @@ namespace Graphics {
         void OnDrawIndexed(reshade::api::command_list* cmd_list, uint32_t index_count, uint32_t instance_count, uint32_t first_index, int32_t vertex_offset, uint32_t first_instance);
         void OnUpdateBuffer(reshade::api::device* device, reshade::api::resource resource, const void* data, uint64_t size);
         void OnBindPipeline(reshade::api::command_list* cmd_list, reshade::api::pipeline_stage stages, reshade::api::pipeline pipeline);
+        void OnPushDescriptors(reshade::api::command_list* cmd_list, reshade::api::shader_stage stages, reshade::api::pipeline_layout layout, uint32_t param_index, const reshade::api::descriptor_table_update& update);
+        void OnDestroyResource(reshade::api::resource resource);
         
+        // Mapped constant buffers are scanned on unmap, once the game has written them
         void OnMapBuffer(reshade::api::device* device, reshade::api::resource resource, uint64_t size, void* data);
         void OnUnmapBuffer(reshade::api::device* device, reshade::api::resource resource);
 
+        // ClearState resets a context's bindings to defaults
+        void OnResetCommandList(reshade::api::command_list* cmd_list);
+        // FinishCommandList ends a deferred context's recording, which is reported through
+        // execute_secondary_command_list together with ExecuteCommandList on the immediate context
+        void OnExecuteSecondaryCommandList(reshade::api::command_list* cmd_list, reshade::api::command_list* secondary_cmd_list);
+        // Frees the interception state of a command list. Static: contexts can outlive the manager.
+        static void OnDestroyCommandList(reshade::api::command_list* cmd_list);
+
     private:
+        // Size-dependent parts are split so a resize only rebuilds what the new size invalidates:
+        // face resources follow the face size, output resources (and the encoder) are created once.
         bool InitResources(uint32_t width, uint32_t height);
+        bool InitFaceResources();
+        bool InitOutputResources();
         void DestroyResources();
-        
+        void DestroyFaceResources();
+        void DestroyOutputResources();
+
+        // Projection and NV12 conversion of the finished cube (see OutputProjector), then encoder submission
+        void ProjectAndEncode(ID3D11DeviceContext* ctx);
+        void SubmitSurface(ID3D11DeviceContext* ctx, Video::EncoderSurface& surface);
+
+        // Faces render into the top-left m_faceRects[i] of their slice when their size can change.
+        // The projection kernels then sample through the g_FaceUV constants in m_faceRectCB.
+        bool UsesFaceSubRects() const;
+        static float GetFaceTierScale(Camera::CubeFace face); // Config::FaceScale* for a face
+        void UpdateFaceRects();
+        void UploadFaceRects(ID3D11DeviceContext* ctx);
+
+        // Picks the faces the next frame's draws are replayed into (Config::TemporalReuseFaces)
+        void ScheduleFaceRefresh();
+
+        // Closes the timed frame and adjusts m_faceScale to the GPU budget (Config::DynamicResolution)
+        void UpdateDynamicResolution(ID3D11DeviceContext* ctx);
+
+        // Profiling: reports the stage times that resolved and starts the next frame's queries.
+        // GetStageTimer is nullptr unless Config::Profiling is set, which makes GpuTimer::Interval a no-op.
+        void UpdateStageTimers(ID3D11DeviceContext* ctx);
+        GpuTimer* GetStageTimer(Profiler::GpuStage stage) { return m_stageTimingEnabled ? &m_stageTimers[(uint32_t)stage] : nullptr; }
+
+        // Persistent per-face copies of the camera constant buffer.
+        // Refilled only when the CameraController reports new camera data, so a draw just rebinds them.
+        struct FaceConstantBuffers {
+            Microsoft::WRL::ComPtr<ID3D11Buffer> buffers[6];
+            bool valid[6] = {};
+            uint64_t generation = 0;
+        };
+
+        // Interception state of one command list: the immediate context or a deferred context, which
+        // games record on worker threads. Attached to the command list as ReShade private data; a D3D11
+        // context is only used by one thread at a time, so none of it needs a lock. Buffers the draw path
+        // maps are per command list too, since a deferred context has to map a dynamic buffer (with
+        // WRITE_DISCARD) before its first use in every command list it records.
+        struct __declspec(uuid("6c1e4f0a-3b7d-4c59-9a8e-2f4d1b7e9c35")) CommandListState {
+            uint32_t owner = 0; // m_instanceId of the manager the buffers below were created for
+            bool deferred = false;
+
+            // Binding tracking. VS constant buffers are mirrored from push_descriptors, so a draw
+            // knows whether (and where) the camera buffer is bound without querying the context.
+            uint64_t vsConstantBuffers[D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT] = {};
+            uint64_t trackedCameraBuffer = 0;
+            int cameraSlot = -1;
+            bool isCameraBufferBound = false;
+
+            // Shader stages bound by the game, tracked through bind_pipeline
+            uint64_t currentVertexShader = 0;
+            uint32_t boundGeometryStages = 0; // pipeline_stage bits of GS/HS/DS in use, which rule out the layered shim
+
+            // Camera contents this list's draws replicate from, see GetListSnapshot
+            Camera::CameraSnapshotPtr snapshot;
+
+            std::map<UINT, FaceConstantBuffers> faceCBPool; // Key is camera buffer ByteWidth
+            Microsoft::WRL::ComPtr<ID3D11Buffer> layeredCB;
+            uint64_t layeredCBGeneration = 0;
+            uint32_t layeredCBFaceMask = 0;
+
+            // Forgets all bindings, as after ClearState
+            void ClearBindings();
+            // Re-reads the bindings from the context, whose state FinishCommandList and ExecuteCommandList
+            // either keep or reset depending on their Restore*State argument, which no event reports
+            void SyncBindings(ID3D11DeviceContext* ctx);
+            // Called when a deferred recording ends: the next command list has to map the buffers again
+            void EndRecording();
+        };
+        CommandListState& GetCommandListState(reshade::api::command_list* cmd_list);
+
+        // Re-resolves which tracked VS slot holds the camera buffer
+        static void UpdateCameraSlot(CommandListState& list, uint64_t cameraHandle);
+
+        // Brings list.snapshot up to date and returns it: the camera contents the recording thread
+        // last wrote, or the latest published ones if the thread doesn't write the camera buffer.
+        // The face data, clip transforms and culling of a draw all come from it.
+        const Camera::CameraSnapshot& GetListSnapshot(CommandListState& list);
+
         void ProcessDraw(reshade::api::command_list* cmd_list, bool indexed, uint32_t count, uint32_t instance_count, uint32_t first, int32_t offset_or_vertex, uint32_t first_instance);
 
-        struct MappedInfo {
-            void* data;
-            uint64_t size;
+        FaceConstantBuffers* AcquireFaceConstantBuffers(CommandListState& list, ID3D11DeviceContext* ctx, ID3D11Buffer* cameraBuffer);
+
+        // Face viewport/scissor setup, keeping the depth range of the game's viewport
+        static void GetGameDepthRange(ID3D11DeviceContext* ctx, float& minDepth, float& maxDepth);
+        static void SetFaceViewports(ID3D11DeviceContext* ctx, const D3D11_RECT* rects, UINT count, float minDepth, float maxDepth);
+
+        // Face-sized 6-slice depth in one of the game's DSV formats. Never changes once published.
+        struct FaceDepth {
+            DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN;
+            reshade::api::resource texture = {};
+            reshade::api::resource_view faceDsvs[6] = {};
+            reshade::api::resource_view arrayDsv = {};
+            bool hasStencil = false;
+            bool usable = false; // Creation failed otherwise, the format isn't retried
         };
-        std::map<uint64_t, MappedInfo> m_mappedBuffers;
-        std::mutex m_mapMutex;
+        struct RetiredFaceDepth {
+            std::unique_ptr<FaceDepth> depth;
+            uint64_t frame; // m_frameIndex when it was retired
+        };
+
+        // Returns the face depth matching the game's DSV format, creating it on first use, from any
+        // recording thread. nullptr if there is no usable one, in which case faces render without depth.
+        const FaceDepth* PrepareFaceDepth(ID3D11DeviceContext* ctx, ID3D11DepthStencilView* gameDSV);
+        bool CreateFaceDepth(FaceDepth& depth);
+        void DestroyFaceDepth(FaceDepth& depth);
+        // Takes every face depth out of reach of new draws (face size change). Draws already recording
+        // may still hold one, so they are only destroyed by ReleaseRetiredFaceDepths a few presents later.
+        void RetireFaceDepths();
+        void ReleaseRetiredFaceDepths(bool all);
+        // Once per present on the immediate context, so every context's face draws start from it
+        void ClearFaceDepth(ID3D11DeviceContext* ctx, const FaceDepth& depth);
+
+        // Single-pass path: one draw through the layered GS shim into all six slices of m_cubeTexture.
+        // Returns false if this draw can't be wrapped, in which case the per-face path is used.
+        bool DrawLayered(CommandListState& list, ID3D11DeviceContext* ctx, const D3D11_RECT* faceRects, uint32_t faceMask, const FaceDepth* faceDepth, bool indexed, uint32_t count, uint32_t instance_count, uint32_t first, int32_t offset_or_vertex, uint32_t first_instance);
 
         reshade::api::device* m_device = nullptr;
+        uint32_t m_instanceId = 0;
         std::unique_ptr<Camera::CameraController> m_cameraController;
-        std::unique_ptr<Video::FFmpegBackend> m_encoder;
+        std::unique_ptr<Video::Encoder> m_encoder; // Created per output size by Video::EncoderFactory
+        // Set once InitOutputResources completed. A failed attempt is torn down and retried after
+        // kOutputRetryPresents presents rather than every frame.
+        bool m_outputReady = false;
+        uint32_t m_outputRetryDelay = 0;
+        static constexpr uint32_t kOutputRetryPresents = 300;
 
         // Resources
-        reshade::api::resource m_faceTextures[6] = {};
-        reshade::api::resource_view m_faceRtvs[6] = {};
-        reshade::api::resource_view m_faceSrvs[6] = {};
-        
+        // Faces are rendered directly into the slices of the cube array, there are no standalone face textures
         reshade::api::resource m_cubeTexture = {};
         reshade::api::resource_view m_cubeSrv = {};
+        reshade::api::resource_view m_faceRtvs[6] = {}; // texture_2d_array views, one slice each
 
-        reshade::api::resource m_equirectTexture = {};
-        reshade::api::resource_view m_equirectUAV = {};
-        reshade::api::resource_view m_equirectSRV = {};
+        // One face depth per DSV format seen in camera passes, so passes alternating formats within a
+        // frame neither reallocate it nor wipe each other's depth. Filled in order by whichever context
+        // needs a format first (m_faceDepthMutex held), read lock-free. Owned, freed by retirement.
+        static constexpr uint32_t kMaxFaceDepthFormats = 4;
+        std::atomic<FaceDepth*> m_faceDepths[kMaxFaceDepthFormats] = {};
+        std::vector<RetiredFaceDepth> m_retiredFaceDepths; // Present thread
+        std::mutex m_faceDepthMutex;
 
-        // Native Interop for FFmpeg (NV12)
-        Microsoft::WRL::ComPtr<ID3D11Texture2D> m_equirectNV12;
-        Microsoft::WRL::ComPtr<ID3D11RenderTargetView> m_nv12Y_RTV;
-        Microsoft::WRL::ComPtr<ID3D11RenderTargetView> m_nv12UV_RTV;
+        // Single-pass layered rendering targets (only created when Config::SinglePassLayered is set)
+        reshade::api::resource_view m_cubeArrayRtv = {};
+        LayeredShimCache* m_layeredShims = nullptr;
+        FaceCuller* m_faceCuller = nullptr;
 
-        // Shaders (Native D3D11 for now as ReShade doesn't provide easy runtime compilation)
-        Microsoft::WRL::ComPtr<ID3D11ComputeShader> m_projectionShader;
-        Microsoft::WRL::ComPtr<ID3D11VertexShader> m_convertVS;
-        Microsoft::WRL::ComPtr<ID3D11PixelShader> m_convertPS_Y;
-        Microsoft::WRL::ComPtr<ID3D11PixelShader> m_convertPS_UV;
-        Microsoft::WRL::ComPtr<ID3D11SamplerState> m_linearSampler;
+        // Plain texture_2d_array view of the cube, sampled with the projection's direction LUT
+        reshade::api::resource_view m_cubeArraySrv = {};
+
+        // Native Interop with the encoder (NV12): frames are projected into its surfaces, no copy
+        OutputProjector m_projector;
 
         bool m_isRecording = true;
         uint32_t m_width = 0;
         uint32_t m_height = 0;
         uint32_t m_faceSize = 0;
+        D3D11_RECT m_faceRects[6] = {}; // Region of each face slice that gets rendered (present thread)
+        Microsoft::WRL::ComPtr<ID3D11Buffer> m_faceRectCB; // g_FaceUV, only with UsesFaceSubRects()
+        bool m_faceRectsDirty = false;
+
+        // Dynamic resolution. Intercepted draws on the immediate context plus the projection are
+        // timed per frame, m_faceScale follows the smoothed result.
+        GpuTimer m_gpuTimer;
+        bool m_gpuTimingEnabled = false;
+        double m_captureGpuMs = 0.0;
+        float m_faceScale = 1.0f;
 
-        // Pipeline tracking
-        reshade::api::pipeline_layout m_currentPipelineLayout = { 0 };
-        // We need to track if the camera buffer is bound. ReShade doesn't give easy access to "currently bound buffers"
-        // without tracking 'push_descriptors' or 'bind_descriptor_tables'.
-        // Simplified: we will try to find the slot index if possible, or just scan binds.
-        // Actually, detecting if the *current* draw call uses the camera buffer is hard without tracking bindings.
-        // For now, we will assume if the CameraController has identified a buffer, we check if it is active.
-        // BUT: ReShade's event `draw` doesn't tell us what resources are bound.
-        // We must implement `push_descriptors` / `bind_descriptor_tables` tracking in the manager.
-
-        bool m_isCameraBufferBound = false;
+        // Per-stage GPU times for the profiler, independent of the dynamic resolution timer
+        GpuTimer m_stageTimers[(uint32_t)Profiler::GpuStage::Count];
+        bool m_stageTimingEnabled = false;
+
+        // Temporal reuse. Faces outside m_refreshFaces keep the previous frame's image this frame;
+        // m_staleFaces must be redrawn next frame no matter the schedule (new texture, new rect).
+        uint32_t m_refreshFaces = FaceCuller::AllFaces;
+        uint32_t m_staleFaces = FaceCuller::AllFaces;
+        uint64_t m_frameIndex = 0;
+        DirectX::XMVECTOR m_faceRefreshEye[6] = {};
+        DirectX::XMVECTOR m_faceRefreshForward[6] = {};
+
+        // The faces and rects draws render with, published once per present so contexts recorded on
+        // other threads never see a half-updated set. A published set stays valid until the
+        // next-but-one present.
+        struct FaceParams {
+            uint32_t refreshFaces = FaceCuller::AllFaces;
+            D3D11_RECT rects[6] = {};
+        };
+        void PublishFaceParams();
+        const FaceParams& GetFaceParams() const { return m_faceParams[m_faceParamsIndex.load(std::memory_order_acquire)]; }
+        FaceParams m_faceParams[2];
+        std::atomic<uint32_t> m_faceParamsIndex = 0;
     };
 }
@@ -0,0 +1,236 @@
+#include "pch.h"
+#include "FaceCuller.h"
+#include <algorithm>
+#include <cmath>
+#include <emmintrin.h>
+
+namespace Graphics {
+
+    // Vertex buffers whose largest float exceeds this are likely not float positions; don't cull them.
+    static const float kMaxPlausibleCoordinate = 1.0e7f;
+    // Packed attributes read as floats land far below any real coordinate (see OnInitResource)
+    static const float kMinPlausibleCoordinate = 1.0e-5f;
+    // Per-object buffers are small, and the world matrix sits near the start
+    static const uint64_t kMaxObjectBufferSize = 1024;
+    static const uint64_t kMaxVertexBufferScan = 64 * 1024 * 1024;
+
+    // Slot keys besides handles. Handles are object pointers and never take these values.
+    static const uint64_t kEmptyKey = 0;
+    static const uint64_t kClaimingKey = ~1ull; // Claimed by an insert that hasn't published yet
+    static const uint64_t kTombstoneKey = ~0ull;
+
+    static uint32_t Hash(uint64_t handle) {
+        // Handles are object pointers, the low bits carry little entropy
+        handle ^= handle >> 33;
+        handle *= 0xff51afd7ed558ccdull;
+        handle ^= handle >> 33;
+        return (uint32_t)handle;
+    }
+
+    FaceCuller::FaceCuller()
+        : m_meshRadii(std::make_unique<MeshSlot[]>(kMeshSlots)), m_objectTransforms(std::make_unique<ObjectSlot[]>(kObjectSlots)) {
+        static_assert((kMeshSlots & (kMeshSlots - 1)) == 0 && (kObjectSlots & (kObjectSlots - 1)) == 0, "Slot counts must be powers of two");
+    }
+
+    void FaceCuller::OnInitResource(const reshade::api::resource_desc& desc, const reshade::api::subresource_data* initialData, reshade::api::resource resource) {
+        if (desc.type != reshade::api::resource_type::buffer) return;
+        if ((desc.usage & reshade::api::resource_usage::vertex_buffer) != reshade::api::resource_usage::vertex_buffer) return;
+        if (!initialData || !initialData->data || desc.buffer.size < 12 || desc.buffer.size > kMaxVertexBufferScan) return;
+
+        // Stride and layout aren't known until the buffer is bound, so bound every float in it instead.
+        // A float3 position p then satisfies |p| <= sqrt(3) * max|component|. That only holds if the
+        // positions are 32-bit floats: half, SNORM16 or UNORM8 data read as floats gives NaNs, denormals
+        // and values around 1e-30 or 1e30, so a single word outside the plausible range rejects the
+        // buffer and its draws go to every face.
+        const float* floats = (const float*)initialData->data;
+        size_t count = (size_t)(desc.buffer.size / sizeof(float));
+        float maxAbs = 0.0f;
+        for (size_t i = 0; i < count; ++i) {
+            float v = std::abs(floats[i]);
+            if (v == 0.0f) continue;
+            if (!(v >= kMinPlausibleCoordinate && v <= kMaxPlausibleCoordinate)) return; // Also rejects NaN
+            if (v > maxAbs) maxAbs = v;
+        }
+        if (maxAbs <= 0.0f) return;
+
+        bool isNew = false;
+        MeshSlot* slot = ClaimSlot(m_meshRadii.get(), kMeshSlots, resource.handle, isNew);
+        if (!slot) return;
+        slot->radius.store(maxAbs * 1.7320508f, std::memory_order_relaxed);
+        if (isNew) slot->key.store(resource.handle, std::memory_order_release);
+    }
+
+    void FaceCuller::OnDestroyResource(reshade::api::resource resource) {
+        EraseSlots(m_meshRadii.get(), kMeshSlots, resource.handle);
+        EraseSlots(m_objectTransforms.get(), kObjectSlots, resource.handle);
+    }
+
+    void FaceCuller::OnBufferData(reshade::api::resource resource, const void* data, uint64_t size) {
+        if (size < 64 || size > kMaxObjectBufferSize) return;
+
+        const float* floats = (const float*)data;
+        size_t floatCount = (size_t)(size / sizeof(float));
+
+        for (size_t i = 0; i + 16 <= floatCount; i += 4) {
+            bool transposed = false;
+            if (!Camera::CameraController::IsViewMatrix(floats + i, &transposed)) continue;
+
+            DirectX::XMMATRIX world = DirectX::XMLoadFloat4x4((const DirectX::XMFLOAT4X4*)(floats + i));
+            if (transposed) world = DirectX::XMMatrixTranspose(world);
+
+            ObjectTransform transform;
+            DirectX::XMStoreFloat3(&transform.position, world.r[3]);
+            float sx = DirectX::XMVectorGetX(DirectX::XMVector3Length(world.r[0]));
+            float sy = DirectX::XMVectorGetX(DirectX::XMVector3Length(world.r[1]));
+            float sz = DirectX::XMVectorGetX(DirectX::XMVector3Length(world.r[2]));
+            transform.maxScale = std::max(sx, std::max(sy, sz));
+
+            bool isNew = false;
+            ObjectSlot* slot = ClaimSlot(m_objectTransforms.get(), kObjectSlots, resource.handle, isNew);
+            if (!slot) return;
+            WriteTransform(*slot, transform);
+            if (isNew) slot->key.store(resource.handle, std::memory_order_release);
+            return;
+        }
+
+        // Buffer no longer holds a world matrix
+        EraseSlots(m_objectTransforms.get(), kObjectSlots, resource.handle);
+    }
+
+    uint32_t FaceCuller::GetVisibleFaces(const Camera::CameraSnapshot& snap, bool rightHanded, uint64_t vertexBuffer, const uint64_t* constantBuffers, uint32_t constantBufferCount) {
+        const MeshSlot* mesh = FindSlot(m_meshRadii.get(), kMeshSlots, vertexBuffer);
+        if (!mesh) return AllFaces;
+        float radius = mesh->radius.load(std::memory_order_relaxed);
+
+        ObjectTransform transform = {};
+        bool hasTransform = false;
+        for (uint32_t i = 0; i < constantBufferCount && !hasTransform; ++i) {
+            const ObjectSlot* slot = FindSlot(m_objectTransforms.get(), kObjectSlots, constantBuffers[i]);
+            hasTransform = slot && ReadTransform(*slot, constantBuffers[i], transform);
+        }
+        if (!hasTransform) return AllFaces;
+
+        DirectX::XMVECTOR center = DirectX::XMVectorSet(transform.position.x, transform.position.y, transform.position.z, 1.0f);
+        float worldRadius = radius * transform.maxScale;
+
+        // The first affine matrix of a per-object buffer is as often a combined WorldView as a World
+        // matrix, and nothing in the buffer tells them apart. Read as WorldView its translation is the
+        // view-space center; the draw is kept for every face either reading can see.
+        uint32_t mask = GetFacesForSphere(snap, rightHanded, center, worldRadius);
+        if (mask == AllFaces) return mask;
+        DirectX::XMVECTOR viewCenter = DirectX::XMVector3TransformCoord(center, snap.invGameView);
+        return mask | GetFacesForSphere(snap, rightHanded, viewCenter, worldRadius);
+    }
+
+    uint32_t FaceCuller::GetFacesForSphere(const Camera::CameraSnapshot& snap, bool rightHanded, DirectX::FXMVECTOR center, float radius) {
+        // A 90 degree face frustum is bounded by the planes |x| <= z and |y| <= z in view space.
+        // Plane normals are (±1, 0, 1)/sqrt(2) and (0, ±1, 1)/sqrt(2); near/far are ignored.
+        const float invSqrt2 = 0.70710678f;
+        uint32_t mask = 0;
+        for (int face = 0; face < 6; ++face) {
+            DirectX::XMVECTOR p = DirectX::XMVector3TransformCoord(center, snap.faceViews[face]);
+            float x = DirectX::XMVectorGetX(p);
+            float y = DirectX::XMVectorGetY(p);
+            float z = DirectX::XMVectorGetZ(p);
+            if (rightHanded) z = -z; // RH views look down -Z
+
+            float limit = -radius;
+            if ((z - x) * invSqrt2 < limit) continue;
+            if ((z + x) * invSqrt2 < limit) continue;
+            if ((z - y) * invSqrt2 < limit) continue;
+            if ((z + y) * invSqrt2 < limit) continue;
+            mask |= 1u << face;
+        }
+        return mask;
+    }
+
+    template<typename Slot>
+    Slot* FaceCuller::FindSlot(Slot* table, uint32_t slotCount, uint64_t handle) {
+        if (handle == kEmptyKey || handle >= kClaimingKey) return nullptr;
+        uint32_t mask = slotCount - 1;
+        for (uint32_t i = Hash(handle) & mask, probes = 0; probes < kMaxProbes; i = (i + 1) & mask, ++probes) {
+            uint64_t key = table[i].key.load(std::memory_order_acquire);
+            if (key == handle) return &table[i];
+            if (key == kEmptyKey) break;
+        }
+        return nullptr;
+    }
+
+    template<typename Slot>
+    Slot* FaceCuller::ClaimSlot(Slot* table, uint32_t slotCount, uint64_t handle, bool& isNew) {
+        if (handle == kEmptyKey || handle >= kClaimingKey) return nullptr;
+        uint32_t mask = slotCount - 1;
+        // Another thread can take the free slot first, then the window is looked at again
+        for (int attempt = 0; attempt < 4; ++attempt) {
+            Slot* free = nullptr;
+            uint64_t freeKey = kEmptyKey;
+            for (uint32_t i = Hash(handle) & mask, probes = 0; probes < kMaxProbes; i = (i + 1) & mask, ++probes) {
+                uint64_t key = table[i].key.load(std::memory_order_acquire);
+                if (key == handle) {
+                    isNew = false;
+                    return &table[i];
+                }
+                // The handle may still sit past a tombstone, so only an empty key ends the search
+                if ((key == kTombstoneKey || key == kEmptyKey) && !free) {
+                    free = &table[i];
+                    freeKey = key;
+                }
+                if (key == kEmptyKey) break;
+            }
+            if (!free) return nullptr;
+
+            // Lookups pass over a claimed slot until the caller publishes its key
+            if (free->key.compare_exchange_strong(freeKey, kClaimingKey, std::memory_order_acquire, std::memory_order_relaxed)) {
+                isNew = true;
+                return free;
+            }
+        }
+        return nullptr;
+    }
+
+    template<typename Slot>
+    void FaceCuller::EraseSlots(Slot* table, uint32_t slotCount, uint64_t handle) {
+        if (handle == kEmptyKey || handle >= kClaimingKey) return;
+        uint32_t mask = slotCount - 1;
+        // Racing inserts of one handle can leave it in two slots, every copy goes
+        for (uint32_t i = Hash(handle) & mask, probes = 0; probes < kMaxProbes; i = (i + 1) & mask, ++probes) {
+            uint64_t key = table[i].key.load(std::memory_order_relaxed);
+            if (key == kEmptyKey) break;
+            if (key == handle) table[i].key.compare_exchange_strong(key, kTombstoneKey, std::memory_order_release, std::memory_order_relaxed);
+        }
+    }
+
+    void FaceCuller::WriteTransform(ObjectSlot& slot, const ObjectTransform& transform) {
+        // Contexts recording in parallel may update the same buffer, writers take turns
+        uint32_t sequence;
+        for (;;) {
+            sequence = slot.sequence.load(std::memory_order_relaxed);
+            if (!(sequence & 1) && slot.sequence.compare_exchange_weak(sequence, sequence + 1, std::memory_order_acquire, std::memory_order_relaxed)) break;
+            _mm_pause();
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+
+        slot.values[0].store(transform.position.x, std::memory_order_relaxed);
+        slot.values[1].store(transform.position.y, std::memory_order_relaxed);
+        slot.values[2].store(transform.position.z, std::memory_order_relaxed);
+        slot.values[3].store(transform.maxScale, std::memory_order_relaxed);
+        slot.sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    bool FaceCuller::ReadTransform(const ObjectSlot& slot, uint64_t handle, ObjectTransform& transform) {
+        // A reader that keeps losing to writers just doesn't cull this draw
+        for (int attempt = 0; attempt < 4; ++attempt) {
+            uint32_t before = slot.sequence.load(std::memory_order_acquire);
+            if (before & 1) continue;
+
+            transform.position.x = slot.values[0].load(std::memory_order_relaxed);
+            transform.position.y = slot.values[1].load(std::memory_order_relaxed);
+            transform.position.z = slot.values[2].load(std::memory_order_relaxed);
+            transform.maxScale = slot.values[3].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if (slot.sequence.load(std::memory_order_relaxed) == before) return slot.key.load(std::memory_order_acquire) == handle;
+        }
+        return false;
+    }
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <reshade.hpp>
+#include <DirectXMath.h>
+#include <atomic>
+#include <memory>
+#include "../Camera/CameraController.h"
+
+namespace Graphics {
+
+    // Decides which cube faces can see an intercepted draw.
+    // The object bound is a sphere built from two cached pieces:
+    //  - a conservative object-space radius per vertex buffer, computed once from its initial data
+    //  - the translation/scale of an affine matrix found in a per-object constant buffer bound to the VS
+    // Draws missing either piece are treated as visible from every face.
+    //
+    // Both are kept in fixed-size open-addressed tables that draws and buffer updates from any thread
+    // read and write without a lock: keys are claimed with a CAS (linear probing, bounded probe length,
+    // deleted keys leave a tombstone that a later insert reuses) and object transforms are published
+    // through a per-slot sequence counter. A full probe window just means the draw isn't culled.
+    class FaceCuller {
+    public:
+        static constexpr uint32_t AllFaces = 0x3F;
+
+        FaceCuller();
+
+        // Resource events
+        void OnInitResource(const reshade::api::resource_desc& desc, const reshade::api::subresource_data* initialData, reshade::api::resource resource);
+        void OnDestroyResource(reshade::api::resource resource);
+
+        // Constant buffer contents, from update_buffer_region or unmap
+        void OnBufferData(reshade::api::resource resource, const void* data, uint64_t size);
+
+        // Returns a bit mask of faces (bit i = Camera::CubeFace i) whose 90 degree frustum intersects the draw.
+        uint32_t GetVisibleFaces(const Camera::CameraSnapshot& snap, bool rightHanded, uint64_t vertexBuffer, const uint64_t* constantBuffers, uint32_t constantBufferCount);
+
+    private:
+        static constexpr uint32_t kMeshSlots = 1u << 15;  // Power of two
+        static constexpr uint32_t kObjectSlots = 1u << 13;
+        static constexpr uint32_t kMaxProbes = 32;
+
+        struct MeshSlot {
+            std::atomic<uint64_t> key{ 0 };
+            std::atomic<float> radius{ 0.0f };
+        };
+
+        struct ObjectTransform {
+            DirectX::XMFLOAT3 position;
+            float maxScale;
+        };
+
+        struct ObjectSlot {
+            std::atomic<uint64_t> key{ 0 };
+            std::atomic<uint32_t> sequence{ 0 }; // Odd while a writer is inside
+            std::atomic<float> values[4];        // ObjectTransform
+        };
+
+        // Slot holding handle, nullptr if none. Lookups and erases stop at an empty key or kMaxProbes.
+        template<typename Slot> static Slot* FindSlot(Slot* table, uint32_t slotCount, uint64_t handle);
+        // The existing slot of handle, or a free one claimed for it and returned still unpublished
+        // (isNew set). nullptr if the probe window is full.
+        template<typename Slot> static Slot* ClaimSlot(Slot* table, uint32_t slotCount, uint64_t handle, bool& isNew);
+        template<typename Slot> static void EraseSlots(Slot* table, uint32_t slotCount, uint64_t handle);
+
+        static void WriteTransform(ObjectSlot& slot, const ObjectTransform& transform);
+        static bool ReadTransform(const ObjectSlot& slot, uint64_t handle, ObjectTransform& transform);
+        // Faces whose frustum intersects a world-space sphere
+        static uint32_t GetFacesForSphere(const Camera::CameraSnapshot& snap, bool rightHanded, DirectX::FXMVECTOR center, float radius);
+
+        std::unique_ptr<MeshSlot[]> m_meshRadii;          // Key is vertex buffer handle
+        std::unique_ptr<ObjectSlot[]> m_objectTransforms; // Key is constant buffer handle
+    };
+}
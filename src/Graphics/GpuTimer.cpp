@@ -0,0 +1,117 @@
+#include "pch.h"
+#include "GpuTimer.h"
+#include "../Core/Logger.h"
+
+namespace Graphics {
+
+    bool GpuTimer::Initialize(ID3D11Device* device, uint32_t maxIntervalsPerFrame) {
+        Reset();
+
+        D3D11_QUERY_DESC disjointDesc = { D3D11_QUERY_TIMESTAMP_DISJOINT, 0 };
+        D3D11_QUERY_DESC timestampDesc = { D3D11_QUERY_TIMESTAMP, 0 };
+
+        for (FrameQueries& frame : m_frames) {
+            if (FAILED(device->CreateQuery(&disjointDesc, frame.disjoint.ReleaseAndGetAddressOf()))) {
+                LOG_ERROR("Failed to create timestamp disjoint query");
+                Reset();
+                return false;
+            }
+            frame.begin.resize(maxIntervalsPerFrame);
+            frame.end.resize(maxIntervalsPerFrame);
+            for (uint32_t i = 0; i < maxIntervalsPerFrame; ++i) {
+                if (FAILED(device->CreateQuery(&timestampDesc, frame.begin[i].GetAddressOf())) ||
+                    FAILED(device->CreateQuery(&timestampDesc, frame.end[i].GetAddressOf())))
+                {
+                    LOG_ERROR("Failed to create timestamp query");
+                    Reset();
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    void GpuTimer::Reset() {
+        for (FrameQueries& frame : m_frames) {
+            frame = FrameQueries();
+        }
+        m_writeFrame = 0;
+        m_readFrame = 0;
+        m_frameOpen = false;
+    }
+
+    void GpuTimer::BeginFrame(ID3D11DeviceContext* ctx) {
+        FrameQueries& frame = m_frames[m_writeFrame];
+        // All slots still waiting for the GPU, skip timing this frame
+        if (!frame.disjoint || frame.pending) return;
+
+        frame.timedIntervals = 0;
+        frame.totalIntervals = 0;
+        frame.intervalOpen = false;
+        ctx->Begin(frame.disjoint.Get());
+        m_frameOpen = true;
+    }
+
+    void GpuTimer::EndFrame(ID3D11DeviceContext* ctx) {
+        if (!m_frameOpen) return;
+
+        FrameQueries& frame = m_frames[m_writeFrame];
+        if (frame.intervalOpen) EndInterval(ctx);
+        ctx->End(frame.disjoint.Get());
+        frame.pending = true;
+        m_frameOpen = false;
+        m_writeFrame = (m_writeFrame + 1) % kFrameLatency;
+    }
+
+    void GpuTimer::BeginInterval(ID3D11DeviceContext* ctx) {
+        if (!m_frameOpen) return;
+
+        FrameQueries& frame = m_frames[m_writeFrame];
+        if (frame.intervalOpen) return;
+        frame.totalIntervals++;
+        if (frame.timedIntervals >= frame.begin.size()) return;
+
+        ctx->End(frame.begin[frame.timedIntervals].Get());
+        frame.intervalOpen = true;
+    }
+
+    void GpuTimer::EndInterval(ID3D11DeviceContext* ctx) {
+        if (!m_frameOpen) return;
+
+        FrameQueries& frame = m_frames[m_writeFrame];
+        if (!frame.intervalOpen) return;
+
+        ctx->End(frame.end[frame.timedIntervals].Get());
+        frame.timedIntervals++;
+        frame.intervalOpen = false;
+    }
+
+    bool GpuTimer::Resolve(ID3D11DeviceContext* ctx, double& milliseconds) {
+        FrameQueries& frame = m_frames[m_readFrame];
+        if (!frame.pending) return false;
+
+        D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+        if (ctx->GetData(frame.disjoint.Get(), &disjoint, sizeof(disjoint), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK) return false;
+
+        uint64_t ticks = 0;
+        for (uint32_t i = 0; i < frame.timedIntervals; ++i) {
+            UINT64 begin = 0, end = 0;
+            if (ctx->GetData(frame.begin[i].Get(), &begin, sizeof(begin), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK ||
+                ctx->GetData(frame.end[i].Get(), &end, sizeof(end), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)
+                return false;
+            if (end > begin) ticks += end - begin;
+        }
+
+        frame.pending = false;
+        m_readFrame = (m_readFrame + 1) % kFrameLatency;
+
+        // Clock changed mid-frame (power state switch), the sample is meaningless
+        if (disjoint.Disjoint || disjoint.Frequency == 0) return false;
+
+        milliseconds = (double)ticks * 1000.0 / (double)disjoint.Frequency;
+        if (frame.timedIntervals > 0 && frame.totalIntervals > frame.timedIntervals) {
+            milliseconds *= (double)frame.totalIntervals / (double)frame.timedIntervals;
+        }
+        return true;
+    }
+}
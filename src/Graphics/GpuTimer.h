@@ -0,0 +1,60 @@
+#pragma once
+#include <d3d11.h>
+#include <wrl/client.h>
+#include <vector>
+
+namespace Graphics {
+
+    // Sums the GPU time of several intervals per frame with timestamp queries.
+    // Results are read back a few frames later without stalling; intervals beyond the
+    // per-frame query budget aren't timed and are extrapolated from the timed ones.
+    class GpuTimer {
+    public:
+        bool Initialize(ID3D11Device* device, uint32_t maxIntervalsPerFrame);
+        void Reset();
+
+        // Immediate context only. BeginFrame/EndFrame bracket one frame's intervals.
+        void BeginFrame(ID3D11DeviceContext* ctx);
+        void EndFrame(ID3D11DeviceContext* ctx);
+        void BeginInterval(ID3D11DeviceContext* ctx);
+        void EndInterval(ID3D11DeviceContext* ctx);
+
+        // Polls the oldest finished frame. Returns true with its total GPU time in ms.
+        bool Resolve(ID3D11DeviceContext* ctx, double& milliseconds);
+
+        // Times a scope. A null timer makes it a no-op, for work that shouldn't be timed.
+        class Interval {
+        public:
+            Interval(GpuTimer* timer, ID3D11DeviceContext* ctx) : m_timer(timer), m_ctx(ctx) {
+                if (m_timer) m_timer->BeginInterval(m_ctx);
+            }
+            ~Interval() {
+                if (m_timer) m_timer->EndInterval(m_ctx);
+            }
+            Interval(const Interval&) = delete;
+            Interval& operator=(const Interval&) = delete;
+
+        private:
+            GpuTimer* m_timer;
+            ID3D11DeviceContext* m_ctx;
+        };
+
+    private:
+        static constexpr int kFrameLatency = 4;
+
+        struct FrameQueries {
+            Microsoft::WRL::ComPtr<ID3D11Query> disjoint;
+            std::vector<Microsoft::WRL::ComPtr<ID3D11Query>> begin;
+            std::vector<Microsoft::WRL::ComPtr<ID3D11Query>> end;
+            uint32_t timedIntervals = 0;
+            uint32_t totalIntervals = 0;
+            bool intervalOpen = false;
+            bool pending = false; // Ended, waiting for results
+        };
+
+        FrameQueries m_frames[kFrameLatency];
+        int m_writeFrame = 0;
+        int m_readFrame = 0;
+        bool m_frameOpen = false;
+    };
+}
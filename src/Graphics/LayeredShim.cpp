@@ -0,0 +1,228 @@
+#include "pch.h"
+#include "LayeredShim.h"
+#include "../Core/Logger.h"
+#include <d3d11shader.h>
+
+namespace Graphics {
+
+    // Slot keys besides shader handles, which are object pointers and never take these values
+    static const uint64_t kEmptyKey = 0;
+    static const uint64_t kTombstoneKey = ~0ull;
+
+    static uint32_t Hash(uint64_t handle) {
+        // Handles are object pointers, the low bits carry little entropy
+        handle ^= handle >> 33;
+        handle *= 0xff51afd7ed558ccdull;
+        handle ^= handle >> 33;
+        return (uint32_t)handle;
+    }
+
+    LayeredShimCache::LayeredShimCache() : m_table(std::make_unique<ShimSlot[]>(kTableSize)) {}
+
+    void LayeredShimCache::OnInitPipeline(reshade::api::device* device, reshade::api::pipeline pipeline, uint32_t subobject_count, const reshade::api::pipeline_subobject* subobjects) {
+        ID3D11Device* nativeDevice = device ? (ID3D11Device*)device->get_native() : nullptr;
+        if (!nativeDevice) return;
+
+        for (uint32_t i = 0; i < subobject_count; ++i) {
+            if (subobjects[i].type != reshade::api::pipeline_subobject_type::vertex_shader || !subobjects[i].data) continue;
+            const auto* desc = (const reshade::api::shader_desc*)subobjects[i].data;
+            RegisterVertexShader(nativeDevice, pipeline.handle, desc->code, desc->code_size);
+        }
+    }
+
+    void LayeredShimCache::OnDestroyPipeline(reshade::api::pipeline pipeline) {
+        // The signature entry stays alive so the GS pointer handed out earlier remains valid
+        if (pipeline.handle == kEmptyKey || pipeline.handle == kTombstoneKey) return;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        uint32_t mask = kTableSize - 1;
+        for (uint32_t i = Hash(pipeline.handle) & mask, probes = 0; probes < kMaxProbes; i = (i + 1) & mask, ++probes) {
+            uint64_t key = m_table[i].shader.load(std::memory_order_relaxed);
+            if (key == kEmptyKey) break;
+            if (key == pipeline.handle) {
+                m_table[i].shader.store(kTombstoneKey, std::memory_order_release);
+                break;
+            }
+        }
+    }
+
+    void LayeredShimCache::RegisterVertexShader(ID3D11Device* device, uint64_t shaderHandle, const void* code, size_t codeSize) {
+        if (!shaderHandle || shaderHandle == kTombstoneKey || !code || codeSize == 0) return;
+
+        Microsoft::WRL::ComPtr<ID3D11ShaderReflection> reflection;
+        if (FAILED(D3DReflect(code, codeSize, __uuidof(ID3D11ShaderReflection), (void**)reflection.GetAddressOf()))) return;
+
+        D3D11_SHADER_DESC desc = {};
+        if (FAILED(reflection->GetDesc(&desc))) return;
+
+        std::vector<OutputElement> elements;
+        elements.reserve(desc.OutputParameters);
+        std::string key;
+
+        for (UINT i = 0; i < desc.OutputParameters; ++i) {
+            D3D11_SIGNATURE_PARAMETER_DESC param = {};
+            if (FAILED(reflection->GetOutputParameterDesc(i, &param))) return;
+
+            OutputElement element = { param.SemanticName, param.SemanticIndex, param.Register, (UINT)param.SystemValueType, (UINT)param.ComponentType, param.Mask };
+            key += element.semantic + "|" + std::to_string(element.semanticIndex) + "|" + std::to_string(element.reg) + "|" +
+                   std::to_string(element.systemValue) + "|" + std::to_string(element.componentType) + "|" + std::to_string(element.mask) + ";";
+            elements.push_back(std::move(element));
+        }
+
+        std::shared_ptr<ShimEntry> entry;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto& shared = m_bySignature[key];
+            if (!shared) {
+                shared = std::make_shared<ShimEntry>();
+                shared->elements = std::move(elements);
+            }
+            entry = shared;
+        }
+
+        // Shader creation is already a load-time cost, and most signatures repeat, so only the first
+        // shader of a signature compiles. Other registrations don't wait on it unless they share it.
+        std::call_once(entry->compiled, [&] { entry->failed = !Compile(device, *entry); });
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Publish(shaderHandle, entry->failed ? nullptr : entry->shader.Get());
+    }
+
+    void LayeredShimCache::Publish(uint64_t shaderHandle, ID3D11GeometryShader* shim) {
+        uint32_t mask = kTableSize - 1;
+        ShimSlot* free = nullptr;
+        for (uint32_t i = Hash(shaderHandle) & mask, probes = 0; probes < kMaxProbes; i = (i + 1) & mask, ++probes) {
+            uint64_t key = m_table[i].shader.load(std::memory_order_relaxed);
+            if (key == shaderHandle) {
+                // Registered again, e.g. a new shader at the address of a destroyed one
+                m_table[i].shim.store(shim, std::memory_order_release);
+                return;
+            }
+            if (key == kTombstoneKey && !free) free = &m_table[i];
+            if (key == kEmptyKey) {
+                if (!free) free = &m_table[i];
+                break;
+            }
+        }
+        if (!free) {
+            LOG_ONCE(WARNING, "Layered shim table is full, new vertex shaders use the per-face path");
+            return;
+        }
+
+        // The shim is stored first, a lookup that sees the key sees its shim
+        free->shim.store(shim, std::memory_order_relaxed);
+        free->shader.store(shaderHandle, std::memory_order_release);
+    }
+
+    ID3D11GeometryShader* LayeredShimCache::GetShim(uint64_t shaderHandle) const {
+        if (shaderHandle == kEmptyKey || shaderHandle == kTombstoneKey) return nullptr;
+        uint32_t mask = kTableSize - 1;
+        for (uint32_t i = Hash(shaderHandle) & mask, probes = 0; probes < kMaxProbes; i = (i + 1) & mask, ++probes) {
+            uint64_t key = m_table[i].shader.load(std::memory_order_acquire);
+            if (key == shaderHandle) return m_table[i].shim.load(std::memory_order_acquire);
+            if (key == kEmptyKey) break;
+        }
+        return nullptr;
+    }
+
+    std::string LayeredShimCache::GenerateSource(const std::vector<OutputElement>& elements) {
+        std::string members;
+        std::string copies;
+
+        for (size_t i = 0; i < elements.size(); ++i) {
+            const OutputElement& e = elements[i];
+
+            const char* type = nullptr;
+            switch (e.componentType) {
+                case D3D_REGISTER_COMPONENT_FLOAT32: type = "float"; break;
+                case D3D_REGISTER_COMPONENT_UINT32:  type = "uint"; break;
+                case D3D_REGISTER_COMPONENT_SINT32:  type = "int"; break;
+                default: return {};
+            }
+
+            int components = 0;
+            for (int bit = 0; bit < 4; ++bit) if (e.mask & (1 << bit)) ++components;
+            if (components == 0) return {};
+
+            std::string name = "m" + std::to_string(i);
+            std::string semantic = e.semanticIndex ? e.semantic + std::to_string(e.semanticIndex) : e.semantic;
+            members += "    " + std::string(type) + (components > 1 ? std::to_string(components) : "") + " " + name + " : " + semantic + ";\n";
+
+            if (e.systemValue == D3D_NAME_POSITION) {
+                copies += "        o." + name + " = mul(input[i]." + name + ", g_FaceClip[face]);\n";
+            } else {
+                copies += "        o." + name + " = input[i]." + name + ";\n";
+            }
+        }
+
+        return
+            "cbuffer WideCaptureFaces : register(b0) { row_major float4x4 g_FaceClip[6]; uint g_FaceMask; };\n"
+            "struct VSOut {\n" + members + "};\n"
+            "struct GSOut {\n" + members + "    uint rtIndex : SV_RenderTargetArrayIndex;\n    uint vpIndex : SV_ViewportArrayIndex;\n};\n"
+            "[maxvertexcount(3)]\n"
+            "[instance(6)]\n"
+            "void main(triangle VSOut input[3], uint face : SV_GSInstanceID, inout TriangleStream<GSOut> output) {\n"
+            "    if (!(g_FaceMask & (1u << face))) return;\n"
+            "    [unroll] for (uint i = 0; i < 3; ++i) {\n"
+            "        GSOut o;\n" + copies +
+            "        o.rtIndex = face;\n"
+            "        o.vpIndex = face;\n"
+            "        output.Append(o);\n"
+            "    }\n"
+            "}\n";
+    }
+
+    bool LayeredShimCache::VerifySignature(const std::vector<OutputElement>& elements, ID3DBlob* gsBlob) {
+        // The pixel shader was linked against the game VS, so every element must land in the same register and mask
+        Microsoft::WRL::ComPtr<ID3D11ShaderReflection> reflection;
+        if (FAILED(D3DReflect(gsBlob->GetBufferPointer(), gsBlob->GetBufferSize(), __uuidof(ID3D11ShaderReflection), (void**)reflection.GetAddressOf()))) return false;
+
+        D3D11_SHADER_DESC desc = {};
+        if (FAILED(reflection->GetDesc(&desc))) return false;
+
+        for (const OutputElement& e : elements) {
+            bool matched = false;
+            for (UINT i = 0; i < desc.OutputParameters && !matched; ++i) {
+                D3D11_SIGNATURE_PARAMETER_DESC param = {};
+                if (FAILED(reflection->GetOutputParameterDesc(i, &param))) return false;
+                matched = _stricmp(param.SemanticName, e.semantic.c_str()) == 0 && param.SemanticIndex == e.semanticIndex &&
+                          param.Register == e.reg && param.Mask == e.mask;
+            }
+            if (!matched) return false;
+        }
+        return true;
+    }
+
+    bool LayeredShimCache::Compile(ID3D11Device* device, ShimEntry& entry) {
+        bool hasPosition = false;
+        for (const OutputElement& e : entry.elements) {
+            // Shaders that already route layers or viewports can't be wrapped
+            if (e.systemValue == D3D_NAME_RENDER_TARGET_ARRAY_INDEX || e.systemValue == D3D_NAME_VIEWPORT_ARRAY_INDEX) return false;
+            if (e.systemValue == D3D_NAME_POSITION) hasPosition = (e.mask == 0xF && e.componentType == D3D_REGISTER_COMPONENT_FLOAT32);
+        }
+        if (!hasPosition) return false;
+
+        std::string source = GenerateSource(entry.elements);
+        if (source.empty()) return false;
+
+        Microsoft::WRL::ComPtr<ID3DBlob> blob;
+        Microsoft::WRL::ComPtr<ID3DBlob> errors;
+        HRESULT hr = D3DCompile(source.data(), source.size(), "WideCaptureLayeredGS", nullptr, nullptr, "main", "gs_5_0",
+                                D3DCOMPILE_OPTIMIZATION_LEVEL3, 0, blob.GetAddressOf(), errors.GetAddressOf());
+        if (FAILED(hr)) {
+            LOG_WARNING("Layered GS compilation failed: ", errors ? (const char*)errors->GetBufferPointer() : "unknown error");
+            return false;
+        }
+
+        if (!VerifySignature(entry.elements, blob.Get())) {
+            LOG_WARNING("Layered GS signature does not match vertex shader output, using per-face path");
+            return false;
+        }
+
+        if (FAILED(device->CreateGeometryShader(blob->GetBufferPointer(), blob->GetBufferSize(), nullptr, entry.shader.GetAddressOf()))) {
+            LOG_ERROR("Failed to create layered geometry shader");
+            return false;
+        }
+
+        return true;
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <reshade.hpp>
+#include <d3d11.h>
+#include <wrl/client.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Graphics {
+
+    // Builds pass-through geometry shaders that replicate a game draw into all six cube faces.
+    // The shim matches the output signature of a game vertex shader, re-projects SV_Position from
+    // game clip space into each face's clip space and routes the copy with SV_RenderTargetArrayIndex.
+    // SV_ViewportArrayIndex selects the face's viewport, so faces can render into sub-rects of their slice.
+    // Shims are compiled when the game creates its vertex shader (once per distinct signature) and the
+    // draw path finds them in a lock-free table.
+    class LayeredShimCache {
+    public:
+        // Constant buffer layout expected by every shim at GS slot b0
+        struct FaceTransforms {
+            float clip[6][16]; // Row-major game clip -> face clip transforms
+            uint32_t faceMask; // Bit i set: face i is drawn
+            uint32_t padding[3];
+        };
+
+        LayeredShimCache();
+
+        // Pipeline events. In D3D11 every vertex shader object is its own pipeline handle.
+        void OnInitPipeline(reshade::api::device* device, reshade::api::pipeline pipeline, uint32_t subobject_count, const reshade::api::pipeline_subobject* subobjects);
+        void OnDestroyPipeline(reshade::api::pipeline pipeline);
+
+        // Returns the shim built for a vertex shader. Lock-free, never compiles.
+        // Returns nullptr if the shader is unknown or its signature can't be wrapped.
+        ID3D11GeometryShader* GetShim(uint64_t shaderHandle) const;
+
+    private:
+        struct OutputElement {
+            std::string semantic;
+            UINT semanticIndex;
+            UINT reg;
+            UINT systemValue;
+            UINT componentType;
+            BYTE mask;
+        };
+
+        struct ShimEntry {
+            std::vector<OutputElement> elements;
+            Microsoft::WRL::ComPtr<ID3D11GeometryShader> shader;
+            std::once_flag compiled; // Shaders created in parallel with one signature wait for one compile
+            bool failed = false;
+        };
+
+        // Shader handle -> shim. Written only with m_mutex held (linear probing, bounded probe length,
+        // erased keys become tombstones that later inserts reuse), read without it.
+        static constexpr uint32_t kTableSize = 1u << 15; // Power of two
+        static constexpr uint32_t kMaxProbes = 32;
+        struct ShimSlot {
+            std::atomic<uint64_t> shader{ 0 };
+            std::atomic<ID3D11GeometryShader*> shim{ nullptr };
+        };
+
+        // Records the output signature of a newly created vertex shader and builds its shim
+        void RegisterVertexShader(ID3D11Device* device, uint64_t shaderHandle, const void* code, size_t codeSize);
+        // m_mutex held
+        void Publish(uint64_t shaderHandle, ID3D11GeometryShader* shim);
+
+        static std::string GenerateSource(const std::vector<OutputElement>& elements);
+        static bool VerifySignature(const std::vector<OutputElement>& elements, ID3DBlob* gsBlob);
+        static bool Compile(ID3D11Device* device, ShimEntry& entry);
+
+        std::mutex m_mutex;
+        std::unique_ptr<ShimSlot[]> m_table;
+        std::map<std::string, std::shared_ptr<ShimEntry>> m_bySignature; // Shaders with identical outputs share a shim
+    };
+}
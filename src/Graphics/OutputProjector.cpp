@@ -0,0 +1,270 @@
+#include "pch.h"
+#include "OutputProjector.h"
+#include "StateBlock.h"
+#include "../Compute/ShaderCompiler.h"
+#include "../Core/Logger.h"
+
+using Microsoft::WRL::ComPtr;
+
+namespace Graphics {
+
+    bool OutputProjector::Initialize(ID3D11Device* device, const Settings& settings) {
+        Reset();
+        m_settings = settings;
+
+        D3D11_SAMPLER_DESC sampDesc = {};
+        sampDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+        sampDesc.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
+        sampDesc.AddressV = D3D11_TEXTURE_ADDRESS_CLAMP;
+        sampDesc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+        if (FAILED(device->CreateSamplerState(&sampDesc, m_linearSampler.GetAddressOf()))) {
+            LOG_ERROR("Failed to create the projection sampler");
+            return false;
+        }
+
+        // Optional baked face+UV per output pixel, replaces the per-pixel trig in the projection kernels
+        if (settings.directionLut && !BuildDirectionLut(device)) m_lutSrv.Reset();
+
+        // Preferred path: one compute pass projects the cube and writes both NV12 planes through UAVs
+        m_fused = InitFused(device);
+        if (!m_fused) {
+            LOG_WARNING("NV12 UAVs unavailable, using separate projection and conversion passes");
+            if (!InitSeparate(device)) return false;
+        }
+        return true;
+    }
+
+    void OutputProjector::Reset() {
+        m_lutSrv.Reset();
+        m_equirectUav.Reset();
+        m_equirectSrv.Reset();
+        m_surfaceViews.clear();
+        m_projectionShader.Reset();
+        m_convertVS.Reset();
+        m_convertPS_Y.Reset();
+        m_convertPS_UV.Reset();
+        m_linearSampler.Reset();
+        m_fused = false;
+        m_settings = {};
+    }
+
+    std::vector<D3D_SHADER_MACRO> OutputProjector::GetDefines(bool useLut) const {
+        std::vector<D3D_SHADER_MACRO> defines = { { "PROJECTION", Compute::GetProjectionDefine(m_settings.projection) } };
+        if (useLut) defines.push_back({ "USE_DIRECTION_LUT", "1" });
+        if (m_settings.faceSubRects) defines.push_back({ "FACE_SUBRECTS", "1" });
+        defines.push_back({ nullptr, nullptr });
+        return defines;
+    }
+
+    bool OutputProjector::BuildDirectionLut(ID3D11Device* device) {
+        D3D11_TEXTURE2D_DESC desc = {};
+        desc.Width = m_settings.width;
+        desc.Height = m_settings.height;
+        desc.MipLevels = 1;
+        desc.ArraySize = 1;
+        desc.Format = DXGI_FORMAT_R32_UINT;
+        desc.SampleDesc.Count = 1;
+        desc.BindFlags = D3D11_BIND_UNORDERED_ACCESS | D3D11_BIND_SHADER_RESOURCE;
+
+        // Baked once per output size, only the SRV is kept
+        ComPtr<ID3D11Texture2D> lut;
+        ComPtr<ID3D11UnorderedAccessView> lutUav;
+        if (FAILED(device->CreateTexture2D(&desc, nullptr, lut.GetAddressOf())) ||
+            FAILED(device->CreateUnorderedAccessView(lut.Get(), nullptr, lutUav.GetAddressOf())) ||
+            FAILED(device->CreateShaderResourceView(lut.Get(), nullptr, m_lutSrv.GetAddressOf())))
+            return false;
+
+        ComPtr<ID3D11ComputeShader> lutShader;
+        std::vector<D3D_SHADER_MACRO> defines = GetDefines(false);
+        if (FAILED(Compute::ShaderCompiler::CreateComputeShader(device, "ProjectionLUT.hlsl", "main", lutShader.GetAddressOf(), defines.data()))) {
+            LOG_ERROR("Failed to compile ProjectionLUT, using per-pixel directions");
+            return false;
+        }
+
+        ComPtr<ID3D11DeviceContext> ctx;
+        device->GetImmediateContext(ctx.GetAddressOf());
+        StateBlock<State::CS> state(ctx.Get());
+
+        ctx->CSSetShader(lutShader.Get(), nullptr, 0);
+        ctx->CSSetUnorderedAccessViews(0, 1, lutUav.GetAddressOf(), nullptr);
+        ctx->Dispatch((m_settings.width + 15) / 16, (m_settings.height + 15) / 16, 1);
+
+        ID3D11UnorderedAccessView* nullUAV[] = { nullptr };
+        ctx->CSSetUnorderedAccessViews(0, 1, nullUAV, nullptr);
+
+        LOG_INFO("Built projection direction LUT ", m_settings.width, "x", m_settings.height);
+        return true;
+    }
+
+    bool OutputProjector::InitFused(ID3D11Device* device) {
+        // The encoder only binds its pool for UAVs when the device supports typed UAVs on NV12
+        if (!(m_settings.surfaceBindFlags & D3D11_BIND_UNORDERED_ACCESS)) return false;
+
+        std::vector<D3D_SHADER_MACRO> defines = GetDefines(UsesDirectionLut());
+        if (FAILED(Compute::ShaderCompiler::CreateComputeShader(device, "ColorConvert.hlsl", "main", m_projectionShader.GetAddressOf(), defines.data()))) {
+            m_projectionShader.Reset();
+            return false;
+        }
+        return true;
+    }
+
+    bool OutputProjector::InitSeparate(ID3D11Device* device) {
+        // The NV12 targets are the encoder's surfaces, see GetSurfaceViews
+        if (!(m_settings.surfaceBindFlags & D3D11_BIND_RENDER_TARGET)) {
+            LOG_ERROR("Encoder surfaces can't be rendered to");
+            return false;
+        }
+
+        D3D11_TEXTURE2D_DESC desc = {};
+        desc.Width = m_settings.width;
+        desc.Height = m_settings.height;
+        desc.MipLevels = 1;
+        desc.ArraySize = 1;
+        desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+        desc.SampleDesc.Count = 1;
+        desc.BindFlags = D3D11_BIND_UNORDERED_ACCESS | D3D11_BIND_SHADER_RESOURCE;
+        ComPtr<ID3D11Texture2D> equirect;
+        if (FAILED(device->CreateTexture2D(&desc, nullptr, equirect.GetAddressOf())) ||
+            FAILED(device->CreateUnorderedAccessView(equirect.Get(), nullptr, m_equirectUav.GetAddressOf())) ||
+            FAILED(device->CreateShaderResourceView(equirect.Get(), nullptr, m_equirectSrv.GetAddressOf())))
+        {
+            LOG_ERROR("Failed to create the equirect texture");
+            return false;
+        }
+
+        std::vector<D3D_SHADER_MACRO> defines = GetDefines(UsesDirectionLut());
+        if (FAILED(Compute::ShaderCompiler::CreateComputeShader(device, "ProjectionShader.hlsl", "main", m_projectionShader.GetAddressOf(), defines.data())) ||
+            FAILED(Compute::ShaderCompiler::CreateVertexShader(device, "RGBToNV12.hlsl", "VS", m_convertVS.GetAddressOf())) ||
+            FAILED(Compute::ShaderCompiler::CreatePixelShader(device, "RGBToNV12.hlsl", "PS_Y", m_convertPS_Y.GetAddressOf())) ||
+            FAILED(Compute::ShaderCompiler::CreatePixelShader(device, "RGBToNV12.hlsl", "PS_UV", m_convertPS_UV.GetAddressOf())))
+        {
+            LOG_ERROR("Failed to create the projection and NV12 conversion shaders");
+            return false;
+        }
+        return true;
+    }
+
+    OutputProjector::SurfaceViews* OutputProjector::GetSurfaceViews(const Video::EncoderSurface& surface) {
+        if (!surface.texture) return nullptr;
+
+        // The pool hands out the same few surfaces over and over (slices of one array for FFmpeg,
+        // separate textures for the native backends), views only need creating once per surface
+        for (SurfaceViews& views : m_surfaceViews) {
+            if (views.texture.Get() == surface.texture && views.arraySlice == surface.arraySlice) return &views;
+        }
+        // Left over from an earlier encoder's pool
+        if (m_surfaceViews.size() >= kMaxSurfaceViews) m_surfaceViews.clear();
+        m_surfaceViews.emplace_back();
+        SurfaceViews& views = m_surfaceViews.back();
+        ComPtr<ID3D11Device> device;
+        surface.texture->GetDevice(device.GetAddressOf());
+
+        // R8 selects the luma plane and R8G8 the half-size chroma plane of the slice
+        bool ok = true;
+        if (m_fused) {
+            D3D11_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+            uavDesc.ViewDimension = D3D11_UAV_DIMENSION_TEXTURE2DARRAY;
+            uavDesc.Texture2DArray.FirstArraySlice = surface.arraySlice;
+            uavDesc.Texture2DArray.ArraySize = 1;
+            uavDesc.Format = DXGI_FORMAT_R8_UNORM;
+            ok = SUCCEEDED(device->CreateUnorderedAccessView(surface.texture, &uavDesc, views.yUav.GetAddressOf()));
+            uavDesc.Format = DXGI_FORMAT_R8G8_UNORM;
+            ok = ok && SUCCEEDED(device->CreateUnorderedAccessView(surface.texture, &uavDesc, views.uvUav.GetAddressOf()));
+        } else {
+            D3D11_RENDER_TARGET_VIEW_DESC rtvDesc = {};
+            rtvDesc.ViewDimension = D3D11_RTV_DIMENSION_TEXTURE2DARRAY;
+            rtvDesc.Texture2DArray.FirstArraySlice = surface.arraySlice;
+            rtvDesc.Texture2DArray.ArraySize = 1;
+            rtvDesc.Format = DXGI_FORMAT_R8_UNORM;
+            ok = SUCCEEDED(device->CreateRenderTargetView(surface.texture, &rtvDesc, views.yRtv.GetAddressOf()));
+            rtvDesc.Format = DXGI_FORMAT_R8G8_UNORM;
+            ok = ok && SUCCEEDED(device->CreateRenderTargetView(surface.texture, &rtvDesc, views.uvRtv.GetAddressOf()));
+        }
+
+        if (!ok) {
+            LOG_FIRST_N(ERROR, 5, "Failed to create views for encoder surface ", surface.arraySlice);
+            m_surfaceViews.pop_back();
+            return nullptr;
+        }
+        views.texture = surface.texture;
+        views.arraySlice = surface.arraySlice;
+        return &views;
+    }
+
+    bool OutputProjector::Project(ID3D11DeviceContext* ctx, ID3D11ShaderResourceView* cube, ID3D11ShaderResourceView* cubeArray,
+                                  ID3D11Buffer* faceRects, const Video::EncoderSurface& surface,
+                                  GpuTimer* projectionTimer, GpuTimer* convertTimer) {
+        SurfaceViews* views = GetSurfaceViews(surface);
+        if (!views) return false;
+
+        UINT width = m_settings.width;
+        UINT height = m_settings.height;
+
+        ctx->CSSetShader(m_projectionShader.Get(), nullptr, 0);
+        ctx->CSSetConstantBuffers(0, 1, &faceRects);
+        ID3D11ShaderResourceView* srvs[] = { cube, m_lutSrv.Get(), cubeArray };
+        ctx->CSSetShaderResources(0, 3, srvs);
+        ctx->CSSetSamplers(0, 1, m_linearSampler.GetAddressOf());
+
+        if (m_fused) {
+            ID3D11UnorderedAccessView* uavs[] = { views->yUav.Get(), views->uvUav.Get() };
+            ctx->CSSetUnorderedAccessViews(0, 2, uavs, nullptr);
+
+            // One thread per 2x2 block
+            {
+                GpuTimer::Interval timing(projectionTimer, ctx);
+                ctx->Dispatch((width / 2 + 15) / 16, (height / 2 + 15) / 16, 1);
+            }
+
+            ID3D11UnorderedAccessView* nullUAVs[] = { nullptr, nullptr };
+            ctx->CSSetUnorderedAccessViews(0, 2, nullUAVs, nullptr);
+            ID3D11ShaderResourceView* nullSRVs[] = { nullptr, nullptr, nullptr };
+            ctx->CSSetShaderResources(0, 3, nullSRVs);
+            return true;
+        }
+
+        ctx->CSSetUnorderedAccessViews(0, 1, m_equirectUav.GetAddressOf(), nullptr);
+        {
+            GpuTimer::Interval timing(projectionTimer, ctx);
+            ctx->Dispatch((width + 15) / 16, (height + 15) / 16, 1);
+        }
+
+        ID3D11UnorderedAccessView* nullUAV[] = { nullptr };
+        ctx->CSSetUnorderedAccessViews(0, 1, nullUAV, nullptr);
+        ID3D11ShaderResourceView* nullSRVs[] = { nullptr, nullptr, nullptr };
+        ctx->CSSetShaderResources(0, 3, nullSRVs);
+
+        // Convert to NV12: a full-screen triangle per plane with the equirect texture as input
+        ctx->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+        ctx->VSSetShader(m_convertVS.Get(), nullptr, 0);
+        ctx->PSSetShaderResources(0, 1, m_equirectSrv.GetAddressOf());
+        ctx->PSSetSamplers(0, 1, m_linearSampler.GetAddressOf());
+
+        D3D11_VIEWPORT vp = {};
+        vp.Width = (float)width;
+        vp.Height = (float)height;
+        vp.MaxDepth = 1.0f;
+        {
+            GpuTimer::Interval timing(convertTimer, ctx);
+            // Y pass
+            ctx->RSSetViewports(1, &vp);
+            ctx->OMSetRenderTargets(1, views->yRtv.GetAddressOf(), nullptr);
+            ctx->PSSetShader(m_convertPS_Y.Get(), nullptr, 0);
+            ctx->Draw(3, 0);
+
+            // UV pass
+            vp.Width = (float)width / 2.0f;
+            vp.Height = (float)height / 2.0f;
+            ctx->RSSetViewports(1, &vp);
+            ctx->OMSetRenderTargets(1, views->uvRtv.GetAddressOf(), nullptr);
+            ctx->PSSetShader(m_convertPS_UV.Get(), nullptr, 0);
+            ctx->Draw(3, 0);
+        }
+
+        // The surface goes to the encoder thread next, it must not stay bound until the caller restores state
+        ctx->OMSetRenderTargets(0, nullptr, nullptr);
+        ID3D11ShaderResourceView* nullSRV = nullptr;
+        ctx->PSSetShaderResources(0, 1, &nullSRV);
+        return true;
+    }
+}
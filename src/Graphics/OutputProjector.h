@@ -0,0 +1,79 @@
+#pragma once
+#include <d3d11.h>
+#include <wrl/client.h>
+#include <vector>
+#include "../Compute/Projection.h"
+#include "../Video/Encoder.h"
+#include "GpuTimer.h"
+
+namespace Graphics {
+
+    // Projection and NV12 conversion of the finished cube, straight into an encoder's pool surfaces.
+    // The fused path needs surfaces with UAV binding; the separate path projects into an RGBA equirect
+    // texture and converts it into the surfaces' render targets with two raster passes.
+    // Plain D3D11, so CubemapManager and the bench run the same passes.
+    class OutputProjector {
+    public:
+        struct Settings {
+            Compute::ProjectionType projection = Compute::ProjectionType::Equirectangular;
+            uint32_t width = 0; // Output size, see Compute::GetOutputSize
+            uint32_t height = 0;
+            bool directionLut = false; // Bake the output pixel -> cube face/UV table (Config::ProjectionLUT)
+            bool faceSubRects = false; // Faces only fill part of their slice, sampled through g_FaceUV
+            UINT surfaceBindFlags = 0; // Encoder::GetSurfaceBindFlags of the surfaces written
+        };
+
+        bool Initialize(ID3D11Device* device, const Settings& settings);
+        void Reset();
+
+        // Writes the cube (cube as TextureCube, cubeArray as Texture2DArray of the same slices) into
+        // surface. Leaves CS, IA, VS, PS, PS SRV/sampler, RS viewport and OM state changed, callers save
+        // what they need. faceRects holds g_FaceUV, only read with faceSubRects. Returns false, with
+        // nothing written, if the surface's views can't be created.
+        bool Project(ID3D11DeviceContext* ctx, ID3D11ShaderResourceView* cube, ID3D11ShaderResourceView* cubeArray,
+                     ID3D11Buffer* faceRects, const Video::EncoderSurface& surface,
+                     GpuTimer* projectionTimer = nullptr, GpuTimer* convertTimer = nullptr);
+
+        bool IsFused() const { return m_fused; }
+        bool UsesDirectionLut() const { return m_lutSrv != nullptr; }
+        uint32_t GetWidth() const { return m_settings.width; }
+        uint32_t GetHeight() const { return m_settings.height; }
+
+    private:
+        // PROJECTION (plus USE_DIRECTION_LUT, FACE_SUBRECTS) for the projection kernels, nullptr-terminated
+        std::vector<D3D_SHADER_MACRO> GetDefines(bool useLut) const;
+        bool BuildDirectionLut(ID3D11Device* device);
+        bool InitFused(ID3D11Device* device);
+        bool InitSeparate(ID3D11Device* device);
+
+        // Y/UV views of an encoder surface, cached per pool array slice. nullptr if they can't be created.
+        struct SurfaceViews {
+            Microsoft::WRL::ComPtr<ID3D11Texture2D> texture; // Pool texture and slice the views were created for
+            UINT arraySlice = 0;
+            Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> yUav;
+            Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> uvUav;
+            Microsoft::WRL::ComPtr<ID3D11RenderTargetView> yRtv;
+            Microsoft::WRL::ComPtr<ID3D11RenderTargetView> uvRtv;
+        };
+        SurfaceViews* GetSurfaceViews(const Video::EncoderSurface& surface);
+
+        Settings m_settings;
+        bool m_fused = false;
+
+        // Direction LUT, sampled together with the plain texture_2d_array view of the cube
+        Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_lutSrv;
+
+        // Intermediate RGBA equirect, only used when the fused kernel isn't available
+        Microsoft::WRL::ComPtr<ID3D11UnorderedAccessView> m_equirectUav;
+        Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_equirectSrv;
+
+        static constexpr size_t kMaxSurfaceViews = 32; // Above any encoder's pool size
+        std::vector<SurfaceViews> m_surfaceViews; // One per pool surface seen, see GetSurfaceViews
+
+        Microsoft::WRL::ComPtr<ID3D11ComputeShader> m_projectionShader; // ColorConvert.hlsl when fused
+        Microsoft::WRL::ComPtr<ID3D11VertexShader> m_convertVS;
+        Microsoft::WRL::ComPtr<ID3D11PixelShader> m_convertPS_Y;
+        Microsoft::WRL::ComPtr<ID3D11PixelShader> m_convertPS_UV;
+        Microsoft::WRL::ComPtr<ID3D11SamplerState> m_linearSampler;
+    };
+}
@@ -1,58 +1,209 @@
 #pragma once
 #include <d3d11.h>
 #include <wrl/client.h>
+#include "../Core/Profiler.h"
+#include <cstdint>
+#include <type_traits>
 
 namespace Graphics {
     using Microsoft::WRL::ComPtr;
 
+    // State categories a StateBlock can capture. Callers declare what they are going to touch,
+    // e.g. StateBlock<State::VS_CB | State::OM_RT>, and everything else is left alone.
+    namespace State {
+        enum : uint32_t {
+            IA         = 1 << 0,  // Input layout, topology, index and vertex buffers
+            RS_STATE   = 1 << 1,  // Rasterizer state
+            RS_VP      = 1 << 2,  // Viewports and scissor rects
+            VS         = 1 << 3,  // Vertex shader
+            VS_CB      = 1 << 4,  // VS constant buffers
+            GS         = 1 << 5,  // Geometry shader and its constant buffers
+            PS         = 1 << 6,  // Pixel shader
+            PS_CB      = 1 << 7,
+            PS_SRV     = 1 << 8,
+            PS_SAMPLER = 1 << 9,
+            OM_RT      = 1 << 10, // Render targets and depth stencil view
+            OM_STATE   = 1 << 11, // Blend and depth stencil state
+            CS         = 1 << 12, // Compute shader with its CBs, SRVs, UAVs and samplers
+
+            All = (1 << 13) - 1
+        };
+    }
+
+    namespace Detail {
+        struct NoState {
+            void Capture(ID3D11DeviceContext*) {}
+            void Restore(ID3D11DeviceContext*) {}
+        };
+
+        struct IAState {
+            ComPtr<ID3D11InputLayout> inputLayout;
+            D3D11_PRIMITIVE_TOPOLOGY topology;
+            ComPtr<ID3D11Buffer> indexBuffer;
+            DXGI_FORMAT indexBufferFormat;
+            UINT indexBufferOffset;
+            ComPtr<ID3D11Buffer> vertexBuffers[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+            UINT vertexStrides[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+            UINT vertexOffsets[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+            void Capture(ID3D11DeviceContext* ctx);
+            void Restore(ID3D11DeviceContext* ctx);
+        };
+
+        struct RSState {
+            ComPtr<ID3D11RasterizerState> rasterizerState;
+            void Capture(ID3D11DeviceContext* ctx);
+            void Restore(ID3D11DeviceContext* ctx);
+        };
+
+        struct ViewportState {
+            D3D11_VIEWPORT viewports[D3D11_VIEWPORT_AND_SCISSORRECT_OBJECT_COUNT_PER_PIPELINE];
+            UINT numViewports;
+            D3D11_RECT scissorRects[D3D11_VIEWPORT_AND_SCISSORRECT_OBJECT_COUNT_PER_PIPELINE];
+            UINT numScissorRects;
+            void Capture(ID3D11DeviceContext* ctx);
+            void Restore(ID3D11DeviceContext* ctx);
+        };
+
+        struct VSState {
+            ComPtr<ID3D11VertexShader> vertexShader;
+            void Capture(ID3D11DeviceContext* ctx);
+            void Restore(ID3D11DeviceContext* ctx);
+        };
+
+        struct VSConstantBufferState {
+            ComPtr<ID3D11Buffer> constantBuffers[D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT];
+            void Capture(ID3D11DeviceContext* ctx);
+            void Restore(ID3D11DeviceContext* ctx);
+        };
+
+        // Layered rendering binds its own GS
+        struct GSState {
+            ComPtr<ID3D11GeometryShader> geometryShader;
+            ComPtr<ID3D11Buffer> constantBuffers[D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT];
+            void Capture(ID3D11DeviceContext* ctx);
+            void Restore(ID3D11DeviceContext* ctx);
+        };
+
+        struct PSState {
+            ComPtr<ID3D11PixelShader> pixelShader;
+            void Capture(ID3D11DeviceContext* ctx);
+            void Restore(ID3D11DeviceContext* ctx);
+        };
+
+        struct PSConstantBufferState {
+            ComPtr<ID3D11Buffer> constantBuffers[D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT];
+            void Capture(ID3D11DeviceContext* ctx);
+            void Restore(ID3D11DeviceContext* ctx);
+        };
+
+        struct PSResourceState {
+            ComPtr<ID3D11ShaderResourceView> srvs[D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT];
+            void Capture(ID3D11DeviceContext* ctx);
+            void Restore(ID3D11DeviceContext* ctx);
+        };
+
+        struct PSSamplerState {
+            ComPtr<ID3D11SamplerState> samplers[D3D11_COMMONSHADER_SAMPLER_SLOT_COUNT];
+            void Capture(ID3D11DeviceContext* ctx);
+            void Restore(ID3D11DeviceContext* ctx);
+        };
+
+        struct RenderTargetState {
+            ComPtr<ID3D11RenderTargetView> renderTargetViews[D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT];
+            ComPtr<ID3D11DepthStencilView> depthStencilView;
+            void Capture(ID3D11DeviceContext* ctx);
+            void Restore(ID3D11DeviceContext* ctx);
+        };
+
+        struct OutputMergerState {
+            ComPtr<ID3D11BlendState> blendState;
+            FLOAT blendFactor[4];
+            UINT sampleMask;
+            ComPtr<ID3D11DepthStencilState> depthStencilState;
+            UINT stencilRef;
+            void Capture(ID3D11DeviceContext* ctx);
+            void Restore(ID3D11DeviceContext* ctx);
+        };
+
+        struct CSState {
+            ComPtr<ID3D11ComputeShader> computeShader;
+            ComPtr<ID3D11UnorderedAccessView> uavs[D3D11_1_UAV_SLOT_COUNT];
+            ComPtr<ID3D11ShaderResourceView> srvs[D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT];
+            ComPtr<ID3D11Buffer> constantBuffers[D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT];
+            ComPtr<ID3D11SamplerState> samplers[D3D11_COMMONSHADER_SAMPLER_SLOT_COUNT];
+            void Capture(ID3D11DeviceContext* ctx);
+            void Restore(ID3D11DeviceContext* ctx);
+        };
+
+        template <uint32_t Mask, uint32_t Flag, typename T>
+        using Select = std::conditional_t<(Mask & Flag) != 0, T, NoState>;
+    }
+
+    // Captures the selected state categories on construction and restores them on destruction.
+    // Categories outside Mask cost nothing.
+    template <uint32_t Mask = State::All>
     class StateBlock {
     public:
-        StateBlock(ID3D11DeviceContext* context);
-        ~StateBlock();
+        explicit StateBlock(ID3D11DeviceContext* context) : m_context(context) {
+            Capture();
+        }
+
+        ~StateBlock() {
+            Restore();
+        }
+
+        StateBlock(const StateBlock&) = delete;
+        StateBlock& operator=(const StateBlock&) = delete;
+
+        void Capture() {
+            Profiler::CpuScope profile(Profiler::CpuStage::StateBlock);
+            m_ia.Capture(m_context);
+            m_rs.Capture(m_context);
+            m_viewports.Capture(m_context);
+            m_vs.Capture(m_context);
+            m_vsCBs.Capture(m_context);
+            m_gs.Capture(m_context);
+            m_ps.Capture(m_context);
+            m_psCBs.Capture(m_context);
+            m_psSRVs.Capture(m_context);
+            m_psSamplers.Capture(m_context);
+            m_renderTargets.Capture(m_context);
+            m_om.Capture(m_context);
+            m_cs.Capture(m_context);
+        }
 
-        void Capture();
-        void Restore();
+        void Restore() {
+            Profiler::CpuScope profile(Profiler::CpuStage::StateBlock);
+            m_ia.Restore(m_context);
+            m_rs.Restore(m_context);
+            m_viewports.Restore(m_context);
+            m_vs.Restore(m_context);
+            m_vsCBs.Restore(m_context);
+            m_gs.Restore(m_context);
+            m_ps.Restore(m_context);
+            m_psCBs.Restore(m_context);
+            m_psSRVs.Restore(m_context);
+            m_psSamplers.Restore(m_context);
+            m_om.Restore(m_context);
+            m_renderTargets.Restore(m_context);
+            m_cs.Restore(m_context);
+        }
 
     private:
         ID3D11DeviceContext* m_context;
 
-        // Input Assembler
-        ComPtr<ID3D11InputLayout> m_inputLayout;
-        D3D11_PRIMITIVE_TOPOLOGY m_topology;
-        ComPtr<ID3D11Buffer> m_indexBuffer;
-        DXGI_FORMAT m_indexBufferFormat;
-        UINT m_indexBufferOffset;
-        ComPtr<ID3D11Buffer> m_vertexBuffers[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
-        UINT m_vertexStrides[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
-        UINT m_vertexOffsets[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
-
-        // Rasterizer
-        ComPtr<ID3D11RasterizerState> m_rasterizerState;
-        ComPtr<ID3D11Buffer> m_vsConstantBuffers[D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT];
-        ComPtr<ID3D11VertexShader> m_vertexShader;
-        
-        // Pixel Shader
-        ComPtr<ID3D11PixelShader> m_pixelShader;
-        ComPtr<ID3D11Buffer> m_psConstantBuffers[D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT];
-        ComPtr<ID3D11ShaderResourceView> m_psSRVs[D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT];
-        ComPtr<ID3D11SamplerState> m_psSamplers[D3D11_COMMONSHADER_SAMPLER_SLOT_COUNT];
-
-        // Output Merger
-        ComPtr<ID3D11BlendState> m_blendState;
-        FLOAT m_blendFactor[4];
-        UINT m_sampleMask;
-        ComPtr<ID3D11DepthStencilState> m_depthStencilState;
-        UINT m_stencilRef;
-        ComPtr<ID3D11RenderTargetView> m_renderTargetViews[D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT];
-        ComPtr<ID3D11DepthStencilView> m_depthStencilView;
-        D3D11_VIEWPORT m_viewports[D3D11_VIEWPORT_AND_SCISSORRECT_OBJECT_COUNT_PER_PIPELINE];
-        UINT m_numViewports;
-
-        // Compute Shader (if needed for compute tasks)
-        ComPtr<ID3D11ComputeShader> m_computeShader;
-        ComPtr<ID3D11UnorderedAccessView> m_csUAVs[D3D11_1_UAV_SLOT_COUNT];
-        ComPtr<ID3D11ShaderResourceView> m_csSRVs[D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT];
-        ComPtr<ID3D11Buffer> m_csConstantBuffers[D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT];
-        ComPtr<ID3D11SamplerState> m_csSamplers[D3D11_COMMONSHADER_SAMPLER_SLOT_COUNT];
+        Detail::Select<Mask, State::IA, Detail::IAState> m_ia;
+        Detail::Select<Mask, State::RS_STATE, Detail::RSState> m_rs;
+        Detail::Select<Mask, State::RS_VP, Detail::ViewportState> m_viewports;
+        Detail::Select<Mask, State::VS, Detail::VSState> m_vs;
+        Detail::Select<Mask, State::VS_CB, Detail::VSConstantBufferState> m_vsCBs;
+        Detail::Select<Mask, State::GS, Detail::GSState> m_gs;
+        Detail::Select<Mask, State::PS, Detail::PSState> m_ps;
+        Detail::Select<Mask, State::PS_CB, Detail::PSConstantBufferState> m_psCBs;
+        Detail::Select<Mask, State::PS_SRV, Detail::PSResourceState> m_psSRVs;
+        Detail::Select<Mask, State::PS_SAMPLER, Detail::PSSamplerState> m_psSamplers;
+        Detail::Select<Mask, State::OM_RT, Detail::RenderTargetState> m_renderTargets;
+        Detail::Select<Mask, State::OM_STATE, Detail::OutputMergerState> m_om;
+        Detail::Select<Mask, State::CS, Detail::CSState> m_cs;
     };
 }
@@ -0,0 +1,253 @@
+#include "pch.h"
+#include "AmfBackend.h"
+#include "../Core/Logger.h"
+#include <core/Factory.h>
+#include <components/VideoEncoderVCE.h>
+#include <components/VideoEncoderHEVC.h>
+#include <components/VideoEncoderAV1.h>
+#include <cstring>
+
+namespace Video {
+    // Loaded once and kept for the process, nullptr without an AMD driver
+    static amf::AMFFactory* GetFactory() {
+        static amf::AMFFactory* factory = []() -> amf::AMFFactory* {
+            HMODULE module = LoadLibraryW(AMF_DLL_NAME);
+            if (!module) return nullptr;
+            auto init = (AMFInit_Fn)GetProcAddress(module, AMF_INIT_FUNCTION_NAME);
+            amf::AMFFactory* result = nullptr;
+            if (!init || init(AMF_FULL_VERSION, &result) != AMF_OK) return nullptr;
+            return result;
+        }();
+        return factory;
+    }
+
+    // The three encoder components name the same settings differently
+    struct AmfCodec {
+        const wchar_t* component;
+        AVCodecID codecId;
+        const wchar_t* usage;
+        amf_int64 usageTranscoding;
+        const wchar_t* rateControl;
+        amf_int64 rateControlCbr;
+        const wchar_t* targetBitrate;
+        const wchar_t* peakBitrate;
+        const wchar_t* frameSize;
+        const wchar_t* frameRate;
+        const wchar_t* keyframeInterval;
+        const wchar_t* extradata;
+        const wchar_t* outputType;
+        amf_int64 outputKey;
+        amf_int64 outputIntra;
+    };
+
+    static const AmfCodec& GetAmfCodec(Codec codec) {
+        static const AmfCodec kH264 = {
+            AMFVideoEncoderVCE_AVC, AV_CODEC_ID_H264,
+            AMF_VIDEO_ENCODER_USAGE, AMF_VIDEO_ENCODER_USAGE_TRANSCODING,
+            AMF_VIDEO_ENCODER_RATE_CONTROL_METHOD, AMF_VIDEO_ENCODER_RATE_CONTROL_METHOD_CBR,
+            AMF_VIDEO_ENCODER_TARGET_BITRATE, AMF_VIDEO_ENCODER_PEAK_BITRATE,
+            AMF_VIDEO_ENCODER_FRAMESIZE, AMF_VIDEO_ENCODER_FRAMERATE,
+            AMF_VIDEO_ENCODER_IDR_PERIOD, AMF_VIDEO_ENCODER_EXTRADATA,
+            AMF_VIDEO_ENCODER_OUTPUT_DATA_TYPE, AMF_VIDEO_ENCODER_OUTPUT_DATA_TYPE_IDR, AMF_VIDEO_ENCODER_OUTPUT_DATA_TYPE_I,
+        };
+        static const AmfCodec kHevc = {
+            AMFVideoEncoder_HEVC, AV_CODEC_ID_HEVC,
+            AMF_VIDEO_ENCODER_HEVC_USAGE, AMF_VIDEO_ENCODER_HEVC_USAGE_TRANSCODING,
+            AMF_VIDEO_ENCODER_HEVC_RATE_CONTROL_METHOD, AMF_VIDEO_ENCODER_HEVC_RATE_CONTROL_METHOD_CBR,
+            AMF_VIDEO_ENCODER_HEVC_TARGET_BITRATE, AMF_VIDEO_ENCODER_HEVC_PEAK_BITRATE,
+            AMF_VIDEO_ENCODER_HEVC_FRAMESIZE, AMF_VIDEO_ENCODER_HEVC_FRAMERATE,
+            AMF_VIDEO_ENCODER_HEVC_GOP_SIZE, AMF_VIDEO_ENCODER_HEVC_EXTRADATA,
+            AMF_VIDEO_ENCODER_HEVC_OUTPUT_DATA_TYPE, AMF_VIDEO_ENCODER_HEVC_OUTPUT_DATA_TYPE_IDR, AMF_VIDEO_ENCODER_HEVC_OUTPUT_DATA_TYPE_I,
+        };
+        static const AmfCodec kAv1 = {
+            AMFVideoEncoder_AV1, AV_CODEC_ID_AV1,
+            AMF_VIDEO_ENCODER_AV1_USAGE, AMF_VIDEO_ENCODER_AV1_USAGE_TRANSCODING,
+            AMF_VIDEO_ENCODER_AV1_RATE_CONTROL_METHOD, AMF_VIDEO_ENCODER_AV1_RATE_CONTROL_METHOD_CBR,
+            AMF_VIDEO_ENCODER_AV1_TARGET_BITRATE, AMF_VIDEO_ENCODER_AV1_PEAK_BITRATE,
+            AMF_VIDEO_ENCODER_AV1_FRAMESIZE, AMF_VIDEO_ENCODER_AV1_FRAMERATE,
+            AMF_VIDEO_ENCODER_AV1_GOP_SIZE, AMF_VIDEO_ENCODER_AV1_EXTRA_DATA,
+            AMF_VIDEO_ENCODER_AV1_OUTPUT_FRAME_TYPE, AMF_VIDEO_ENCODER_AV1_OUTPUT_FRAME_TYPE_KEY, AMF_VIDEO_ENCODER_AV1_OUTPUT_FRAME_TYPE_INTRA_ONLY,
+        };
+        switch (codec) {
+            case Codec::HEVC: return kHevc;
+            case Codec::AV1:  return kAv1;
+            default:          return kH264;
+        }
+    }
+
+    // A DX11 context and an encoder component for codec on it, both null on failure
+    static bool CreateEncoder(ID3D11Device* pDevice, Codec codec, amf::AMFContext*& context, amf::AMFComponent*& encoder) {
+        context = nullptr;
+        encoder = nullptr;
+        amf::AMFFactory* factory = GetFactory();
+        if (!factory || factory->CreateContext(&context) != AMF_OK) return false;
+
+        if (context->InitDX11(pDevice) == AMF_OK && factory->CreateComponent(context, GetAmfCodec(codec).component, &encoder) == AMF_OK) return true;
+
+        if (encoder) encoder->Release();
+        encoder = nullptr;
+        context->Terminate();
+        context->Release();
+        context = nullptr;
+        return false;
+    }
+
+    bool AmfBackend::QueryCaps(ID3D11Device* pDevice, Codec codec, EncoderCaps& caps) {
+        amf::AMFContext* context = nullptr;
+        amf::AMFComponent* encoder = nullptr;
+        if (!CreateEncoder(pDevice, codec, context, encoder)) return false;
+
+        amf::AMFCapsPtr encoderCaps;
+        amf::AMFIOCapsPtr inputCaps;
+        amf_int32 minWidth = 0, maxWidth = 0, minHeight = 0, maxHeight = 0;
+        bool supported = encoder->GetCaps(&encoderCaps) == AMF_OK
+            && encoderCaps->GetAccelerationType() == amf::AMF_ACCEL_HARDWARE
+            && encoderCaps->GetInputCaps(&inputCaps) == AMF_OK;
+        if (supported) {
+            inputCaps->GetWidthRange(&minWidth, &maxWidth);
+            inputCaps->GetHeightRange(&minHeight, &maxHeight);
+            caps.maxWidth = maxWidth;
+            caps.maxHeight = maxHeight;
+        }
+        inputCaps = nullptr;
+        encoderCaps = nullptr;
+
+        encoder->Terminate();
+        encoder->Release();
+        context->Terminate();
+        context->Release();
+        return supported;
+    }
+
+    AmfBackend::~AmfBackend() {
+        Finish();
+    }
+
+    std::string AmfBackend::GetName() const {
+        return std::string("AMF ") + GetCodecName(m_codec);
+    }
+
+    bool AmfBackend::OpenSession(ID3D11Device* pDevice, const EncoderSettings& settings, AVCodecParameters* codecPar) {
+        m_codec = settings.codec;
+        if (!CreateEncoder(pDevice, settings.codec, m_context, m_encoder)) return false;
+
+        // Usage first, it resets the others to its defaults. No B-frames (the components default to
+        // none outside H.264), so outputs come back in submission order.
+        const AmfCodec& codec = GetAmfCodec(settings.codec);
+        m_encoder->SetProperty(codec.usage, codec.usageTranscoding);
+        m_encoder->SetProperty(codec.frameSize, ::AMFConstructSize(settings.width, settings.height));
+        m_encoder->SetProperty(codec.frameRate, ::AMFConstructRate(settings.fps, 1));
+        m_encoder->SetProperty(codec.rateControl, codec.rateControlCbr);
+        m_encoder->SetProperty(codec.targetBitrate, (amf_int64)settings.bitRate);
+        m_encoder->SetProperty(codec.peakBitrate, (amf_int64)settings.bitRate);
+        m_encoder->SetProperty(codec.keyframeInterval, (amf_int64)settings.gopSize);
+        if (settings.codec == Codec::H264) m_encoder->SetProperty(AMF_VIDEO_ENCODER_B_PIC_PATTERN, (amf_int64)0);
+        if (settings.codec == Codec::HEVC) m_encoder->SetProperty(AMF_VIDEO_ENCODER_HEVC_NUM_GOPS_PER_IDR, (amf_int64)1);
+
+        if (m_encoder->Init(amf::AMF_SURFACE_NV12, settings.width, settings.height) != AMF_OK) {
+            LOG_WARNING("AMF rejected ", GetCodecName(settings.codec), " at ", settings.width, "x", settings.height);
+            CloseSession();
+            return false;
+        }
+
+        // SPS/PPS (or the AV1 sequence header) go into the container ahead of the first packet
+        amf::AMFVariant extradata;
+        amf::AMFBufferPtr header;
+        if (m_encoder->GetProperty(codec.extradata, &extradata) != AMF_OK || extradata.type != amf::AMF_VARIANT_INTERFACE || !extradata.pInterface
+            || extradata.pInterface->QueryInterface(amf::AMFBuffer::IID(), (void**)&header) != AMF_OK) {
+            CloseSession();
+            return false;
+        }
+
+        size_t headerSize = header->GetSize();
+        codecPar->codec_id = codec.codecId;
+        codecPar->extradata = (uint8_t*)av_mallocz(headerSize + AV_INPUT_BUFFER_PADDING_SIZE);
+        if (!codecPar->extradata) {
+            CloseSession();
+            return false;
+        }
+        memcpy(codecPar->extradata, header->GetNative(), headerSize);
+        codecPar->extradata_size = (int)headerSize;
+        return true;
+    }
+
+    void AmfBackend::CloseSession() {
+        while (!m_inFlight.empty()) ReleaseOldest();
+        if (m_encoder) {
+            m_encoder->Terminate();
+            m_encoder->Release();
+            m_encoder = nullptr;
+        }
+        if (m_context) {
+            m_context->Terminate();
+            m_context->Release();
+            m_context = nullptr;
+        }
+    }
+
+    void AmfBackend::ReleaseOldest() {
+        InFlight oldest = m_inFlight.front();
+        m_inFlight.pop_front();
+        oldest.surface->Release();
+        ReleaseSurface(oldest.index);
+    }
+
+    bool AmfBackend::ReceiveOutput(bool wait) {
+        for (;;) {
+            amf::AMFDataPtr data;
+            AMF_RESULT result = m_encoder->QueryOutput(&data);
+            if (result == AMF_OK && data) {
+                amf::AMFBufferPtr buffer;
+                if (data->QueryInterface(amf::AMFBuffer::IID(), (void**)&buffer) == AMF_OK) {
+                    amf_int64 outputType = 0;
+                    buffer->GetProperty(GetAmfCodec(m_codec).outputType, &outputType);
+                    bool keyframe = outputType == GetAmfCodec(m_codec).outputKey || outputType == GetAmfCodec(m_codec).outputIntra;
+                    WritePacket(buffer->GetNative(), buffer->GetSize(), (int64_t)data->GetPts(), keyframe);
+                }
+                // One output per input, oldest first
+                if (!m_inFlight.empty()) ReleaseOldest();
+                return true;
+            }
+            if (result == AMF_EOF) return false;
+            if (result != AMF_REPEAT && result != AMF_OK) {
+                LOG_ERROR("Error receiving packet: ", (int)result);
+                return false;
+            }
+            if (!wait) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    void AmfBackend::EncodeSurface(int index, int64_t pts) {
+        amf::AMFSurface* surface = nullptr;
+        if (m_context->CreateSurfaceFromDX11Native(GetPoolTexture(index), &surface, nullptr) != AMF_OK) {
+            LOG_ERROR("AMF could not wrap an input surface");
+            ReleaseSurface(index);
+            return;
+        }
+        surface->SetPts(pts);
+
+        // A full input queue empties as outputs are taken
+        AMF_RESULT result;
+        while ((result = m_encoder->SubmitInput(surface)) == AMF_INPUT_FULL) {
+            if (!ReceiveOutput(true)) break;
+        }
+        if (result != AMF_OK) {
+            LOG_ERROR("Error sending frame to encoder: ", (int)result);
+            surface->Release();
+            ReleaseSurface(index);
+            return;
+        }
+
+        // Outputs are taken as they complete; past kMaxInFlight this thread waits for the oldest
+        m_inFlight.push_back({ index, surface });
+        while (ReceiveOutput(false)) {}
+        while ((int)m_inFlight.size() > kMaxInFlight && ReceiveOutput(true)) {}
+    }
+
+    void AmfBackend::FlushSession() {
+        m_encoder->Drain();
+        while (ReceiveOutput(true)) {}
+        while (!m_inFlight.empty()) ReleaseOldest();
+    }
+}
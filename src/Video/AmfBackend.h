@@ -0,0 +1,47 @@
+#pragma once
+#include "NativeEncoder.h"
+#include <deque>
+
+namespace amf {
+    class AMFContext;
+    class AMFComponent;
+    class AMFSurface;
+}
+
+namespace Video {
+    // AMD's encoder driven through the AMF runtime (MIT-licensed AMF SDK headers, the driver's
+    // amfrt64.dll loaded at runtime). Each frame wraps its pool texture as an AMF surface, which the
+    // encoder reads in place, without FFmpeg's hw frame pool.
+    class AmfBackend : public NativeEncoder {
+    public:
+        ~AmfBackend();
+
+        std::string GetName() const override;
+
+        // Creates a throwaway encoder component on pDevice: false if the GPU has no AMF or no encoder
+        // for codec, otherwise the largest input it accepts
+        static bool QueryCaps(ID3D11Device* pDevice, Codec codec, EncoderCaps& caps);
+
+    protected:
+        bool OpenSession(ID3D11Device* pDevice, const EncoderSettings& settings, AVCodecParameters* codecPar) override;
+        void CloseSession() override;
+        void EncodeSurface(int index, int64_t pts) override;
+        void FlushSession() override;
+
+    private:
+        struct InFlight {
+            int index;
+            amf::AMFSurface* surface; // Our reference, dropped once its output is back
+        };
+
+        // Takes the next encoded frame if there is one (waiting for it if wait), writes it and frees the
+        // oldest surface. False once the encoder has nothing more to give.
+        bool ReceiveOutput(bool wait);
+        void ReleaseOldest();
+
+        amf::AMFContext* m_context = nullptr;
+        amf::AMFComponent* m_encoder = nullptr;
+        Codec m_codec = Codec::H264;
+        std::deque<InFlight> m_inFlight; // Encoder thread, in submission order
+    };
+}
@@ -0,0 +1,170 @@
+#include "pch.h"
+#include "AsyncFileWriter.h"
+#include "../Core/Logger.h"
+#include <algorithm>
+#include <cstring>
+#include <malloc.h>
+
+namespace Video {
+    AVIOContext* AsyncFileWriter::Open(const std::string& path) {
+        AsyncFileWriter* writer = new AsyncFileWriter();
+        if (!writer->Create(path)) {
+            delete writer;
+            return nullptr;
+        }
+
+        uint8_t* buffer = (uint8_t*)av_malloc(kIoBufferSize);
+        AVIOContext* pb = buffer ? avio_alloc_context(buffer, kIoBufferSize, 1, writer, nullptr, &AsyncFileWriter::WritePacket, &AsyncFileWriter::SeekPacket) : nullptr;
+        if (!pb) {
+            av_free(buffer);
+            delete writer;
+            return nullptr;
+        }
+        return pb;
+    }
+
+    bool AsyncFileWriter::Close(AVIOContext** pb) {
+        if (!pb || !*pb) return true;
+
+        avio_flush(*pb);
+        AsyncFileWriter* writer = (AsyncFileWriter*)(*pb)->opaque;
+        writer->Finish();
+        bool ok = !writer->m_failed;
+        delete writer;
+
+        av_freep(&(*pb)->buffer);
+        avio_context_free(pb);
+        return ok;
+    }
+
+    AsyncFileWriter::~AsyncFileWriter() {
+        Finish();
+        for (Block& block : m_blocks) _aligned_free(block.data);
+    }
+
+    bool AsyncFileWriter::Create(const std::string& path) {
+        HANDLE file = CreateFileW(std::filesystem::u8path(path).wstring().c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+                                  CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            LOG_ERROR("Could not create output file ", path);
+            return false;
+        }
+        m_file = file;
+
+        // Page-aligned, allocated once, recycled through m_free
+        for (Block& block : m_blocks) {
+            block.data = (uint8_t*)_aligned_malloc(kBlockSize, 4096);
+            if (!block.data) return false;
+            m_free.TryPush(&block);
+        }
+
+        m_thread = std::thread(&AsyncFileWriter::WriterThread, this);
+        return true;
+    }
+
+    void AsyncFileWriter::Finish() {
+        Submit();
+        if (m_thread.joinable()) {
+            m_stopThread = true;
+            m_blockQueued.notify_one();
+            m_thread.join();
+        }
+        if (m_file) {
+            CloseHandle((HANDLE)m_file);
+            m_file = nullptr;
+        }
+    }
+
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+    int AsyncFileWriter::WritePacket(void* opaque, const uint8_t* buf, int size) {
+#else
+    int AsyncFileWriter::WritePacket(void* opaque, uint8_t* buf, int size) {
+#endif
+        return ((AsyncFileWriter*)opaque)->Write(buf, size);
+    }
+
+    int64_t AsyncFileWriter::SeekPacket(void* opaque, int64_t offset, int whence) {
+        return ((AsyncFileWriter*)opaque)->Seek(offset, whence);
+    }
+
+    int AsyncFileWriter::Write(const uint8_t* buf, int size) {
+        if (m_failed) return AVERROR(EIO);
+
+        int remaining = size;
+        while (remaining > 0) {
+            // A block holds one contiguous run, anything after a seek starts the next one
+            if (m_current && m_current->size > 0 && (m_current->offset + (int64_t)m_current->size != m_position || m_current->size == kBlockSize)) Submit();
+            if (!m_current) {
+                m_current = TakeFreeBlock();
+                m_current->size = 0;
+            }
+            if (m_current->size == 0) m_current->offset = m_position;
+
+            size_t chunk = std::min((size_t)remaining, kBlockSize - m_current->size);
+            memcpy(m_current->data + m_current->size, buf, chunk);
+            m_current->size += chunk;
+            buf += chunk;
+            remaining -= (int)chunk;
+            m_position += chunk;
+        }
+        m_size = std::max(m_size, m_position);
+        return size;
+    }
+
+    int64_t AsyncFileWriter::Seek(int64_t offset, int whence) {
+        switch (whence & ~AVSEEK_FORCE) {
+            case AVSEEK_SIZE: return m_size;
+            case SEEK_SET: m_position = offset; break;
+            case SEEK_CUR: m_position += offset; break;
+            case SEEK_END: m_position = m_size + offset; break;
+            default: return AVERROR(EINVAL);
+        }
+        return m_position;
+    }
+
+    void AsyncFileWriter::Submit() {
+        // An empty block just stays current: m_free has a single producer, the writer thread
+        if (!m_current || m_current->size == 0) return;
+
+        // Every block comes from m_blocks, so the queue always has room for it
+        m_queued.TryPush(m_current);
+        m_blockQueued.notify_one();
+        m_current = nullptr;
+    }
+
+    AsyncFileWriter::Block* AsyncFileWriter::TakeFreeBlock() {
+        Block* block = nullptr;
+        while (!m_free.TryPop(block)) {
+            // Missed notifications are covered by the timeout
+            std::unique_lock<std::mutex> lock(m_wakeMutex);
+            m_blockFreed.wait_for(lock, std::chrono::milliseconds(2), [this] { return !m_free.Empty(); });
+        }
+        return block;
+    }
+
+    void AsyncFileWriter::WriterThread() {
+        for (;;) {
+            Block* block = nullptr;
+            if (m_queued.TryPop(block)) {
+                // Positioned write, blocks after a seek land where the muxer wanted them
+                OVERLAPPED overlapped = {};
+                overlapped.Offset = (DWORD)(block->offset & 0xFFFFFFFF);
+                overlapped.OffsetHigh = (DWORD)(block->offset >> 32);
+                DWORD written = 0;
+                if (!m_failed && (!WriteFile((HANDLE)m_file, block->data, (DWORD)block->size, &written, &overlapped) || written != block->size)) {
+                    LOG_ERROR("Write to output file failed (", GetLastError(), ")");
+                    m_failed = true;
+                }
+
+                m_free.TryPush(block);
+                m_blockFreed.notify_one();
+                continue;
+            }
+
+            if (m_stopThread) break;
+
+            std::unique_lock<std::mutex> lock(m_wakeMutex);
+            m_blockQueued.wait_for(lock, std::chrono::milliseconds(5), [this] { return !m_queued.Empty() || m_stopThread; });
+        }
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include "../Core/SpscRing.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#pragma warning(push)
+#pragma warning(disable: 4244)
+extern "C" {
+#include <libavformat/avio.h>
+}
+#pragma warning(pop)
+
+namespace Video {
+    // Write-only AVIOContext whose disk writes happen on a dedicated writer thread.
+    // Muxer output is gathered into large page-aligned blocks; the muxing thread only copies into
+    // them and hands full blocks over, so a slow disk never stalls encoding until kMaxBlocks are queued.
+    // Seeking is supported (the MP4 muxer patches sizes), reading is not, so no faststart.
+    class AsyncFileWriter {
+    public:
+        // nullptr if the file can't be created
+        static AVIOContext* Open(const std::string& path);
+
+        // Flushes, waits for the queued writes and closes the file. Returns false if a write failed.
+        static bool Close(AVIOContext** pb);
+
+    private:
+        static constexpr size_t kBlockSize = 1 << 20;
+        static constexpr size_t kMaxBlocks = 64; // Up to 64 MB waiting for the disk
+        static constexpr int kIoBufferSize = 64 * 1024;
+
+        struct Block {
+            uint8_t* data;
+            size_t size;
+            int64_t offset;
+        };
+
+        AsyncFileWriter() = default;
+        ~AsyncFileWriter();
+
+        bool Create(const std::string& path);
+        void Finish();
+
+        // AVIOContext callbacks, on the muxing thread
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+        static int WritePacket(void* opaque, const uint8_t* buf, int size);
+#else
+        static int WritePacket(void* opaque, uint8_t* buf, int size);
+#endif
+        static int64_t SeekPacket(void* opaque, int64_t offset, int whence);
+        int Write(const uint8_t* buf, int size);
+        int64_t Seek(int64_t offset, int whence);
+
+        void Submit();          // Queues m_current if it holds anything
+        Block* TakeFreeBlock(); // Waits for the writer thread to return one
+        void WriterThread();
+
+        void* m_file = nullptr; // HANDLE
+        std::thread m_thread;
+        std::atomic<bool> m_stopThread{ false };
+        std::atomic<bool> m_failed{ false };
+
+        Block m_blocks[kMaxBlocks] = {};
+        SpscRing<Block*, kMaxBlocks> m_queued; // Muxing thread -> writer thread
+        SpscRing<Block*, kMaxBlocks> m_free;   // Writer thread -> muxing thread
+        std::mutex m_wakeMutex;
+        std::condition_variable m_blockQueued;
+        std::condition_variable m_blockFreed;
+
+        // Muxing thread only
+        Block* m_current = nullptr;
+        int64_t m_position = 0;
+        int64_t m_size = 0;
+    };
+}
@@ -1,13 +1,96 @@
 #pragma once
 #include <d3d11.h>
+#include <cstdint>
+#include <memory>
 #include <string>
 
 namespace Video {
+    class Muxer;
+
+    enum class Codec : uint32_t {
+        H264 = 0,
+        HEVC = 1,
+        AV1 = 2
+    };
+
+    inline const char* GetCodecName(Codec codec) {
+        switch (codec) {
+            case Codec::HEVC: return "HEVC";
+            case Codec::AV1:  return "AV1";
+            default:          return "H.264";
+        }
+    }
+
+    // How the output is written, see Muxer
+    struct OutputOptions {
+        // Fragmented MP4: a fragment per keyframe, nothing to rewrite on close, a crash loses one fragment
+        bool fragmented = false;
+        // New file (name_000.mp4, name_001.mp4, ...) every this many seconds, at a keyframe. 0 for one file.
+        uint32_t segmentSeconds = 0;
+    };
+
+    struct EncoderSettings {
+        int width = 0;
+        int height = 0;
+        int fps = 60;
+        Codec codec = Codec::H264;
+        int64_t bitRate = 50000000;
+        int gopSize = 120; // Frames between keyframes
+        std::string filename;
+        OutputOptions output;
+
+        // Frames in flight between the render thread and the encoder thread, and what happens
+        // when the encoder falls behind: drop the oldest queued frame, or wait for a free slot
+        size_t queueDepth = 4;
+        bool dropOldest = true;
+
+        // Split the frame into this many sessions (see TiledEncoder), as columns or with tileRows as rows
+        uint32_t tiles = 1;
+        bool tileRows = false;
+
+        // Set for tile sessions: add a stream to this already opened muxer instead of writing filename
+        std::shared_ptr<Muxer> muxer;
+    };
+
+    // What a backend's hardware reports it can encode for one codec, see EncoderFactory
+    struct EncoderCaps {
+        int maxWidth = 0;
+        int maxHeight = 0;
+
+        bool Fits(int width, int height) const { return width <= maxWidth && height <= maxHeight; }
+    };
+
+    // An NV12 input surface owned by the encoder, one slice of its texture array
+    struct EncoderSurface {
+        ID3D11Texture2D* texture = nullptr;
+        UINT arraySlice = 0;
+        void* frame = nullptr; // Backend bookkeeping
+    };
+
     class Encoder {
     public:
         virtual ~Encoder() = default;
-        virtual bool Initialize(ID3D11Device* pDevice, int width, int height, int fps, const std::string& filename) = 0;
-        virtual void EncodeFrame(ID3D11Texture2D* pSourceTexture) = 0;
+        // Opens a session for settings.codec, false if this backend can't encode it at that size
+        virtual bool Initialize(ID3D11Device* pDevice, const EncoderSettings& settings) = 0;
+        // Copies a subresource (or a region of it) of an NV12 texture into the next frame
+        virtual void EncodeFrame(ID3D11Texture2D* pSourceTexture, UINT sourceSubresource = 0, const D3D11_BOX* sourceBox = nullptr) = 0;
         virtual void Finish() = 0;
+
+        // Zero-copy input: the caller writes the frame straight into an encoder surface on the immediate
+        // context, between AcquireSurface and SubmitSurface (or DiscardSurface if nothing was written).
+        // AcquireSurface returns false if no surface is available this frame.
+        virtual bool AcquireSurface(EncoderSurface& /*surface*/) { return false; }
+        virtual void SubmitSurface(EncoderSurface& /*surface*/) {}
+        virtual void DiscardSurface(EncoderSurface& /*surface*/) {}
+
+        // D3D11_BIND_* flags of the surfaces, tells the caller which views it can create
+        virtual UINT GetSurfaceBindFlags() const { return 0; }
+
+        // Backend and codec implementation in use, for logging (e.g. "FFmpeg hevc_nvenc")
+        virtual std::string GetName() const = 0;
+
+        // Render thread: frames dropped by the queue policy so far, and frames waiting for the encoder thread
+        virtual uint64_t GetDroppedFrames() const { return 0; }
+        virtual uint64_t GetQueuedFrames() const { return 0; }
     };
 }
@@ -0,0 +1,144 @@
+#include "pch.h"
+#include "EncoderFactory.h"
+#include "FFmpegBackend.h"
+#ifdef WIDECAPTURE_NVENC
+#include "NvencBackend.h"
+#endif
+#ifdef WIDECAPTURE_AMF
+#include "AmfBackend.h"
+#endif
+#include "TiledEncoder.h"
+#include "../Core/Logger.h"
+#include <algorithm>
+#include <mutex>
+
+namespace Video {
+
+    struct EncoderBackend {
+        const char* name;
+        std::unique_ptr<Encoder> (*create)();
+        // Hardware limits for a codec on the device, false if the backend can't encode it there.
+        // nullptr if the backend has no query, opening the session decides.
+        bool (*queryCaps)(ID3D11Device* pDevice, Codec codec, EncoderCaps& caps);
+    };
+
+    // In preference order: the native SDKs that were built in, then FFmpeg's wrappers around the same hardware
+    static const EncoderBackend kBackends[] = {
+#ifdef WIDECAPTURE_NVENC
+        { "NVENC", []() -> std::unique_ptr<Encoder> { return std::make_unique<NvencBackend>(); }, &NvencBackend::QueryCaps },
+#endif
+#ifdef WIDECAPTURE_AMF
+        { "AMF", []() -> std::unique_ptr<Encoder> { return std::make_unique<AmfBackend>(); }, &AmfBackend::QueryCaps },
+#endif
+        { "FFmpeg", []() -> std::unique_ptr<Encoder> { return std::make_unique<FFmpegBackend>(); }, nullptr },
+    };
+    static constexpr size_t kBackendCount = sizeof(kBackends) / sizeof(kBackends[0]);
+
+    // A query opens a session, so answers are kept per adapter: tiles and later outputs ask again
+    struct CapsEntry {
+        LUID adapter;
+        size_t backend;
+        Codec codec;
+        bool supported;
+        EncoderCaps caps;
+    };
+    static std::mutex g_capsMutex;
+    static std::vector<CapsEntry> g_capsCache;
+
+    static LUID GetAdapterLuid(ID3D11Device* pDevice) {
+        LUID luid = {};
+        Microsoft::WRL::ComPtr<IDXGIDevice> dxgiDevice;
+        Microsoft::WRL::ComPtr<IDXGIAdapter> adapter;
+        DXGI_ADAPTER_DESC desc = {};
+        if (SUCCEEDED(pDevice->QueryInterface(IID_PPV_ARGS(&dxgiDevice))) && SUCCEEDED(dxgiDevice->GetAdapter(&adapter)) && SUCCEEDED(adapter->GetDesc(&desc))) {
+            luid = desc.AdapterLuid;
+        }
+        return luid;
+    }
+
+    static bool QueryBackendCaps(ID3D11Device* pDevice, size_t backend, Codec codec, EncoderCaps& caps) {
+        LUID adapter = GetAdapterLuid(pDevice);
+        std::lock_guard<std::mutex> lock(g_capsMutex);
+        for (const CapsEntry& entry : g_capsCache) {
+            if (entry.adapter.LowPart == adapter.LowPart && entry.adapter.HighPart == adapter.HighPart && entry.backend == backend && entry.codec == codec) {
+                caps = entry.caps;
+                return entry.supported;
+            }
+        }
+
+        CapsEntry entry = { adapter, backend, codec, false, {} };
+        entry.supported = kBackends[backend].queryCaps(pDevice, codec, entry.caps);
+        if (entry.supported) LOG_INFO(kBackends[backend].name, " ", GetCodecName(codec), " encodes up to ", entry.caps.maxWidth, "x", entry.caps.maxHeight);
+        g_capsCache.push_back(entry);
+        caps = entry.caps;
+        return entry.supported;
+    }
+
+    EncoderFactory::Fit EncoderFactory::FitsCodec(ID3D11Device* pDevice, Codec codec, int width, int height) {
+        Fit fit = Fit::Unknown;
+        for (size_t i = 0; i < kBackendCount; ++i) {
+            if (!kBackends[i].queryCaps) continue;
+            EncoderCaps caps;
+            if (!QueryBackendCaps(pDevice, i, codec, caps)) continue;
+            if (caps.Fits(width, height)) return Fit::Yes;
+            fit = Fit::No;
+        }
+        return fit;
+    }
+
+    std::vector<Codec> EncoderFactory::GetCodecOrder(ID3D11Device* pDevice, uint32_t codecPreference, int width, int height) {
+        std::vector<Codec> order;
+        if (codecPreference >= 1 && codecPreference <= 3) order.push_back((Codec)(codecPreference - 1));
+
+        // Then everything the hardware reports fitting, most compatible first, then the codecs no
+        // backend could answer for (only FFmpeg's sessions, which decide when they open)
+        const Codec codecs[] = { Codec::H264, Codec::HEVC, Codec::AV1 };
+        Fit fits[3];
+        for (int i = 0; i < 3; ++i) fits[i] = FitsCodec(pDevice, codecs[i], width, height);
+        for (Fit wanted : { Fit::Yes, Fit::Unknown }) {
+            for (int i = 0; i < 3; ++i) {
+                if (fits[i] != wanted) continue;
+                if (std::find(order.begin(), order.end(), codecs[i]) == order.end()) order.push_back(codecs[i]);
+            }
+        }
+
+        // Too large for every codec the hardware has, let the sessions decide
+        if (order.empty()) order = { Codec::HEVC, Codec::AV1 };
+        return order;
+    }
+
+    std::unique_ptr<Encoder> EncoderFactory::Create(ID3D11Device* pDevice, const EncoderSettings& settings, uint32_t codecPreference) {
+        if (settings.tiles > 1) {
+            auto tiled = std::make_unique<TiledEncoder>(codecPreference);
+            if (tiled->Initialize(pDevice, settings)) {
+                LOG_INFO("Encoder: ", tiled->GetName(), ", ", settings.width, "x", settings.height, " total");
+                return tiled;
+            }
+            LOG_WARNING("Tiled encoding unavailable, trying a single session");
+            EncoderSettings single = settings;
+            single.tiles = 1;
+            return Create(pDevice, single, codecPreference);
+        }
+
+        for (Codec codec : GetCodecOrder(pDevice, codecPreference, settings.width, settings.height)) {
+            EncoderSettings attempt = settings;
+            attempt.codec = codec;
+
+            for (size_t i = 0; i < kBackendCount; ++i) {
+                const EncoderBackend& backend = kBackends[i];
+                EncoderCaps caps;
+                if (backend.queryCaps && (!QueryBackendCaps(pDevice, i, codec, caps) || !caps.Fits(settings.width, settings.height))) continue;
+
+                std::unique_ptr<Encoder> encoder = backend.create();
+                if (encoder->Initialize(pDevice, attempt)) {
+                    LOG_INFO("Encoder: ", encoder->GetName(), " (", GetCodecName(codec), ") ", settings.width, "x", settings.height);
+                    return encoder;
+                }
+                LOG_WARNING(backend.name, " can't encode ", GetCodecName(codec), " at ", settings.width, "x", settings.height);
+            }
+        }
+
+        LOG_ERROR("No encoder available for ", settings.width, "x", settings.height);
+        return nullptr;
+    }
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include "Encoder.h"
+#include <memory>
+#include <vector>
+
+namespace Video {
+    // Picks the encoder backend and codec at runtime. For each codec in GetCodecOrder every backend is
+    // tried in turn, the first session that opens is used. Native NVENC and AMF sessions (when their SDK
+    // headers were built in) come first and are only tried where their capability query says the frame
+    // fits; FFmpeg's hardware wrappers are the fallback.
+    class EncoderFactory {
+    public:
+        // Config::EncoderCodec: 0 picks by output size, 1-3 tries Codec (H.264, HEVC, AV1) first.
+        // settings.codec is ignored. With settings.tiles > 1 this is a TiledEncoder whose sessions
+        // come from here as well, falling back to one session. Returns nullptr if nothing can encode the output.
+        static std::unique_ptr<Encoder> Create(ID3D11Device* pDevice, const EncoderSettings& settings, uint32_t codecPreference);
+
+        // Codecs in the order Create tries them
+        static std::vector<Codec> GetCodecOrder(ID3D11Device* pDevice, uint32_t codecPreference, int width, int height);
+
+        // Whether a backend's capability query on pDevice accepts a width x height frame for codec.
+        // Unknown if no backend with a query can encode the codec there. H.264 usually stops at 4096,
+        // below the equirect width of any face size over 1024.
+        enum class Fit { Yes, No, Unknown };
+        static Fit FitsCodec(ID3D11Device* pDevice, Codec codec, int width, int height);
+    };
+}
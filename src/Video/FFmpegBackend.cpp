@@ -1,6 +1,7 @@
 #include "pch.h"
 #include "FFmpegBackend.h"
 #include "../Core/Logger.h"
+#include <algorithm>
 
 namespace Video {
     FFmpegBackend::FFmpegBackend() {
@@ -11,27 +12,53 @@ namespace Video {
         Finish();
     }
 
+    // Hardware encoders per codec, in preference order
+    static std::vector<const char*> GetEncoderNames(Codec codec) {
+        switch (codec) {
+            case Codec::HEVC: return { "hevc_nvenc", "hevc_amf" };
+            case Codec::AV1:  return { "av1_nvenc", "av1_amf" };
+            default:          return { "h264_nvenc", "h264_amf" };
+        }
+    }
+
+    // Our frames come straight from the D3D11 pool, software encoders can't take them
+    static bool AcceptsD3D11Frames(const AVCodec* codec) {
+        for (const AVPixelFormat* fmt = codec->pix_fmts; fmt && *fmt != AV_PIX_FMT_NONE; ++fmt) {
+            if (*fmt == AV_PIX_FMT_D3D11) return true;
+        }
+        return false;
+    }
+
     void FFmpegBackend::Finish() {
         std::lock_guard<std::mutex> lock(m_mutex);
-        if (m_codecCtx) {
-            // Flush encoder
-            avcodec_send_frame(m_codecCtx, nullptr);
-            // Read remaining packets... skipped for brevity, should look like loop below
-            
-            if (m_fmtCtx) {
-                av_write_trailer(m_fmtCtx);
-                if (!(m_fmtCtx->oformat->flags & AVFMT_NOFILE)) {
-                    avio_closep(&m_fmtCtx->pb);
-                }
-                avformat_free_context(m_fmtCtx);
-                m_fmtCtx = nullptr;
-            }
-            
-            avcodec_free_context(&m_codecCtx);
+
+        // The encoder thread drains the queue and flushes the codec before it exits
+        if (m_thread.joinable()) {
+            m_stopThread = true;
+            m_frameQueued.notify_one();
+            m_thread.join();
         }
+
+        AVFrame* leftover = nullptr;
+        while (m_queue.TryPop(leftover)) av_frame_free(&leftover);
+
+        if (m_droppedFrames > 0) {
+            LOG_WARNING("Encoder fell behind, dropped ", m_droppedFrames, " of ", m_pts, " frames");
+            m_droppedFrames = 0;
+        }
+
+        // A shared muxer is closed by its owner once all of its sessions are finished
+        if (m_muxer && m_ownsMuxer) m_muxer->Close();
+        m_muxer.reset();
+        m_videoStream = nullptr;
+
+        if (m_codecCtx) avcodec_free_context(&m_codecCtx);
+        m_codecName.clear();
         
         if (m_hwFramesRef) av_buffer_unref(&m_hwFramesRef);
         if (m_hwDeviceRef) av_buffer_unref(&m_hwDeviceRef);
+        m_multithread.Reset();
+        m_surfaceBindFlags = 0;
     }
 
     void FFmpegBackend::InitHWContext(ID3D11Device* pDevice) {
@@ -44,6 +71,20 @@ namespace Video {
         d3d11Ctx->device = pDevice;
         pDevice->AddRef(); 
 
+        // The encoder thread drives the session through this device while the game keeps using its
+        // immediate context on the render thread. FFmpeg only turns on the runtime's locking when it creates
+        // the device itself, so it's done here, and FFmpeg's lock becomes that same (recursive) critical
+        // section, which the game's own context calls now enter too. It stays on for the device's lifetime:
+        // other sessions on it may still be running when this one finishes.
+        if (FAILED(pDevice->QueryInterface(IID_PPV_ARGS(&m_multithread)))) throw std::runtime_error("Device can't be multithread protected");
+        if (!m_multithread->GetMultithreadProtected()) {
+            m_multithread->SetMultithreadProtected(TRUE);
+            LOG_INFO("Enabled multithread protection on the game's device");
+        }
+        d3d11Ctx->lock = [](void* ctx) { ((ID3D10Multithread*)ctx)->Enter(); };
+        d3d11Ctx->unlock = [](void* ctx) { ((ID3D10Multithread*)ctx)->Leave(); };
+        d3d11Ctx->lock_ctx = m_multithread.Get();
+
         if (av_hwdevice_ctx_init(m_hwDeviceRef) < 0) throw std::runtime_error("Failed to init HW device ctx");
 
         m_hwFramesRef = av_hwframe_ctx_alloc(m_hwDeviceRef);
@@ -54,118 +95,228 @@ namespace Video {
         framesCtx->sw_format = AV_PIX_FMT_NV12; // Match DXGI_FORMAT_NV12
         framesCtx->width = m_width;
         framesCtx->height = m_height;
-        framesCtx->initial_pool_size = 20; // Ensure pool is allocated for CopyResource workflow
+        framesCtx->initial_pool_size = 20; // One texture array; frames are rendered into its slices
 
         // Explicitly set BindFlags to what we know works (BIND_RENDER_TARGET | BIND_SHADER_RESOURCE)
         // Failure 80070057 (E_INVALIDARG) suggests default flags (often BIND_DECODER) might be rejected for NV12 or by driver.
+        // Typed UAVs on NV12 let the fused compute kernel write the slices, but only where the device supports them.
         AVD3D11VAFramesContext* framesHwCtx = (AVD3D11VAFramesContext*)framesCtx->hwctx;
-        framesHwCtx->BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
+        UINT bindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
+        UINT support = 0;
+        if (SUCCEEDED(pDevice->CheckFormatSupport(DXGI_FORMAT_NV12, &support)) && (support & D3D11_FORMAT_SUPPORT_TYPED_UNORDERED_ACCESS_VIEW)) {
+            framesHwCtx->BindFlags = bindFlags | D3D11_BIND_UNORDERED_ACCESS;
+            framesHwCtx->MiscFlags = 0;
+            if (av_hwframe_ctx_init(m_hwFramesRef) >= 0) {
+                m_surfaceBindFlags = framesHwCtx->BindFlags;
+                return;
+            }
+
+            // Retry without UAVs in a fresh frames context, a failed init can't be reused
+            LOG_WARNING("NV12 pool with UAV binding rejected, using render targets");
+            av_buffer_unref(&m_hwFramesRef);
+            m_hwFramesRef = av_hwframe_ctx_alloc(m_hwDeviceRef);
+            if (!m_hwFramesRef) throw std::runtime_error("Failed to alloc HW frames ctx");
+            framesCtx = (AVHWFramesContext*)m_hwFramesRef->data;
+            framesCtx->format = AV_PIX_FMT_D3D11;
+            framesCtx->sw_format = AV_PIX_FMT_NV12;
+            framesCtx->width = m_width;
+            framesCtx->height = m_height;
+            framesCtx->initial_pool_size = 20;
+            framesHwCtx = (AVD3D11VAFramesContext*)framesCtx->hwctx;
+        }
+
+        framesHwCtx->BindFlags = bindFlags;
         framesHwCtx->MiscFlags = 0;
 
         if (av_hwframe_ctx_init(m_hwFramesRef) < 0) throw std::runtime_error("Failed to init HW frames ctx");
+        m_surfaceBindFlags = bindFlags;
     }
 
-    bool FFmpegBackend::Initialize(ID3D11Device* pDevice, int width, int height, int fps, const std::string& filename) {
-        m_width = width;
-        m_height = height;
+    bool FFmpegBackend::Initialize(ID3D11Device* pDevice, const EncoderSettings& settings) {
+        m_width = settings.width;
+        m_height = settings.height;
+        m_queueDepth = std::clamp(settings.queueDepth, (size_t)1, kMaxQueuedFrames);
+        m_dropOldest = settings.dropOldest;
 
         try {
             InitHWContext(pDevice);
 
-            const AVCodec* codec = avcodec_find_encoder_by_name("h264_nvenc");
-            if (!codec) {
-                LOG_WARNING("NVENC not found, trying h264_amf...");
-                codec = avcodec_find_encoder_by_name("h264_amf");
-            }
-            if (!codec) {
-                 LOG_WARNING("AMF not found, trying default h264...");
-                 codec = avcodec_find_encoder(AV_CODEC_ID_H264);
-            }
-            if (!codec) throw std::runtime_error("No encoder found!");
-
-            m_codecCtx = avcodec_alloc_context3(codec);
-            m_codecCtx->width = width;
-            m_codecCtx->height = height;
-            m_codecCtx->time_base = { 1, fps }; // Rational time base
-            m_codecCtx->framerate = { fps, 1 };
-            m_codecCtx->pix_fmt = AV_PIX_FMT_D3D11; 
-            
-            m_codecCtx->bit_rate = 50000000; // 50 Mbps
-            m_codecCtx->gop_size = fps * 2;
-            m_codecCtx->max_b_frames = 0; 
-            
-            m_codecCtx->hw_device_ctx = av_buffer_ref(m_hwDeviceRef);
-            m_codecCtx->hw_frames_ctx = av_buffer_ref(m_hwFramesRef);
-
-            if (avcodec_open2(m_codecCtx, codec, nullptr) < 0) throw std::runtime_error("Could not open codec");
+            // Opening is the capability check: a session fails to open above the GPU's size limits
+            for (const char* name : GetEncoderNames(settings.codec)) {
+                const AVCodec* codec = avcodec_find_encoder_by_name(name);
+                if (!codec || !AcceptsD3D11Frames(codec)) continue;
 
-            avformat_alloc_output_context2(&m_fmtCtx, nullptr, nullptr, filename.c_str());
-            m_videoStream = avformat_new_stream(m_fmtCtx, nullptr);
-            avcodec_parameters_from_context(m_videoStream->codecpar, m_codecCtx);
-            // Important: Rescale timebase? Handled by av_packet_rescale_ts later.
-            m_videoStream->time_base = m_codecCtx->time_base;
+                m_codecCtx = avcodec_alloc_context3(codec);
+                m_codecCtx->width = settings.width;
+                m_codecCtx->height = settings.height;
+                m_codecCtx->time_base = { 1, settings.fps }; // Rational time base
+                m_codecCtx->framerate = { settings.fps, 1 };
+                m_codecCtx->pix_fmt = AV_PIX_FMT_D3D11; 
+                
+                m_codecCtx->bit_rate = settings.bitRate;
+                m_codecCtx->gop_size = settings.gopSize;
+                m_codecCtx->max_b_frames = 0; 
+                
+                m_codecCtx->hw_device_ctx = av_buffer_ref(m_hwDeviceRef);
+                m_codecCtx->hw_frames_ctx = av_buffer_ref(m_hwFramesRef);
 
-            if (!(m_fmtCtx->oformat->flags & AVFMT_NOFILE)) {
-                if (avio_open(&m_fmtCtx->pb, filename.c_str(), AVIO_FLAG_WRITE) < 0) throw std::runtime_error("Could not open output file");
+                if (avcodec_open2(m_codecCtx, codec, nullptr) >= 0) {
+                    m_codecName = name;
+                    break;
+                }
+                LOG_WARNING(name, " can't encode ", settings.width, "x", settings.height);
+                avcodec_free_context(&m_codecCtx);
             }
+            if (!m_codecCtx) throw std::runtime_error(std::string("No hardware ") + GetCodecName(settings.codec) + " encoder");
 
-            AVDictionary* opt = nullptr;
-            av_dict_set(&opt, "movflags", "faststart", 0);
-            if (avformat_write_header(m_fmtCtx, &opt) < 0) {
-                throw std::runtime_error("Failed to write header");
-            }
+            // Either our own file, or one stream of a muxer started by whoever shares it
+            m_ownsMuxer = !settings.muxer;
+            m_muxer = m_ownsMuxer ? std::make_shared<Muxer>() : settings.muxer;
+            if (m_ownsMuxer && !m_muxer->Open(settings.filename, settings.output)) throw std::runtime_error("Could not open output file");
+
+            m_videoStream = m_muxer->AddStream(m_codecCtx);
+            if (!m_videoStream) throw std::runtime_error("Could not add stream");
+            if (m_ownsMuxer && !m_muxer->Start()) throw std::runtime_error("Failed to write header");
+
+            m_pts = 0;
+            m_droppedFrames = 0;
+            m_stopThread = false;
+            m_thread = std::thread(&FFmpegBackend::EncoderThread, this);
             
             return true;
         } catch (const std::exception& e) {
-            LOG_ERROR("FFmpeg Init Failed: ", e.what());
+            // Not fatal yet, the factory may still find another codec or backend
+            LOG_WARNING("FFmpeg Init Failed: ", e.what());
+            Finish();
             return false;
         }
     }
 
-    void FFmpegBackend::EncodeFrame(ID3D11Texture2D* pSourceTexture) {
-        std::lock_guard<std::mutex> lock(m_mutex);
+    AVFrame* FFmpegBackend::AllocateFrame() {
+        if (!m_thread.joinable()) return nullptr;
 
-        // 1. Allocate a frame from the HW pool
+        // Make room first, so a dropped frame's surface is back in the pool before we allocate
+        while (m_queue.Size() >= m_queueDepth) {
+            if (m_dropOldest) {
+                AVFrame* oldest = nullptr;
+                if (m_queue.TryPop(oldest)) {
+                    av_frame_free(&oldest);
+                    m_droppedFrames++;
+                }
+            } else {
+                // Missed notifications are covered by the timeout
+                std::unique_lock<std::mutex> lock(m_wakeMutex);
+                m_frameTaken.wait_for(lock, std::chrono::milliseconds(2), [this] { return m_queue.Size() < m_queueDepth; });
+            }
+        }
+
+        // frame->data[0] is the pool's Texture2DArray, frame->data[1] the array slice
         AVFrame* frame = av_frame_alloc();
         if (av_hwframe_get_buffer(m_hwFramesRef, frame, 0) < 0) {
             LOG_ERROR("Failed to allocate HW frame");
             av_frame_free(&frame);
-            return;
+            return nullptr;
         }
+        return frame;
+    }
 
-        // 2. Map/Copy Logic
-        // We need ID3D11DeviceContext to CopyResource.
-        // We can get it from the device associated with the HW context.
-        AVHWDeviceContext* deviceCtx = (AVHWDeviceContext*)m_hwDeviceRef->data;
-        AVD3D11VADeviceContext* d3d11Ctx = (AVD3D11VADeviceContext*)deviceCtx->hwctx;
-        ID3D11Device* device = d3d11Ctx->device;
-        
-        ID3D11DeviceContext* ctx = nullptr;
-        device->GetImmediateContext(&ctx);
-        
-        if (ctx) {
-            // FIX: Use CopySubresourceRegion instead of CopyResource
-            // frame->data[0] is the resource (likely Texture2DArray if pool > 0)
-            // frame->data[1] is the index (array slice) within that resource
-            
-            ID3D11Texture2D* dstTexture = (ID3D11Texture2D*)frame->data[0];
-            intptr_t index = (intptr_t)frame->data[1]; // Subresource index
+    void FFmpegBackend::QueueFrame(AVFrame* frame) {
+        // Timestamps are assigned here, so dropped frames leave a gap instead of speeding up the video
+        frame->pts = m_pts++;
 
-            // Copy entire texture to the specific subresource index
-            ctx->CopySubresourceRegion(dstTexture, (UINT)index, 0, 0, 0, pSourceTexture, 0, nullptr);
-            
-            ctx->Release();
+        // Space was made in AllocateFrame and we are the only producer, so this can't fail
+        m_queue.TryPush(frame, m_queueDepth);
+        m_frameQueued.notify_one();
+    }
+
+    void FFmpegBackend::LockDevice() {
+        // Keeps the encoder thread out of the device while we write a surface on the immediate context.
+        // The game's calls from this thread re-enter it, so holding it across a frame's writes is fine.
+        AVD3D11VADeviceContext* d3d11Ctx = (AVD3D11VADeviceContext*)((AVHWDeviceContext*)m_hwDeviceRef->data)->hwctx;
+        d3d11Ctx->lock(d3d11Ctx->lock_ctx);
+    }
+
+    void FFmpegBackend::UnlockDevice() {
+        AVD3D11VADeviceContext* d3d11Ctx = (AVD3D11VADeviceContext*)((AVHWDeviceContext*)m_hwDeviceRef->data)->hwctx;
+        d3d11Ctx->unlock(d3d11Ctx->lock_ctx);
+    }
+
+    void FFmpegBackend::EncodeFrame(ID3D11Texture2D* pSourceTexture, UINT sourceSubresource, const D3D11_BOX* sourceBox) {
+        // Render thread. Only the GPU copy happens here, the encoder thread does the rest.
+        AVFrame* frame = AllocateFrame();
+        if (!frame) return;
+
+        AVD3D11VADeviceContext* d3d11Ctx = (AVD3D11VADeviceContext*)((AVHWDeviceContext*)m_hwDeviceRef->data)->hwctx;
+        LockDevice();
+        d3d11Ctx->device_context->CopySubresourceRegion((ID3D11Texture2D*)frame->data[0], (UINT)(intptr_t)frame->data[1], 0, 0, 0, pSourceTexture, sourceSubresource, sourceBox);
+        UnlockDevice();
+
+        QueueFrame(frame);
+    }
+
+    bool FFmpegBackend::AcquireSurface(EncoderSurface& surface) {
+        AVFrame* frame = AllocateFrame();
+        if (!frame) return false;
+
+        surface.texture = (ID3D11Texture2D*)frame->data[0];
+        surface.arraySlice = (UINT)(intptr_t)frame->data[1];
+        surface.frame = frame;
+        LockDevice();
+        return true;
+    }
+
+    void FFmpegBackend::SubmitSurface(EncoderSurface& surface) {
+        if (!surface.frame) return;
+        UnlockDevice();
+        QueueFrame((AVFrame*)surface.frame);
+        surface = {};
+    }
+
+    void FFmpegBackend::DiscardSurface(EncoderSurface& surface) {
+        if (!surface.frame) return;
+        UnlockDevice();
+        AVFrame* frame = (AVFrame*)surface.frame;
+        av_frame_free(&frame); // Back to the pool
+        surface = {};
+    }
+
+    void FFmpegBackend::EncoderThread() {
+        AVPacket* pkt = av_packet_alloc();
+
+        for (;;) {
+            AVFrame* frame = nullptr;
+            if (m_queue.TryPop(frame)) {
+                m_frameTaken.notify_one();
+                SendFrame(frame, pkt);
+                av_frame_free(&frame); // Returns texture to pool
+                continue;
+            }
+
+            if (m_stopThread) {
+                // Anything pushed before the stop flag is still encoded
+                while (m_queue.TryPop(frame)) {
+                    SendFrame(frame, pkt);
+                    av_frame_free(&frame);
+                }
+                break;
+            }
+
+            // The producer notifies without taking the mutex, so the timeout covers a missed wakeup
+            std::unique_lock<std::mutex> lock(m_wakeMutex);
+            m_frameQueued.wait_for(lock, std::chrono::milliseconds(5), [this] { return !m_queue.Empty() || m_stopThread; });
         }
 
-        frame->pts = m_pts++;
+        // Flush encoder
+        SendFrame(nullptr, pkt);
+        av_packet_free(&pkt);
+    }
 
-        // 3. Send to Validated Frame
+    void FFmpegBackend::SendFrame(AVFrame* frame, AVPacket* pkt) {
         int ret = avcodec_send_frame(m_codecCtx, frame);
         if (ret < 0) {
             LOG_ERROR("Error sending frame to encoder: ", ret);
         }
 
-        AVPacket* pkt = av_packet_alloc();
         while (ret >= 0) {
             ret = avcodec_receive_packet(m_codecCtx, pkt);
             if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) break;
@@ -174,13 +325,7 @@ namespace Video {
                 break;
             }
 
-            av_packet_rescale_ts(pkt, m_codecCtx->time_base, m_videoStream->time_base);
-            pkt->stream_index = m_videoStream->index;
-            av_interleaved_write_frame(m_fmtCtx, pkt);
-            av_packet_unref(pkt);
+            m_muxer->WritePacket(pkt, m_codecCtx->time_base, m_videoStream);
         }
-
-        av_packet_free(&pkt);
-        av_frame_free(&frame); // Returns texture to pool
     }
 }
@@ -1,6 +1,13 @@
 #pragma once
 #include "Encoder.h"
+#include "Muxer.h"
+#include "../Core/SpscRing.h"
+#include <d3d10.h>
+#include <wrl/client.h>
+#include <atomic>
+#include <condition_variable>
 #include <mutex>
+#include <thread>
 
 #pragma warning(push)
 #pragma warning(disable: 4244)
@@ -20,23 +27,63 @@ namespace Video {
         FFmpegBackend();
         ~FFmpegBackend();
 
-        bool Initialize(ID3D11Device* pDevice, int width, int height, int fps, const std::string& filename) override;
-        void EncodeFrame(ID3D11Texture2D* pSourceTexture) override;
+        // Tries the hardware encoders for settings.codec (NVENC, then AMF) through libavcodec
+        bool Initialize(ID3D11Device* pDevice, const EncoderSettings& settings) override;
+        void EncodeFrame(ID3D11Texture2D* pSourceTexture, UINT sourceSubresource = 0, const D3D11_BOX* sourceBox = nullptr) override;
         void Finish() override;
 
+        // Surfaces come from the hw frame pool. The device lock is held from Acquire to Submit/Discard.
+        bool AcquireSurface(EncoderSurface& surface) override;
+        void SubmitSurface(EncoderSurface& surface) override;
+        void DiscardSurface(EncoderSurface& surface) override;
+        UINT GetSurfaceBindFlags() const override { return m_surfaceBindFlags; }
+        std::string GetName() const override { return "FFmpeg " + m_codecName; }
+        uint64_t GetDroppedFrames() const override { return m_droppedFrames; }
+        uint64_t GetQueuedFrames() const override { return m_queue.Size(); }
+
     private:
+        // Frames in flight between the render thread and the encoder thread.
+        // Has to stay below the hw pool size, the encoder holds a few surfaces of its own.
+        static constexpr size_t kMaxQueuedFrames = 8;
+
         void InitHWContext(ID3D11Device* pDevice);
 
-        AVFormatContext* m_fmtCtx = nullptr;
+        // Waits or drops per the queue policy until a frame fits, then takes one from the pool
+        AVFrame* AllocateFrame();
+        void QueueFrame(AVFrame* frame);
+        void LockDevice();
+        void UnlockDevice();
+
+        // Encoder thread: owns send/receive/mux from here on
+        void EncoderThread();
+        void SendFrame(AVFrame* frame, AVPacket* pkt); // nullptr frame flushes
+
+        std::shared_ptr<Muxer> m_muxer;
+        bool m_ownsMuxer = false;
         AVCodecContext* m_codecCtx = nullptr;
         AVStream* m_videoStream = nullptr;
+        std::string m_codecName;
         
         AVBufferRef* m_hwDeviceRef = nullptr;
         AVBufferRef* m_hwFramesRef = nullptr;
+        Microsoft::WRL::ComPtr<ID3D10Multithread> m_multithread; // lock_ctx of the hw device
         
-        std::mutex m_mutex;
+        std::mutex m_mutex; // Initialize/Finish
         int64_t m_pts = 0;
+
+        SpscRing<AVFrame*, kMaxQueuedFrames> m_queue;
+        size_t m_queueDepth = kMaxQueuedFrames;
+        bool m_dropOldest = true;
+        uint64_t m_droppedFrames = 0;
+
+        std::thread m_thread;
+        std::atomic<bool> m_stopThread{ false };
+        std::mutex m_wakeMutex;
+        std::condition_variable m_frameQueued;
+        std::condition_variable m_frameTaken;
+
         int m_width = 0;
         int m_height = 0;
+        UINT m_surfaceBindFlags = 0;
     };
 }
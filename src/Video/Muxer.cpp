@@ -0,0 +1,136 @@
+#include "pch.h"
+#include "Muxer.h"
+#include "AsyncFileWriter.h"
+#include "../Core/Logger.h"
+
+namespace Video {
+    Muxer::~Muxer() {
+        Close();
+    }
+
+    // name.mp4 -> name_%03d.mp4
+    static std::string GetSegmentPattern(const std::string& filename) {
+        size_t dot = filename.find_last_of('.');
+        size_t slash = filename.find_last_of("/\\");
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return filename + "_%03d";
+        return filename.substr(0, dot) + "_%03d" + filename.substr(dot);
+    }
+
+    static const char* kFragmentFlags = "frag_keyframe+empty_moov+default_base_moof";
+
+    int Muxer::OpenSegment(AVFormatContext* /*s*/, AVIOContext** pb, const char* url, int flags, AVDictionary** /*options*/) {
+        if (flags & AVIO_FLAG_READ) return AVERROR(ENOSYS);
+        *pb = AsyncFileWriter::Open(url);
+        return *pb ? 0 : AVERROR(EIO);
+    }
+
+    int Muxer::CloseSegment(AVFormatContext* /*s*/, AVIOContext* pb) {
+        return AsyncFileWriter::Close(&pb) ? 0 : AVERROR(EIO);
+    }
+
+    bool Muxer::Open(const std::string& filename, const OutputOptions& options) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_options = options;
+        m_asyncIo = options.fragmented || options.segmentSeconds > 0;
+
+        int ret = options.segmentSeconds > 0
+            ? avformat_alloc_output_context2(&m_fmtCtx, nullptr, "segment", GetSegmentPattern(filename).c_str())
+            : avformat_alloc_output_context2(&m_fmtCtx, nullptr, nullptr, filename.c_str());
+        if (ret < 0 || !m_fmtCtx) {
+            LOG_ERROR("No output format for ", filename);
+            return false;
+        }
+
+        // The segment muxer opens and closes each segment's file through these
+        if (m_asyncIo) {
+            m_fmtCtx->io_open = &Muxer::OpenSegment;
+            m_fmtCtx->io_close2 = &Muxer::CloseSegment;
+        }
+
+        if (!(m_fmtCtx->oformat->flags & AVFMT_NOFILE)) {
+            if (m_asyncIo) m_fmtCtx->pb = AsyncFileWriter::Open(filename);
+            else if (avio_open(&m_fmtCtx->pb, filename.c_str(), AVIO_FLAG_WRITE) < 0) m_fmtCtx->pb = nullptr;
+            if (!m_fmtCtx->pb) {
+                LOG_ERROR("Could not open output file ", filename);
+                avformat_free_context(m_fmtCtx);
+                m_fmtCtx = nullptr;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    AVStream* Muxer::AddStream(const AVCodecContext* codecCtx) {
+        AVCodecParameters* codecPar = avcodec_parameters_alloc();
+        if (!codecPar) return nullptr;
+        AVStream* stream = avcodec_parameters_from_context(codecPar, codecCtx) >= 0 ? AddStream(codecPar, codecCtx->time_base) : nullptr;
+        avcodec_parameters_free(&codecPar);
+        return stream;
+    }
+
+    AVStream* Muxer::AddStream(const AVCodecParameters* codecPar, AVRational timeBase) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_fmtCtx || m_headerWritten) return nullptr;
+
+        AVStream* stream = avformat_new_stream(m_fmtCtx, nullptr);
+        if (!stream) return nullptr;
+        avcodec_parameters_copy(stream->codecpar, codecPar);
+        // The muxer may pick its own time base in Start, packets are rescaled on write
+        stream->time_base = timeBase;
+        // hvc1 rather than hev1, players on Apple platforms only accept the former in MP4
+        if (codecPar->codec_id == AV_CODEC_ID_HEVC) stream->codecpar->codec_tag = MKTAG('h', 'v', 'c', '1');
+        return stream;
+    }
+
+    bool Muxer::Start() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_fmtCtx) return false;
+
+        AVDictionary* opt = nullptr;
+        if (m_options.segmentSeconds > 0) {
+            // Splits at keyframes of the first video stream, tiles share its GOP so they split with it
+            av_dict_set(&opt, "segment_format", "mp4", 0);
+            av_dict_set_int(&opt, "segment_time", m_options.segmentSeconds, 0);
+            av_dict_set(&opt, "reset_timestamps", "1", 0);
+            if (m_options.fragmented) av_dict_set(&opt, "segment_format_options", (std::string("movflags=") + kFragmentFlags).c_str(), 0);
+        } else {
+            av_dict_set(&opt, "movflags", m_options.fragmented ? kFragmentFlags : "faststart", 0);
+        }
+        int ret = avformat_write_header(m_fmtCtx, &opt);
+        av_dict_free(&opt);
+        if (ret < 0) {
+            LOG_ERROR("Failed to write header");
+            return false;
+        }
+        m_headerWritten = true;
+        return true;
+    }
+
+    void Muxer::WritePacket(AVPacket* pkt, AVRational codecTimeBase, AVStream* stream) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_headerWritten) {
+            av_packet_unref(pkt);
+            return;
+        }
+
+        av_packet_rescale_ts(pkt, codecTimeBase, stream->time_base);
+        pkt->stream_index = stream->index;
+        // Interleaves by dts across the streams, takes ownership of the packet's data
+        av_interleaved_write_frame(m_fmtCtx, pkt);
+        av_packet_unref(pkt);
+    }
+
+    void Muxer::Close() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_fmtCtx) return;
+
+        if (m_headerWritten) av_write_trailer(m_fmtCtx);
+        if (!(m_fmtCtx->oformat->flags & AVFMT_NOFILE)) {
+            if (m_asyncIo) AsyncFileWriter::Close(&m_fmtCtx->pb);
+            else avio_closep(&m_fmtCtx->pb);
+        }
+        avformat_free_context(m_fmtCtx);
+        m_fmtCtx = nullptr;
+        m_headerWritten = false;
+    }
+}
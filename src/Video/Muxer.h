@@ -0,0 +1,46 @@
+#pragma once
+#include "Encoder.h"
+#include <mutex>
+#include <string>
+
+#pragma warning(push)
+#pragma warning(disable: 4244)
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+#pragma warning(pop)
+
+namespace Video {
+    // One output file (or segment series), shared by every encoder session that writes a stream into it.
+    // Streams are added between Open and Start; after Start any encoder thread may write packets.
+    //
+    // Fragmented and segmented output go through AsyncFileWriter, so disk I/O stays off the encoder
+    // threads. A plain MP4 keeps libavformat's own I/O, its faststart pass needs to read the file back.
+    class Muxer {
+    public:
+        ~Muxer();
+
+        bool Open(const std::string& filename, const OutputOptions& options);
+        AVStream* AddStream(const AVCodecContext* codecCtx); // nullptr on failure
+        AVStream* AddStream(const AVCodecParameters* codecPar, AVRational timeBase); // For sessions without a codec context
+        bool Start(); // Writes the header
+
+        // Thread-safe. Rescales pkt from the codec's time base to the stream's and unrefs it.
+        void WritePacket(AVPacket* pkt, AVRational codecTimeBase, AVStream* stream);
+
+        // Writes the trailer once the sessions are finished, safe to call twice
+        void Close();
+
+    private:
+        // Segment files are opened by the segment muxer through these
+        static int OpenSegment(AVFormatContext* s, AVIOContext** pb, const char* url, int flags, AVDictionary** options);
+        static int CloseSegment(AVFormatContext* s, AVIOContext* pb);
+
+        std::mutex m_mutex;
+        AVFormatContext* m_fmtCtx = nullptr;
+        OutputOptions m_options;
+        bool m_asyncIo = false;
+        bool m_headerWritten = false;
+    };
+}
@@ -0,0 +1,228 @@
+#include "pch.h"
+#include "NativeEncoder.h"
+#include "../Core/Logger.h"
+#include <d3d10.h>
+#include <algorithm>
+#include <cstring>
+
+namespace Video {
+    bool NativeEncoder::CreatePool(ID3D11Device* pDevice, int width, int height) {
+        D3D11_TEXTURE2D_DESC desc = {};
+        desc.Width = (UINT)width;
+        desc.Height = (UINT)height;
+        desc.MipLevels = 1;
+        desc.ArraySize = 1; // One texture per surface, the SDKs register whole textures
+        desc.Format = DXGI_FORMAT_NV12;
+        desc.SampleDesc.Count = 1;
+        desc.Usage = D3D11_USAGE_DEFAULT;
+        desc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
+
+        // Same rule as the FFmpeg pool: UAVs for the fused kernel where NV12 supports them
+        UINT support = 0;
+        if (SUCCEEDED(pDevice->CheckFormatSupport(DXGI_FORMAT_NV12, &support)) && (support & D3D11_FORMAT_SUPPORT_TYPED_UNORDERED_ACCESS_VIEW)) {
+            desc.BindFlags |= D3D11_BIND_UNORDERED_ACCESS;
+            Microsoft::WRL::ComPtr<ID3D11Texture2D> probe;
+            if (FAILED(pDevice->CreateTexture2D(&desc, nullptr, &probe))) desc.BindFlags &= ~D3D11_BIND_UNORDERED_ACCESS;
+        }
+
+        m_pool.resize(kPoolSize);
+        for (auto& texture : m_pool) {
+            if (FAILED(pDevice->CreateTexture2D(&desc, nullptr, texture.GetAddressOf()))) return false;
+        }
+        m_surfaceBindFlags = desc.BindFlags;
+        return true;
+    }
+
+    bool NativeEncoder::Initialize(ID3D11Device* pDevice, const EncoderSettings& settings) {
+        m_queueDepth = std::clamp(settings.queueDepth, (size_t)1, kMaxQueuedFrames);
+        m_dropOldest = settings.dropOldest;
+        m_timeBase = { 1, settings.fps };
+
+        // The session runs on the encoder thread while the game keeps using the immediate context,
+        // see FFmpegBackend::InitHWContext
+        Microsoft::WRL::ComPtr<ID3D10Multithread> multithread;
+        if (FAILED(pDevice->QueryInterface(IID_PPV_ARGS(&multithread)))) return false;
+        if (!multithread->GetMultithreadProtected()) {
+            multithread->SetMultithreadProtected(TRUE);
+            LOG_INFO("Enabled multithread protection on the game's device");
+        }
+        pDevice->GetImmediateContext(&m_context);
+
+        AVCodecParameters* codecPar = avcodec_parameters_alloc();
+        if (!codecPar) return false;
+        codecPar->codec_type = AVMEDIA_TYPE_VIDEO;
+        codecPar->width = settings.width;
+        codecPar->height = settings.height;
+        codecPar->format = AV_PIX_FMT_NV12;
+        codecPar->bit_rate = settings.bitRate;
+
+        bool ok = CreatePool(pDevice, settings.width, settings.height);
+        if (ok) ok = m_sessionOpen = OpenSession(pDevice, settings, codecPar);
+        if (ok) {
+            // Either our own file, or one stream of a muxer started by whoever shares it
+            m_ownsMuxer = !settings.muxer;
+            m_muxer = m_ownsMuxer ? std::make_shared<Muxer>() : settings.muxer;
+            ok = (!m_ownsMuxer || m_muxer->Open(settings.filename, settings.output))
+                && (m_videoStream = m_muxer->AddStream(codecPar, m_timeBase)) != nullptr
+                && (!m_ownsMuxer || m_muxer->Start());
+            if (!ok) LOG_WARNING("Could not open the output for ", GetName());
+        }
+        avcodec_parameters_free(&codecPar);
+
+        if (ok) ok = (m_packet = av_packet_alloc()) != nullptr;
+        if (!ok) {
+            // Not fatal yet, the factory may still find another codec or backend
+            Finish();
+            return false;
+        }
+
+        m_pts = 0;
+        m_droppedFrames = 0;
+        m_busySurfaces = 0;
+        m_stopThread = false;
+        m_thread = std::thread(&NativeEncoder::EncoderThread, this);
+        return true;
+    }
+
+    void NativeEncoder::Finish() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        // The encoder thread drains the queue and flushes the session before it exits
+        if (m_thread.joinable()) {
+            m_stopThread = true;
+            m_frameQueued.notify_one();
+            m_thread.join();
+        }
+
+        int leftover = -1;
+        while (m_queue.TryPop(leftover)) ReleaseSurface(leftover);
+
+        if (m_droppedFrames > 0) {
+            LOG_WARNING("Encoder fell behind, dropped ", m_droppedFrames, " of ", m_pts, " frames");
+            m_droppedFrames = 0;
+        }
+
+        // A shared muxer is closed by its owner once all of its sessions are finished
+        if (m_muxer && m_ownsMuxer) m_muxer->Close();
+        m_muxer.reset();
+        m_videoStream = nullptr;
+        if (m_packet) av_packet_free(&m_packet);
+
+        if (m_sessionOpen) CloseSession();
+        m_sessionOpen = false;
+        m_pool.clear();
+        m_context.Reset();
+        m_surfaceBindFlags = 0;
+    }
+
+    int NativeEncoder::AllocateSurface() {
+        if (!m_thread.joinable()) return -1;
+
+        // Make room first, so a dropped frame's surface is free again before we claim one
+        for (;;) {
+            uint32_t busy = m_busySurfaces.load(std::memory_order_acquire);
+            bool queueFull = m_queue.Size() >= m_queueDepth;
+            if (!queueFull && busy != (1u << kPoolSize) - 1) {
+                // Only this thread claims, the encoder thread only clears bits
+                int index = 0;
+                while (busy & (1u << index)) ++index;
+                m_busySurfaces.fetch_or(1u << index, std::memory_order_acq_rel);
+                return index;
+            }
+
+            int oldest = -1;
+            if (m_dropOldest && m_queue.TryPop(oldest)) {
+                ReleaseSurface(oldest);
+                m_droppedFrames++;
+            } else if (m_dropOldest && !queueFull) {
+                // Every surface is in the session and nothing is queued: this frame is the one dropped
+                m_droppedFrames++;
+                m_pts++;
+                return -1;
+            } else {
+                // Missed notifications are covered by the timeout
+                std::unique_lock<std::mutex> lock(m_wakeMutex);
+                m_frameTaken.wait_for(lock, std::chrono::milliseconds(2));
+            }
+        }
+    }
+
+    void NativeEncoder::QueueSurface(int index) {
+        // Timestamps are assigned here, so dropped frames leave a gap instead of speeding up the video.
+        // The ring's push publishes the surface's timestamp along with it.
+        m_surfacePts[index] = m_pts++;
+
+        // Space was made in AllocateSurface and we are the only producer, so this can't fail
+        m_queue.TryPush(index, m_queueDepth);
+        m_frameQueued.notify_one();
+    }
+
+    void NativeEncoder::ReleaseSurface(int index) {
+        m_busySurfaces.fetch_and(~(1u << index), std::memory_order_acq_rel);
+        m_frameTaken.notify_one();
+    }
+
+    void NativeEncoder::EncodeFrame(ID3D11Texture2D* pSourceTexture, UINT sourceSubresource, const D3D11_BOX* sourceBox) {
+        // Render thread. Only the GPU copy happens here, the encoder thread does the rest.
+        int index = AllocateSurface();
+        if (index < 0) return;
+
+        m_context->CopySubresourceRegion(m_pool[index].Get(), 0, 0, 0, 0, pSourceTexture, sourceSubresource, sourceBox);
+        QueueSurface(index);
+    }
+
+    bool NativeEncoder::AcquireSurface(EncoderSurface& surface) {
+        int index = AllocateSurface();
+        if (index < 0) return false;
+
+        surface.texture = m_pool[index].Get();
+        surface.arraySlice = 0;
+        surface.frame = (void*)(intptr_t)(index + 1);
+        return true;
+    }
+
+    void NativeEncoder::SubmitSurface(EncoderSurface& surface) {
+        if (!surface.frame) return;
+        QueueSurface((int)(intptr_t)surface.frame - 1);
+        surface = {};
+    }
+
+    void NativeEncoder::DiscardSurface(EncoderSurface& surface) {
+        if (!surface.frame) return;
+        ReleaseSurface((int)(intptr_t)surface.frame - 1);
+        surface = {};
+    }
+
+    void NativeEncoder::WritePacket(const void* data, size_t size, int64_t pts, bool keyframe) {
+        if (av_new_packet(m_packet, (int)size) < 0) return;
+        memcpy(m_packet->data, data, size);
+        // No B-frames, so decode order is presentation order
+        m_packet->pts = pts;
+        m_packet->dts = pts;
+        if (keyframe) m_packet->flags |= AV_PKT_FLAG_KEY;
+        m_muxer->WritePacket(m_packet, m_timeBase, m_videoStream);
+    }
+
+    void NativeEncoder::EncoderThread() {
+        for (;;) {
+            int index = -1;
+            if (m_queue.TryPop(index)) {
+                m_frameTaken.notify_one();
+                EncodeSurface(index, m_surfacePts[index]);
+                continue;
+            }
+
+            if (m_stopThread) {
+                // Anything pushed before the stop flag is still encoded
+                while (m_queue.TryPop(index)) EncodeSurface(index, m_surfacePts[index]);
+                break;
+            }
+
+            // The producer notifies without taking the mutex, so the timeout covers a missed wakeup
+            std::unique_lock<std::mutex> lock(m_wakeMutex);
+            m_frameQueued.wait_for(lock, std::chrono::milliseconds(5), [this] { return !m_queue.Empty() || m_stopThread; });
+        }
+
+        FlushSession();
+    }
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include "Encoder.h"
+#include "Muxer.h"
+#include "../Core/SpscRing.h"
+#include <wrl/client.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace Video {
+    // Common part of the backends that drive a vendor SDK directly (NvencBackend, AmfBackend): a pool of
+    // NV12 input textures the session reads in place, the queue to the encoder thread with the same
+    // policy as FFmpegBackend, and the muxer stream. Subclasses open the session and encode surfaces.
+    //
+    // A pool surface is owned by the render thread from AcquireSurface to SubmitSurface, then by the
+    // encoder thread until the subclass hands it back with ReleaseSurface, once the hardware has read it.
+    class NativeEncoder : public Encoder {
+    public:
+        bool Initialize(ID3D11Device* pDevice, const EncoderSettings& settings) override;
+        void EncodeFrame(ID3D11Texture2D* pSourceTexture, UINT sourceSubresource = 0, const D3D11_BOX* sourceBox = nullptr) override;
+        // Subclass destructors call this, the session is gone by the time ours runs
+        void Finish() override;
+
+        bool AcquireSurface(EncoderSurface& surface) override;
+        void SubmitSurface(EncoderSurface& surface) override;
+        void DiscardSurface(EncoderSurface& surface) override;
+        UINT GetSurfaceBindFlags() const override { return m_surfaceBindFlags; }
+        uint64_t GetDroppedFrames() const override { return m_droppedFrames; }
+        uint64_t GetQueuedFrames() const override { return m_queue.Size(); }
+
+    protected:
+        // Frames a session may keep encoding before handing their surfaces back
+        static constexpr int kMaxInFlight = 2;
+
+        // Opens the session for settings and prepares the pool textures for it. Fills codecPar's codec id
+        // and extradata (the parameter sets the container needs ahead of the first packet).
+        virtual bool OpenSession(ID3D11Device* pDevice, const EncoderSettings& settings, AVCodecParameters* codecPar) = 0;
+        virtual void CloseSession() = 0;
+
+        // Encoder thread. Starts encoding pool surface index with timestamp pts; completed frames go to
+        // WritePacket and their surfaces back through ReleaseSurface, keeping at most kMaxInFlight.
+        virtual void EncodeSurface(int index, int64_t pts) = 0;
+        // Encoder thread, after the last frame: completes and releases everything still in flight
+        virtual void FlushSession() = 0;
+
+        void WritePacket(const void* data, size_t size, int64_t pts, bool keyframe);
+        void ReleaseSurface(int index);
+
+        int GetPoolSize() const { return (int)m_pool.size(); }
+        ID3D11Texture2D* GetPoolTexture(int index) const { return m_pool[index].Get(); }
+
+    private:
+        static constexpr size_t kMaxQueuedFrames = 8;
+        // Queued frames, the ones in flight and the one the render thread writes
+        static constexpr int kPoolSize = (int)kMaxQueuedFrames + kMaxInFlight + 1;
+        static_assert(kPoolSize <= 32, "Pool surfaces are tracked in a 32-bit mask");
+
+        bool CreatePool(ID3D11Device* pDevice, int width, int height);
+        // Waits or drops per the queue policy until a frame fits, then claims a free surface. -1 if none.
+        int AllocateSurface();
+        void QueueSurface(int index);
+
+        void EncoderThread();
+
+        std::vector<Microsoft::WRL::ComPtr<ID3D11Texture2D>> m_pool;
+        std::atomic<uint32_t> m_busySurfaces{ 0 }; // Bit i: pool surface i is claimed
+        int64_t m_surfacePts[kPoolSize] = {};      // Written before the surface is queued
+        Microsoft::WRL::ComPtr<ID3D11DeviceContext> m_context;
+        UINT m_surfaceBindFlags = 0;
+
+        std::shared_ptr<Muxer> m_muxer;
+        bool m_ownsMuxer = false;
+        AVStream* m_videoStream = nullptr;
+        AVRational m_timeBase = { 1, 60 };
+        AVPacket* m_packet = nullptr; // Encoder thread
+
+        std::mutex m_mutex; // Initialize/Finish
+        bool m_sessionOpen = false;
+        int64_t m_pts = 0;
+
+        SpscRing<int, kMaxQueuedFrames> m_queue;
+        size_t m_queueDepth = kMaxQueuedFrames;
+        bool m_dropOldest = true;
+        uint64_t m_droppedFrames = 0;
+
+        std::thread m_thread;
+        std::atomic<bool> m_stopThread{ false };
+        std::mutex m_wakeMutex;
+        std::condition_variable m_frameQueued;
+        std::condition_variable m_frameTaken;
+    };
+}
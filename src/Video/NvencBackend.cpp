@@ -0,0 +1,300 @@
+#include "pch.h"
+#include "NvencBackend.h"
+#include "../Core/Logger.h"
+#include <ffnvcodec/nvEncodeAPI.h>
+#include <algorithm>
+#include <cstring>
+
+namespace Video {
+    // Loaded once and kept for the process, nullptr without an NVIDIA driver new enough for our headers
+    static const NV_ENCODE_API_FUNCTION_LIST* GetApi() {
+        static const NV_ENCODE_API_FUNCTION_LIST* api = []() -> const NV_ENCODE_API_FUNCTION_LIST* {
+            using GetMaxSupportedVersionFn = NVENCSTATUS(NVENCAPI*)(uint32_t*);
+            using CreateInstanceFn = NVENCSTATUS(NVENCAPI*)(NV_ENCODE_API_FUNCTION_LIST*);
+
+#ifdef _WIN64
+            HMODULE module = LoadLibraryW(L"nvEncodeAPI64.dll");
+#else
+            HMODULE module = LoadLibraryW(L"nvEncodeAPI.dll");
+#endif
+            if (!module) return nullptr;
+            auto getMaxSupportedVersion = (GetMaxSupportedVersionFn)GetProcAddress(module, "NvEncodeAPIGetMaxSupportedVersion");
+            auto createInstance = (CreateInstanceFn)GetProcAddress(module, "NvEncodeAPICreateInstance");
+            if (!getMaxSupportedVersion || !createInstance) return nullptr;
+
+            uint32_t version = 0;
+            uint32_t required = (NVENCAPI_MAJOR_VERSION << 4) | NVENCAPI_MINOR_VERSION;
+            if (getMaxSupportedVersion(&version) != NV_ENC_SUCCESS || version < required) {
+                LOG_WARNING("NVENC driver supports API ", version >> 4, ".", version & 0xF, ", ", NVENCAPI_MAJOR_VERSION, ".", NVENCAPI_MINOR_VERSION, " needed");
+                return nullptr;
+            }
+
+            static NV_ENCODE_API_FUNCTION_LIST functions = {};
+            functions.version = NV_ENCODE_API_FUNCTION_LIST_VER;
+            if (createInstance(&functions) != NV_ENC_SUCCESS) return nullptr;
+            return &functions;
+        }();
+        return api;
+    }
+
+    static GUID GetCodecGuid(Codec codec) {
+        switch (codec) {
+            case Codec::HEVC: return NV_ENC_CODEC_HEVC_GUID;
+            case Codec::AV1:  return NV_ENC_CODEC_AV1_GUID;
+            default:          return NV_ENC_CODEC_H264_GUID;
+        }
+    }
+
+    static AVCodecID GetCodecId(Codec codec) {
+        switch (codec) {
+            case Codec::HEVC: return AV_CODEC_ID_HEVC;
+            case Codec::AV1:  return AV_CODEC_ID_AV1;
+            default:          return AV_CODEC_ID_H264;
+        }
+    }
+
+    static void* OpenEncodeSession(const NV_ENCODE_API_FUNCTION_LIST& api, ID3D11Device* pDevice) {
+        NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS params = {};
+        params.version = NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS_VER;
+        params.deviceType = NV_ENC_DEVICE_TYPE_DIRECTX;
+        params.device = pDevice;
+        params.apiVersion = NVENCAPI_VERSION;
+
+        void* encoder = nullptr;
+        if (api.nvEncOpenEncodeSessionEx(&params, &encoder) != NV_ENC_SUCCESS) {
+            if (encoder) api.nvEncDestroyEncoder(encoder);
+            return nullptr;
+        }
+        return encoder;
+    }
+
+    // The capability query proper: is codecGuid among the session's encoders, and up to which size
+    static bool GetSessionCaps(const NV_ENCODE_API_FUNCTION_LIST& api, void* encoder, const GUID& codecGuid, EncoderCaps& caps) {
+        uint32_t count = 0;
+        if (api.nvEncGetEncodeGUIDCount(encoder, &count) != NV_ENC_SUCCESS || count == 0) return false;
+        std::vector<GUID> guids(count);
+        if (api.nvEncGetEncodeGUIDs(encoder, guids.data(), count, &count) != NV_ENC_SUCCESS) return false;
+        if (std::find(guids.begin(), guids.begin() + count, codecGuid) == guids.begin() + count) return false;
+
+        NV_ENC_CAPS_PARAM param = {};
+        param.version = NV_ENC_CAPS_PARAM_VER;
+        param.capsToQuery = NV_ENC_CAPS_WIDTH_MAX;
+        if (api.nvEncGetEncodeCaps(encoder, codecGuid, &param, &caps.maxWidth) != NV_ENC_SUCCESS) return false;
+        param.capsToQuery = NV_ENC_CAPS_HEIGHT_MAX;
+        if (api.nvEncGetEncodeCaps(encoder, codecGuid, &param, &caps.maxHeight) != NV_ENC_SUCCESS) return false;
+        return true;
+    }
+
+    bool NvencBackend::QueryCaps(ID3D11Device* pDevice, Codec codec, EncoderCaps& caps) {
+        const NV_ENCODE_API_FUNCTION_LIST* api = GetApi();
+        if (!api) return false;
+        void* encoder = OpenEncodeSession(*api, pDevice);
+        if (!encoder) return false;
+
+        bool supported = GetSessionCaps(*api, encoder, GetCodecGuid(codec), caps);
+        api->nvEncDestroyEncoder(encoder);
+        return supported;
+    }
+
+    NvencBackend::~NvencBackend() {
+        Finish();
+    }
+
+    std::string NvencBackend::GetName() const {
+        return std::string("NVENC ") + GetCodecName(m_codec);
+    }
+
+    bool NvencBackend::OpenSession(ID3D11Device* pDevice, const EncoderSettings& settings, AVCodecParameters* codecPar) {
+        const NV_ENCODE_API_FUNCTION_LIST* api = GetApi();
+        if (!api) return false;
+
+        m_codec = settings.codec;
+        m_width = settings.width;
+        m_height = settings.height;
+        m_encoder = OpenEncodeSession(*api, pDevice);
+        if (!m_encoder) return false;
+
+        GUID codecGuid = GetCodecGuid(settings.codec);
+        EncoderCaps caps;
+        if (!GetSessionCaps(*api, m_encoder, codecGuid, caps) || !caps.Fits(settings.width, settings.height)) {
+            CloseSession();
+            return false;
+        }
+
+        // P4 is the driver's balanced preset. No B-frames and no lookahead, so every picture
+        // comes back as soon as it is encoded and in submission order.
+        NV_ENC_PRESET_CONFIG preset = {};
+        preset.version = NV_ENC_PRESET_CONFIG_VER;
+        preset.presetCfg.version = NV_ENC_CONFIG_VER;
+        if (api->nvEncGetEncodePresetConfigEx(m_encoder, codecGuid, NV_ENC_PRESET_P4_GUID, NV_ENC_TUNING_INFO_HIGH_QUALITY, &preset) != NV_ENC_SUCCESS) {
+            CloseSession();
+            return false;
+        }
+
+        NV_ENC_CONFIG& config = preset.presetCfg;
+        config.gopLength = (uint32_t)settings.gopSize;
+        config.frameIntervalP = 1;
+        config.rcParams.rateControlMode = NV_ENC_PARAMS_RC_CBR;
+        config.rcParams.averageBitRate = (uint32_t)settings.bitRate;
+        config.rcParams.maxBitRate = (uint32_t)settings.bitRate;
+        config.rcParams.enableLookahead = 0;
+        switch (settings.codec) {
+            case Codec::HEVC: config.encodeCodecConfig.hevcConfig.idrPeriod = config.gopLength; break;
+            case Codec::AV1:  config.encodeCodecConfig.av1Config.idrPeriod = config.gopLength; break;
+            default:          config.encodeCodecConfig.h264Config.idrPeriod = config.gopLength; break;
+        }
+
+        NV_ENC_INITIALIZE_PARAMS init = {};
+        init.version = NV_ENC_INITIALIZE_PARAMS_VER;
+        init.encodeGUID = codecGuid;
+        init.presetGUID = NV_ENC_PRESET_P4_GUID;
+        init.tuningInfo = NV_ENC_TUNING_INFO_HIGH_QUALITY;
+        init.encodeWidth = init.darWidth = init.maxEncodeWidth = (uint32_t)settings.width;
+        init.encodeHeight = init.darHeight = init.maxEncodeHeight = (uint32_t)settings.height;
+        init.frameRateNum = (uint32_t)settings.fps;
+        init.frameRateDen = 1;
+        init.enablePTD = 1;
+        init.encodeConfig = &config;
+        if (api->nvEncInitializeEncoder(m_encoder, &init) != NV_ENC_SUCCESS) {
+            LOG_WARNING("NVENC rejected ", GetCodecName(settings.codec), " at ", settings.width, "x", settings.height);
+            CloseSession();
+            return false;
+        }
+
+        // Every pool texture is registered once, the encoder reads it in place
+        m_slots.resize(GetPoolSize());
+        for (int i = 0; i < GetPoolSize(); ++i) {
+            NV_ENC_REGISTER_RESOURCE reg = {};
+            reg.version = NV_ENC_REGISTER_RESOURCE_VER;
+            reg.resourceType = NV_ENC_INPUT_RESOURCE_TYPE_DIRECTX;
+            reg.width = (uint32_t)settings.width;
+            reg.height = (uint32_t)settings.height;
+            reg.resourceToRegister = GetPoolTexture(i);
+            reg.bufferFormat = NV_ENC_BUFFER_FORMAT_NV12;
+            reg.bufferUsage = NV_ENC_INPUT_IMAGE;
+
+            NV_ENC_CREATE_BITSTREAM_BUFFER bitstream = {};
+            bitstream.version = NV_ENC_CREATE_BITSTREAM_BUFFER_VER;
+
+            if (api->nvEncRegisterResource(m_encoder, &reg) != NV_ENC_SUCCESS
+                || api->nvEncCreateBitstreamBuffer(m_encoder, &bitstream) != NV_ENC_SUCCESS) {
+                LOG_WARNING("NVENC could not register the input surfaces");
+                m_slots[i].registered = reg.registeredResource;
+                CloseSession();
+                return false;
+            }
+            m_slots[i].registered = reg.registeredResource;
+            m_slots[i].bitstream = bitstream.bitstreamBuffer;
+        }
+
+        // SPS/PPS (or the AV1 sequence header) go into the container ahead of the first packet
+        uint8_t header[1024];
+        uint32_t headerSize = 0;
+        NV_ENC_SEQUENCE_PARAM_PAYLOAD payload = {};
+        payload.version = NV_ENC_SEQUENCE_PARAM_PAYLOAD_VER;
+        payload.inBufferSize = sizeof(header);
+        payload.spsppsBuffer = header;
+        payload.outSPSPPSPayloadSize = &headerSize;
+        if (api->nvEncGetSequenceParams(m_encoder, &payload) != NV_ENC_SUCCESS || headerSize == 0) {
+            CloseSession();
+            return false;
+        }
+
+        codecPar->codec_id = GetCodecId(settings.codec);
+        codecPar->extradata = (uint8_t*)av_mallocz(headerSize + AV_INPUT_BUFFER_PADDING_SIZE);
+        if (!codecPar->extradata) {
+            CloseSession();
+            return false;
+        }
+        memcpy(codecPar->extradata, header, headerSize);
+        codecPar->extradata_size = (int)headerSize;
+        return true;
+    }
+
+    void NvencBackend::CloseSession() {
+        const NV_ENCODE_API_FUNCTION_LIST* api = GetApi();
+        if (!api || !m_encoder) return;
+
+        for (Slot& slot : m_slots) {
+            if (slot.mapped) api->nvEncUnmapInputResource(m_encoder, slot.mapped);
+            if (slot.registered) api->nvEncUnregisterResource(m_encoder, slot.registered);
+            if (slot.bitstream) api->nvEncDestroyBitstreamBuffer(m_encoder, slot.bitstream);
+        }
+        m_slots.clear();
+        m_inFlight.clear();
+
+        api->nvEncDestroyEncoder(m_encoder);
+        m_encoder = nullptr;
+    }
+
+    void NvencBackend::EncodeSurface(int index, int64_t pts) {
+        const NV_ENCODE_API_FUNCTION_LIST& api = *GetApi();
+        Slot& slot = m_slots[index];
+
+        NV_ENC_MAP_INPUT_RESOURCE map = {};
+        map.version = NV_ENC_MAP_INPUT_RESOURCE_VER;
+        map.registeredResource = slot.registered;
+        if (api.nvEncMapInputResource(m_encoder, &map) != NV_ENC_SUCCESS) {
+            LOG_ERROR("NVENC could not map an input surface");
+            ReleaseSurface(index);
+            return;
+        }
+        slot.mapped = map.mappedResource;
+
+        NV_ENC_PIC_PARAMS pic = {};
+        pic.version = NV_ENC_PIC_PARAMS_VER;
+        pic.inputWidth = (uint32_t)m_width;
+        pic.inputHeight = (uint32_t)m_height;
+        pic.inputBuffer = map.mappedResource;
+        pic.bufferFmt = map.mappedBufferFmt;
+        pic.outputBitstream = slot.bitstream;
+        pic.pictureStruct = NV_ENC_PIC_STRUCT_FRAME;
+        pic.inputTimeStamp = (uint64_t)pts;
+
+        NVENCSTATUS status = api.nvEncEncodePicture(m_encoder, &pic);
+        if (status != NV_ENC_SUCCESS) {
+            LOG_ERROR("Error sending frame to encoder: ", (int)status);
+            api.nvEncUnmapInputResource(m_encoder, slot.mapped);
+            slot.mapped = nullptr;
+            ReleaseSurface(index);
+            return;
+        }
+
+        // The bitstream of a frame is locked only once the next ones are queued behind it,
+        // so the GPU encodes while this thread waits on the oldest
+        m_inFlight.push_back(index);
+        while ((int)m_inFlight.size() > kMaxInFlight) CompleteOldest();
+    }
+
+    void NvencBackend::CompleteOldest() {
+        const NV_ENCODE_API_FUNCTION_LIST& api = *GetApi();
+        int index = m_inFlight.front();
+        m_inFlight.pop_front();
+        Slot& slot = m_slots[index];
+
+        NV_ENC_LOCK_BITSTREAM lock = {};
+        lock.version = NV_ENC_LOCK_BITSTREAM_VER;
+        lock.outputBitstream = slot.bitstream;
+        if (api.nvEncLockBitstream(m_encoder, &lock) == NV_ENC_SUCCESS) {
+            bool keyframe = lock.pictureType == NV_ENC_PIC_TYPE_IDR || lock.pictureType == NV_ENC_PIC_TYPE_I;
+            WritePacket(lock.bitstreamBufferPtr, lock.bitstreamSizeInBytes, (int64_t)lock.outputTimeStamp, keyframe);
+            api.nvEncUnlockBitstream(m_encoder, slot.bitstream);
+        } else {
+            LOG_ERROR("Error receiving packet");
+        }
+
+        api.nvEncUnmapInputResource(m_encoder, slot.mapped);
+        slot.mapped = nullptr;
+        ReleaseSurface(index);
+    }
+
+    void NvencBackend::FlushSession() {
+        const NV_ENCODE_API_FUNCTION_LIST& api = *GetApi();
+        NV_ENC_PIC_PARAMS eos = {};
+        eos.version = NV_ENC_PIC_PARAMS_VER;
+        eos.encodePicFlags = NV_ENC_PIC_FLAG_EOS;
+        api.nvEncEncodePicture(m_encoder, &eos);
+
+        while (!m_inFlight.empty()) CompleteOldest();
+    }
+}
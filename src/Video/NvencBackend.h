@@ -0,0 +1,43 @@
+#pragma once
+#include "NativeEncoder.h"
+#include <deque>
+
+namespace Video {
+    // NVIDIA's encoder driven through the NVENC API (FFmpeg's MIT-licensed ffnvcodec headers, the driver's
+    // nvEncodeAPI64.dll loaded at runtime). The pool textures are registered with the session once, so a
+    // frame is encoded straight from the surface the projection wrote, without FFmpeg's hw frame pool.
+    class NvencBackend : public NativeEncoder {
+    public:
+        ~NvencBackend();
+
+        std::string GetName() const override;
+
+        // Opens a throwaway session on pDevice: false if the GPU has no NVENC or no encoder for codec,
+        // otherwise the largest frame it accepts
+        static bool QueryCaps(ID3D11Device* pDevice, Codec codec, EncoderCaps& caps);
+
+    protected:
+        bool OpenSession(ID3D11Device* pDevice, const EncoderSettings& settings, AVCodecParameters* codecPar) override;
+        void CloseSession() override;
+        void EncodeSurface(int index, int64_t pts) override;
+        void FlushSession() override;
+
+    private:
+        // Per pool surface. NVENC handles, typed in the SDK header only.
+        struct Slot {
+            void* registered = nullptr; // NV_ENC_REGISTERED_PTR
+            void* mapped = nullptr;     // NV_ENC_INPUT_PTR while encoding
+            void* bitstream = nullptr;  // NV_ENC_OUTPUT_PTR
+        };
+
+        // Locks the oldest frame's bitstream (waiting for it), writes it and frees its surface
+        void CompleteOldest();
+
+        void* m_encoder = nullptr;
+        Codec m_codec = Codec::H264;
+        int m_width = 0;
+        int m_height = 0;
+        std::vector<Slot> m_slots;
+        std::deque<int> m_inFlight; // Encoder thread, in submission order
+    };
+}
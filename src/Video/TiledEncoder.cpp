@@ -0,0 +1,154 @@
+#include "pch.h"
+#include "TiledEncoder.h"
+#include "EncoderFactory.h"
+#include "../Core/Logger.h"
+#include <algorithm>
+
+namespace Video {
+    TiledEncoder::~TiledEncoder() {
+        Finish();
+    }
+
+    std::vector<D3D11_BOX> TiledEncoder::GetTileBoxes(int width, int height, uint32_t tiles, bool rows) {
+        int length = rows ? height : width;
+        int tileLength = (((length + (int)tiles - 1) / (int)tiles) + 15) & ~15;
+
+        std::vector<D3D11_BOX> boxes;
+        for (int start = 0; start < length; start += tileLength) {
+            int end = std::min(length, start + tileLength);
+            D3D11_BOX box = { 0, 0, 0, (UINT)width, (UINT)height, 1 };
+            if (rows) { box.top = (UINT)start; box.bottom = (UINT)end; }
+            else      { box.left = (UINT)start; box.right = (UINT)end; }
+            boxes.push_back(box);
+        }
+        return boxes;
+    }
+
+    bool TiledEncoder::CreateFrameTexture(ID3D11Device* pDevice, int width, int height) {
+        D3D11_TEXTURE2D_DESC desc = {};
+        desc.Width = (UINT)width;
+        desc.Height = (UINT)height;
+        desc.MipLevels = 1;
+        desc.ArraySize = 1;
+        desc.Format = DXGI_FORMAT_NV12;
+        desc.SampleDesc.Count = 1;
+        desc.Usage = D3D11_USAGE_DEFAULT;
+        desc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
+
+        // Same rule as the session pools: UAVs for the fused kernel where NV12 supports them
+        UINT support = 0;
+        if (SUCCEEDED(pDevice->CheckFormatSupport(DXGI_FORMAT_NV12, &support)) && (support & D3D11_FORMAT_SUPPORT_TYPED_UNORDERED_ACCESS_VIEW)) {
+            desc.BindFlags |= D3D11_BIND_UNORDERED_ACCESS;
+            if (SUCCEEDED(pDevice->CreateTexture2D(&desc, nullptr, m_frame.GetAddressOf()))) {
+                m_surfaceBindFlags = desc.BindFlags;
+                return true;
+            }
+            desc.BindFlags &= ~D3D11_BIND_UNORDERED_ACCESS;
+        }
+
+        if (FAILED(pDevice->CreateTexture2D(&desc, nullptr, m_frame.GetAddressOf()))) return false;
+        m_surfaceBindFlags = desc.BindFlags;
+        return true;
+    }
+
+    bool TiledEncoder::Initialize(ID3D11Device* pDevice, const EncoderSettings& settings) {
+        m_boxes = GetTileBoxes(settings.width, settings.height, std::max(settings.tiles, 1u), settings.tileRows);
+        if (!CreateFrameTexture(pDevice, settings.width, settings.height)) {
+            LOG_ERROR("Failed to create tiled encoder frame");
+            return false;
+        }
+
+        m_muxer = std::make_shared<Muxer>();
+        if (!m_muxer->Open(settings.filename, settings.output)) {
+            Finish();
+            return false;
+        }
+
+        // Every tile needs a session, one that can't be opened fails the whole tiled encoder
+        for (const D3D11_BOX& box : m_boxes) {
+            EncoderSettings tile = settings;
+            tile.width = (int)(box.right - box.left);
+            tile.height = (int)(box.bottom - box.top);
+            tile.tiles = 1;
+            tile.muxer = m_muxer;
+
+            std::unique_ptr<Encoder> session = EncoderFactory::Create(pDevice, tile, m_codecPreference);
+            if (!session) {
+                Finish();
+                return false;
+            }
+            m_tiles.push_back(std::move(session));
+        }
+
+        // All streams are known now, the sessions only write packets once frames arrive
+        if (!m_muxer->Start()) {
+            Finish();
+            return false;
+        }
+        return true;
+    }
+
+    void TiledEncoder::EncodeFrame(ID3D11Texture2D* pSourceTexture, UINT sourceSubresource, const D3D11_BOX* sourceBox) {
+        UINT x = sourceBox ? sourceBox->left : 0;
+        UINT y = sourceBox ? sourceBox->top : 0;
+
+        // Every tile gets every frame, so the streams' timestamps stay aligned
+        for (size_t i = 0; i < m_tiles.size(); ++i) {
+            D3D11_BOX box = m_boxes[i];
+            box.left += x; box.right += x;
+            box.top += y; box.bottom += y;
+            m_tiles[i]->EncodeFrame(pSourceTexture, sourceSubresource, &box);
+        }
+    }
+
+    void TiledEncoder::Finish() {
+        for (auto& tile : m_tiles) tile->Finish();
+        m_tiles.clear();
+        if (m_muxer) m_muxer->Close();
+        m_muxer.reset();
+
+        m_boxes.clear();
+        m_frame.Reset();
+        m_surfaceBindFlags = 0;
+    }
+
+    bool TiledEncoder::AcquireSurface(EncoderSurface& surface) {
+        if (!m_frame || m_tiles.empty()) return false;
+
+        // Reused every frame: the tile copies of the previous frame were queued on the same
+        // immediate context ahead of this frame's writes
+        surface.texture = m_frame.Get();
+        surface.arraySlice = 0;
+        surface.frame = this;
+        return true;
+    }
+
+    void TiledEncoder::SubmitSurface(EncoderSurface& surface) {
+        if (!surface.frame) return;
+        EncodeFrame(m_frame.Get());
+        surface = {};
+    }
+
+    void TiledEncoder::DiscardSurface(EncoderSurface& surface) {
+        surface = {};
+    }
+
+    std::string TiledEncoder::GetName() const {
+        std::string name = std::to_string(m_tiles.size()) + " tiles";
+        if (!m_tiles.empty()) name += " of " + m_tiles.front()->GetName();
+        return name;
+    }
+
+    uint64_t TiledEncoder::GetDroppedFrames() const {
+        // Every tile sees every frame, the worst one says how many frames are incomplete
+        uint64_t dropped = 0;
+        for (const auto& tile : m_tiles) dropped = std::max(dropped, tile->GetDroppedFrames());
+        return dropped;
+    }
+
+    uint64_t TiledEncoder::GetQueuedFrames() const {
+        uint64_t queued = 0;
+        for (const auto& tile : m_tiles) queued = std::max(queued, tile->GetQueuedFrames());
+        return queued;
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include "Encoder.h"
+#include "Muxer.h"
+#include <wrl/client.h>
+#include <memory>
+#include <vector>
+
+namespace Video {
+    // Splits frames too large for one encoder session into tiles, each encoded by its own session
+    // (and on GPUs with several encoder engines, in parallel). All tiles go into one MP4 as
+    // synchronized video streams, stream i being tile i from the left or top.
+    //
+    // The projection renders the whole frame into a full-size NV12 surface owned by this class,
+    // SubmitSurface copies each tile's region into its session.
+    class TiledEncoder : public Encoder {
+    public:
+        explicit TiledEncoder(uint32_t codecPreference) : m_codecPreference(codecPreference) {}
+        ~TiledEncoder();
+
+        bool Initialize(ID3D11Device* pDevice, const EncoderSettings& settings) override;
+        void EncodeFrame(ID3D11Texture2D* pSourceTexture, UINT sourceSubresource = 0, const D3D11_BOX* sourceBox = nullptr) override;
+        void Finish() override;
+
+        bool AcquireSurface(EncoderSurface& surface) override;
+        void SubmitSurface(EncoderSurface& surface) override;
+        void DiscardSurface(EncoderSurface& surface) override;
+        UINT GetSurfaceBindFlags() const override { return m_surfaceBindFlags; }
+        std::string GetName() const override;
+        uint64_t GetDroppedFrames() const override;
+        uint64_t GetQueuedFrames() const override;
+
+        // Tile regions of a width x height frame, edges on multiples of 16
+        static std::vector<D3D11_BOX> GetTileBoxes(int width, int height, uint32_t tiles, bool rows);
+
+    private:
+        bool CreateFrameTexture(ID3D11Device* pDevice, int width, int height);
+
+        uint32_t m_codecPreference = 0;
+        std::shared_ptr<Muxer> m_muxer;
+        std::vector<std::unique_ptr<Encoder>> m_tiles;
+        std::vector<D3D11_BOX> m_boxes;
+
+        Microsoft::WRL::ComPtr<ID3D11Texture2D> m_frame; // Full-size NV12
+        UINT m_surfaceBindFlags = 0;
+    };
+}
@@ -1,15 +1,44 @@
 #include "pch.h"
 #include <reshade.hpp>
 #include "Core/Logger.h"
+#include "Core/Config.h"
+#include "Core/Profiler.h"
 #include "Graphics/CubemapManager.h"
+#include "Graphics/LayeredShim.h"
+#include "Graphics/FaceCuller.h"
 
 // Global Manager
 static std::unique_ptr<Graphics::CubemapManager> g_CubemapManager;
+// Vertex shader signatures are collected for the whole device lifetime, not just while a swapchain exists
+static std::unique_ptr<Graphics::LayeredShimCache> g_LayeredShims;
+static std::unique_ptr<Graphics::FaceCuller> g_FaceCuller;
+
+#ifdef WIDECAPTURE_OVERLAY
+static void draw_profiler_overlay(reshade::api::effect_runtime* /*runtime*/)
+{
+    Profiler::DrawOverlay();
+}
+#endif
 
 static void on_init_device(reshade::api::device* device)
 {
     Logger::Init();
+    Config::Load();
     LOG_INFO("Init Device: ", (void*)device);
+    if (Config::Profiling) {
+        Profiler::Enable(Config::ProfilingCsv);
+#ifdef WIDECAPTURE_OVERLAY
+        reshade::register_overlay("WideCapture", draw_profiler_overlay);
+#endif
+    }
+    if (Config::SinglePassLayered) {
+        LOG_INFO("Single-pass layered rendering enabled");
+        g_LayeredShims = std::make_unique<Graphics::LayeredShimCache>();
+    }
+    if (Config::FaceCulling) {
+        LOG_INFO("Per-face culling enabled");
+        g_FaceCuller = std::make_unique<Graphics::FaceCuller>();
+    }
     // Initialize global resources if needed, though usually we wait for swapchain or present
 }
 
@@ -17,6 +46,12 @@ static void on_destroy_device(reshade::api::device* device)
 {
     LOG_INFO("Destroy Device: ", (void*)device);
     g_CubemapManager.reset();
+    g_LayeredShims.reset();
+    g_FaceCuller.reset();
+#ifdef WIDECAPTURE_OVERLAY
+    if (Profiler::IsEnabled()) reshade::unregister_overlay("WideCapture", draw_profiler_overlay);
+#endif
+    Profiler::Shutdown();
     Logger::Shutdown();
 }
 
@@ -25,7 +60,7 @@ static void on_init_swapchain(reshade::api::swapchain* swapchain, bool resize)
     LOG_INFO("Init Swapchain. Resize: ", resize);
     try {
         if (!g_CubemapManager) {
-            g_CubemapManager = std::make_unique<Graphics::CubemapManager>(swapchain->get_device());
+            g_CubemapManager = std::make_unique<Graphics::CubemapManager>(swapchain->get_device(), g_LayeredShims.get(), g_FaceCuller.get());
         }
     } catch (const std::exception& e) {
         LOG_ERROR("Exception in on_init_swapchain: ", e.what());
@@ -34,14 +69,14 @@ static void on_init_swapchain(reshade::api::swapchain* swapchain, bool resize)
     }
 }
 
-static void on_destroy_swapchain(reshade::api::swapchain* /*swapchain*/, bool /*resize*/)
+static void on_destroy_swapchain(reshade::api::swapchain* /*swapchain*/, bool resize)
 {
-    LOG_INFO("Destroy Swapchain");
+    LOG_INFO("Destroy Swapchain. Resize: ", resize);
     try {
-        // We can keep the manager alive during resize, or reset it.
-        // If we reset, we lose recording state.
-        // FIX: We MUST reset it, otherwise we might hold onto invalid resources or obsolete references
-        // which causes crashes on startup when swapchain is resized immediately (0 -> Destroy -> 1).
+        // A resize keeps the manager and its encoder session, so the recording continues in the same file.
+        // The manager holds nothing owned by the swapchain: it reads the back buffer size on every present
+        // and only rebuilds the face resources when the face size changes.
+        if (resize) return;
         g_CubemapManager.reset();
     } catch (const std::exception& e) {
         LOG_ERROR("Exception in on_destroy_swapchain: ", e.what());
@@ -56,6 +91,7 @@ static void on_present(reshade::api::command_queue* queue, reshade::api::swapcha
         if (g_CubemapManager) {
             g_CubemapManager->OnPresent(queue, swapchain);
         }
+        Profiler::EndFrame();
     } catch (const std::exception& e) {
         LOG_ERROR("Exception in on_present: ", e.what());
     } catch (...) {
@@ -88,12 +124,43 @@ static bool on_draw_indexed(reshade::api::command_list* cmd_list, uint32_t index
     return false;
 }
 
+static void on_reset_command_list(reshade::api::command_list* cmd_list)
+{
+    try {
+        if (g_CubemapManager) {
+            g_CubemapManager->OnResetCommandList(cmd_list);
+        }
+    } catch (...) {
+        // Suppress
+    }
+}
+
+static void on_execute_secondary_command_list(reshade::api::command_list* cmd_list, reshade::api::command_list* secondary_cmd_list)
+{
+    try {
+        if (g_CubemapManager) {
+            g_CubemapManager->OnExecuteSecondaryCommandList(cmd_list, secondary_cmd_list);
+        }
+    } catch (...) {
+        // Suppress
+    }
+}
+
+static void on_destroy_command_list(reshade::api::command_list* cmd_list)
+{
+    try {
+        // Also without a manager, the state attached to the command list outlives it
+        Graphics::CubemapManager::OnDestroyCommandList(cmd_list);
+    } catch (...) {
+        // Suppress
+    }
+}
+
 static bool on_update_buffer_region(reshade::api::device* device, const void* data, reshade::api::resource resource, uint64_t /*offset*/, uint64_t size)
 {
     try {
         if (g_CubemapManager) {
-            // static int updateLog = 0;
-            // if (updateLog++ < 20) LOG_INFO("Event: Update Buffer ", (void*)resource.handle, " Size: ", size);
+            LOG_FIRST_N(DEBUG, 20, "Event: Update Buffer ", (void*)resource.handle, " Size: ", size);
             g_CubemapManager->OnUpdateBuffer(device, resource, data, size);
         }
     } catch (...) {
@@ -106,8 +173,7 @@ static void on_map_buffer_region(reshade::api::device* device, reshade::api::res
 {
     try {
         if (g_CubemapManager && data && *data) {
-            // static int mapLog = 0;
-            // if (mapLog++ < 20) LOG_INFO("Event: Map Buffer ", (void*)resource.handle, " Size: ", size);
+            LOG_FIRST_N(DEBUG, 20, "Event: Map Buffer ", (void*)resource.handle, " Size: ", size);
             g_CubemapManager->OnMapBuffer(device, resource, size, *data);
         }
     } catch (...) {
@@ -119,8 +185,7 @@ static void on_unmap_buffer_region(reshade::api::device* device, reshade::api::r
 {
     try {
         if (g_CubemapManager) {
-            // static int unmapLog = 0;
-            // if (unmapLog++ < 20) LOG_INFO("Event: Unmap Buffer ", (void*)resource.handle);
+            LOG_FIRST_N(DEBUG, 20, "Event: Unmap Buffer ", (void*)resource.handle);
             g_CubemapManager->OnUnmapBuffer(device, resource);
         }
     } catch (...) {
@@ -139,6 +204,64 @@ static void on_bind_pipeline(reshade::api::command_list* cmd_list, reshade::api:
     }
 }
 
+static void on_push_descriptors(reshade::api::command_list* cmd_list, reshade::api::shader_stage stages, reshade::api::pipeline_layout layout, uint32_t param_index, const reshade::api::descriptor_table_update& update)
+{
+    try {
+        if (g_CubemapManager) {
+            g_CubemapManager->OnPushDescriptors(cmd_list, stages, layout, param_index, update);
+        }
+    } catch (...) {
+        // Suppress
+    }
+}
+
+static void on_init_pipeline(reshade::api::device* device, reshade::api::pipeline_layout /*layout*/, uint32_t subobject_count, const reshade::api::pipeline_subobject* subobjects, reshade::api::pipeline pipeline)
+{
+    try {
+        if (g_LayeredShims) {
+            g_LayeredShims->OnInitPipeline(device, pipeline, subobject_count, subobjects);
+        }
+    } catch (...) {
+        // Suppress
+    }
+}
+
+static void on_destroy_pipeline(reshade::api::device* /*device*/, reshade::api::pipeline pipeline)
+{
+    try {
+        if (g_LayeredShims) {
+            g_LayeredShims->OnDestroyPipeline(pipeline);
+        }
+    } catch (...) {
+        // Suppress
+    }
+}
+
+static void on_init_resource(reshade::api::device* /*device*/, const reshade::api::resource_desc& desc, const reshade::api::subresource_data* initial_data, reshade::api::resource_usage /*initial_state*/, reshade::api::resource resource)
+{
+    try {
+        if (g_FaceCuller) {
+            g_FaceCuller->OnInitResource(desc, initial_data, resource);
+        }
+    } catch (...) {
+        // Suppress
+    }
+}
+
+static void on_destroy_resource(reshade::api::device* /*device*/, reshade::api::resource resource)
+{
+    try {
+        if (g_CubemapManager) {
+            g_CubemapManager->OnDestroyResource(resource);
+        }
+        if (g_FaceCuller) {
+            g_FaceCuller->OnDestroyResource(resource);
+        }
+    } catch (...) {
+        // Suppress
+    }
+}
+
 // Addon Entry Point
 extern "C" __declspec(dllexport) const char* reshade_addon_name = "WideCapture";
 extern "C" __declspec(dllexport) const char* reshade_addon_description = "Captures 360 video from DX11 games.";
@@ -160,10 +283,18 @@ BOOL APIENTRY DllMain(HMODULE hModule, DWORD fdwReason, LPVOID)
         // Capture Logic Events
         reshade::register_event<reshade::addon_event::draw>(on_draw);
         reshade::register_event<reshade::addon_event::draw_indexed>(on_draw_indexed);
+        reshade::register_event<reshade::addon_event::reset_command_list>(on_reset_command_list);
+        reshade::register_event<reshade::addon_event::execute_secondary_command_list>(on_execute_secondary_command_list);
+        reshade::register_event<reshade::addon_event::destroy_command_list>(on_destroy_command_list);
         reshade::register_event<reshade::addon_event::update_buffer_region>(on_update_buffer_region);
         reshade::register_event<reshade::addon_event::map_buffer_region>(on_map_buffer_region);
         reshade::register_event<reshade::addon_event::unmap_buffer_region>(on_unmap_buffer_region);
         reshade::register_event<reshade::addon_event::bind_pipeline>(on_bind_pipeline);
+        reshade::register_event<reshade::addon_event::push_descriptors>(on_push_descriptors);
+        reshade::register_event<reshade::addon_event::init_pipeline>(on_init_pipeline);
+        reshade::register_event<reshade::addon_event::destroy_pipeline>(on_destroy_pipeline);
+        reshade::register_event<reshade::addon_event::init_resource>(on_init_resource);
+        reshade::register_event<reshade::addon_event::destroy_resource>(on_destroy_resource);
 
         break;
     case DLL_PROCESS_DETACH:
@@ -13,6 +13,13 @@
 #include <DirectXMath.h>
 #include <wrl/client.h>
 
+// The ReShade overlay needs Dear ImGui (external/imgui, the version reshade_overlay.hpp expects).
+// Included here so every translation unit sees the same reshade.hpp.
+#ifdef WIDECAPTURE_OVERLAY
+#define ImTextureID ImU64
+#include <imgui.h>
+#endif
+
 #include <vector>
 #include <string>
 #include <memory>